@@ -0,0 +1,413 @@
+// Microbenchmarks for the noise kernels and heightmap operations
+// Built from this file and every file in src/ except main.cpp
+
+#include "../src/algorithm.h"
+#include "../src/heightmap.h"
+#include "../src/export.h"
+#include "../src/parallel.h"
+#include "../src/query.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cmath>
+#include <random>
+
+using namespace std;
+typedef std::chrono::steady_clock Timer;
+
+// Settings read from the command line
+struct BenchSettings
+{
+	unsigned warmup = 1;			// The number of untimed runs before each benchmark
+	unsigned repetitions = 5;		// The number of timed runs of each benchmark
+	vector<unsigned> sizes = { 256, 1024 };		// The heightmap widths and heights to run each benchmark at
+	vector<unsigned> lattices = { 8, 64, 512 };	// The noise lattice sizes to run each noise benchmark at
+	vector<unsigned> threads;		// The thread counts to run each benchmark with
+	string filter;					// Only run benchmarks with names containing this string
+	string csv_name;				// The file to save results to as CSV, or empty to skip it
+	string json_name;				// The file to save results to as JSON, or empty to skip it
+};
+
+// The timing of a single benchmark configuration
+struct BenchResult
+{
+	string name;
+	string variant;		// The parameters that aren't the size or thread count, such as the lattice size
+	unsigned size;
+	unsigned threads;
+	unsigned repetitions;
+	double samples;		// The number of samples (heights, points or pixels) processed by each run
+	double min_ms;
+	double median_ms;
+	double mean_ms;
+
+	double getNsPerSample() const
+	{
+		return median_ms * 1e6 / samples;
+	}
+	double getSamplesPerSecond() const
+	{
+		return samples / (median_ms * 1e-3);
+	}
+};
+
+// Runs benchmarks and collects their results
+class BenchRunner
+{
+public:
+	BenchRunner(const BenchSettings& _settings) : settings(_settings)
+	{
+	}
+
+	// Check if a benchmark was selected on the command line
+	bool isSelected(const string& name) const
+	{
+		return settings.filter.empty() || name.find(settings.filter) != string::npos;
+	}
+
+	// Time run, calling setup before each run without timing it
+	void measure(const string& name, const string& variant, unsigned size, double samples, const function<void()>& setup, const function<void()>& run)
+	{
+		for (unsigned i = 0; i < settings.warmup; ++i)
+		{
+			setup();
+			run();
+		}
+
+		vector<double> times;
+		for (unsigned i = 0; i < settings.repetitions; ++i)
+		{
+			setup();
+			auto t_start = Timer::now();
+			run();
+			chrono::duration<double, milli> delta = Timer::now() - t_start;
+			times.push_back(delta.count());
+		}
+		sort(times.begin(), times.end());
+
+		BenchResult result;
+		result.name = name;
+		result.variant = variant;
+		result.size = size;
+		result.threads = getThreadCount();
+		result.repetitions = settings.repetitions;
+		result.samples = samples;
+		result.min_ms = times.front();
+		result.median_ms = times.size() % 2 == 1 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) * 0.5;
+		result.mean_ms = 0.0;
+		for (double time : times)
+		{
+			result.mean_ms += time / times.size();
+		}
+		results.push_back(result);
+
+		printf("%-28s %-14s %6u %3u thr %10.3f ms %10.2f ns/sample %12.4g samples/s\n", name.c_str(), variant.c_str(), size, result.threads,
+			result.median_ms, result.getNsPerSample(), result.getSamplesPerSecond());
+		fflush(stdout);
+	}
+	void measure(const string& name, const string& variant, unsigned size, double samples, const function<void()>& run)
+	{
+		measure(name, variant, size, samples, [] {}, run);
+	}
+
+	// Save the results as CSV, with one row for each benchmark configuration
+	void saveCSV(const string& filename) const
+	{
+		ofstream file(filename);
+		file << "benchmark,variant,size,threads,repetitions,samples,min_ms,median_ms,mean_ms,ns_per_sample,samples_per_s\n";
+		for (const BenchResult& result : results)
+		{
+			file << result.name << "," << result.variant << "," << result.size << "," << result.threads << "," << result.repetitions << ","
+				<< result.samples << "," << result.min_ms << "," << result.median_ms << "," << result.mean_ms << ","
+				<< result.getNsPerSample() << "," << result.getSamplesPerSecond() << "\n";
+		}
+		if (!file)
+		{
+			throw runtime_error("Unable to write file " + filename);
+		}
+	}
+
+	// Save the results as JSON, with one object for each benchmark configuration
+	void saveJSON(const string& filename) const
+	{
+		ofstream file(filename);
+		file << "{\n\"hardware_threads\": " << thread::hardware_concurrency() << ",\n\"warmup\": " << settings.warmup << ",\n\"results\": [";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const BenchResult& result = results[i];
+			file << (i == 0 ? "\n" : ",\n") << "{\"benchmark\": \"" << result.name << "\", \"variant\": \"" << result.variant << "\", \"size\": " << result.size
+				<< ", \"threads\": " << result.threads << ", \"repetitions\": " << result.repetitions << ", \"samples\": " << result.samples
+				<< ", \"min_ms\": " << result.min_ms << ", \"median_ms\": " << result.median_ms << ", \"mean_ms\": " << result.mean_ms
+				<< ", \"ns_per_sample\": " << result.getNsPerSample() << ", \"samples_per_s\": " << result.getSamplesPerSecond() << "}";
+		}
+		file << "\n]\n}\n";
+		if (!file)
+		{
+			throw runtime_error("Unable to write file " + filename);
+		}
+	}
+
+private:
+	const BenchSettings& settings;
+	vector<BenchResult> results;
+};
+
+///
+/// Benchmarks
+///
+
+// Sample a noise function over a heightmap for each lattice size
+template <class N>
+void benchNoise(BenchRunner& runner, const BenchSettings& settings, const string& name, unsigned size, const function<N(unsigned lattice)>& create, float (N::* sample)(float, float) const)
+{
+	if (!runner.isSelected(name))
+	{
+		return;
+	}
+
+	Heightmap map(size, size);
+	for (unsigned lattice : settings.lattices)
+	{
+		N noise = create(lattice);
+		runner.measure(name, "lattice=" + to_string(lattice), size, (double)size * size, [&]
+		{
+			map.sample(noise, sample);
+		});
+	}
+}
+
+// Run every benchmark for one heightmap size with the current thread count
+void runBenchmarks(BenchRunner& runner, const BenchSettings& settings, unsigned size)
+{
+	unsigned seed = 1;
+	double cells = (double)size * size;
+
+	benchNoise<GradientNoise>(runner, settings, "GradientNoise::perlin", size, [&](unsigned lattice) { return GradientNoise(lattice, lattice, seed); }, &GradientNoise::perlin);
+	benchNoise<SimplexNoise>(runner, settings, "SimplexNoise::simplex", size, [&](unsigned lattice) { return SimplexNoise(lattice, lattice, seed); }, &SimplexNoise::simplex);
+	benchNoise<ValueNoise>(runner, settings, "ValueNoise::linear", size, [&](unsigned lattice) { return ValueNoise(lattice, lattice, seed); }, &ValueNoise::linear);
+	benchNoise<ValueNoise>(runner, settings, "ValueNoise::cosine", size, [&](unsigned lattice) { return ValueNoise(lattice, lattice, seed); }, &ValueNoise::cosine);
+	benchNoise<ValueNoise>(runner, settings, "ValueNoise::cubic", size, [&](unsigned lattice) { return ValueNoise(lattice, lattice, seed); }, &ValueNoise::cubic);
+
+	// Point noise is sized by the number of points rather than a lattice
+	benchNoise<PointNoise>(runner, settings, "PointNoise::dot", size, [&](unsigned lattice) { return PointNoise(5, 5, lattice, seed); }, &PointNoise::dot);
+	benchNoise<PointNoise>(runner, settings, "PointNoise::worley", size, [&](unsigned lattice) { return PointNoise(5, 5, lattice, seed); }, &PointNoise::worley);
+	benchNoise<GridNoise>(runner, settings, "GridNoise::dot", size, [&](unsigned lattice) { return GridNoise(lattice, lattice, seed); }, &GridNoise::dot);
+	benchNoise<GridNoise>(runner, settings, "GridNoise::worley", size, [&](unsigned lattice) { return GridNoise(lattice, lattice, seed); }, &GridNoise::worley);
+
+	if (runner.isSelected("PlasmaNoise::PlasmaNoise"))
+	{
+		// Plasma noise is sized by the power of two of its width, so use the largest that fits the heightmap
+		unsigned power = 1;
+		while ((2u << power) <= size)
+		{
+			++power;
+		}
+		double points = pow(pow(2.0, power) + 1.0, 2.0);
+		runner.measure("PlasmaNoise::PlasmaNoise", "power=" + to_string(power), size, points, [&]
+		{
+			PlasmaNoise noise(power, seed);
+		});
+	}
+
+	Heightmap map(size, size);
+	GradientNoise noise(64, 64, seed);
+	map.sample(noise, &GradientNoise::perlin);
+
+	if (runner.isSelected("Heightmap::calculateNormals"))
+	{
+		Vectormap normals(size, size), tangents(size, size);
+		runner.measure("Heightmap::calculateNormals", "", size, cells, [&]
+		{
+			map.calculateNormals(normals, tangents);
+		});
+	}
+
+	if (runner.isSelected("MapQuery::query"))
+	{
+		// Scattered points, one per cell, so that sorting has to regroup them
+		vector<Vector2> points((size_t)size * size);
+		default_random_engine random(seed);
+		uniform_real_distribution<float> position(0.0f, (float)size);
+		for (Vector2& point : points)
+		{
+			point = Vector2(position(random), position(random));
+		}
+
+		vector<float> heights;
+		vector<Vector3> normals;
+		QuerySettings bicubic;
+		bicubic.filter = QueryFilter::Bicubic;
+		QuerySettings unsorted;
+		unsorted.sort = false;
+		unique_ptr<HeightField> field = MapGenerator::layeredPerlinField(size, size, seed, 0.0f, 1.0f, 4, 6, 0.5f);
+		runner.measure("MapQuery::query", "bilinear", size, cells, [&] { MapQuery::query(map, points, heights); });
+		runner.measure("MapQuery::query", "bilinear unsorted", size, cells, [&] { MapQuery::query(map, points, heights, nullptr, unsorted); });
+		runner.measure("MapQuery::query", "bicubic", size, cells, [&] { MapQuery::query(map, points, heights, nullptr, bicubic); });
+		runner.measure("MapQuery::query", "bilinear normals", size, cells, [&] { MapQuery::query(map, points, heights, &normals); });
+		runner.measure("MapQuery::query", "perlin field", size, cells, [&] { MapQuery::query(*field, points, heights); });
+	}
+
+	// Arithmetic on a copy, so that repeated runs don't change the heights used by later benchmarks
+	Heightmap work(map);
+	Heightmap16 map16(size, size);
+	map16.set(map);
+	if (runner.isSelected("Heightmap::add"))
+	{
+		runner.measure("Heightmap::add", "constant", size, cells, [&] { work.add(0.001f); });
+		runner.measure("Heightmap::add", "float map", size, cells, [&] { work.add(map); });
+		runner.measure("Heightmap::add", "fixed16 map", size, cells, [&] { work.add(map16); });
+	}
+	if (runner.isSelected("Heightmap::multiply"))
+	{
+		runner.measure("Heightmap::multiply", "constant", size, cells, [&] { work.multiply(1.0001f); });
+		runner.measure("Heightmap::multiply", "float map", size, cells, [&] { work.multiply(map); });
+	}
+	if (runner.isSelected("Heightmap::set"))
+	{
+		runner.measure("Heightmap::set", "float map", size, cells, [&] { work.set(map); });
+		runner.measure("Heightmap16::set", "float map", size, cells, [&] { map16.set(map); });
+	}
+
+	if (runner.isSelected("PixelBuffer::save"))
+	{
+		// Fill and save a 16 bit image the same way as the main export
+		string filename = "benchmark_export.png";
+		runner.measure("PixelBuffer::save", "16 bit", size, cells, [&]
+		{
+			PixelBuffer image(size, size, sizeof(uint16_t));
+			parallelFor(size, [&](unsigned y, unsigned thread)
+			{
+				for (unsigned x = 0; x < size; ++x)
+				{
+					float height = std::min(std::max(map.getHeight(x, y), -1.0f), 1.0f);
+					image.fillPixel(x, y, (uint16_t)((height * 0.5f + 0.5f) * 65535));
+				}
+			});
+			image.save(filename);
+		});
+		remove(filename.c_str());
+	}
+}
+
+// Read a comma separated list of numbers
+vector<unsigned> readList(const string& text)
+{
+	vector<unsigned> values;
+	stringstream list(text);
+	string value;
+	while (getline(list, value, ','))
+	{
+		values.push_back((unsigned)stoul(value));
+	}
+	return values;
+}
+
+int main(int argc, char** argv)
+{
+	BenchSettings settings;
+	for (int i = 1; i < argc; ++i)
+	{
+		string option = argv[i];
+		bool has_value = i + 1 < argc;
+		try
+		{
+			if (option == "--quick")
+			{
+				settings.repetitions = 3;
+				settings.sizes = { 256 };
+				settings.lattices = { 64 };
+			}
+			else if (option == "--warmup" && has_value)
+			{
+				settings.warmup = stoi(argv[++i]);
+			}
+			else if (option == "--reps" && has_value)
+			{
+				settings.repetitions = max(stoi(argv[++i]), 1);
+			}
+			else if (option == "--sizes" && has_value)
+			{
+				settings.sizes = readList(argv[++i]);
+			}
+			else if (option == "--lattices" && has_value)
+			{
+				settings.lattices = readList(argv[++i]);
+			}
+			else if (option == "--threads" && has_value)
+			{
+				settings.threads = readList(argv[++i]);
+			}
+			else if (option == "--filter" && has_value)
+			{
+				settings.filter = argv[++i];
+			}
+			else if (option == "--csv" && has_value)
+			{
+				settings.csv_name = argv[++i];
+			}
+			else if (option == "--json" && has_value)
+			{
+				settings.json_name = argv[++i];
+			}
+			else
+			{
+				cout << "Usage: benchmark [--quick] [--warmup n] [--reps n] [--sizes a,b] [--lattices a,b] [--threads a,b] [--filter name] [--csv file] [--json file]" << endl;
+				return 1;
+			}
+		}
+		catch (exception&)
+		{
+			cout << "Invalid value for " << option << endl;
+			return 1;
+		}
+	}
+
+	// By default, double the thread count from 1 up to the number of hardware threads
+	if (settings.threads.empty())
+	{
+		unsigned hardware = max(thread::hardware_concurrency(), 1u);
+		for (unsigned count = 1; count < hardware; count *= 2)
+		{
+			settings.threads.push_back(count);
+		}
+		settings.threads.push_back(hardware);
+	}
+
+	BenchRunner runner(settings);
+	for (unsigned threads : settings.threads)
+	{
+		setThreadCount(threads);
+		for (unsigned size : settings.sizes)
+		{
+			runBenchmarks(runner, settings, size);
+		}
+	}
+
+	try
+	{
+		if (!settings.csv_name.empty())
+		{
+			runner.saveCSV(settings.csv_name);
+			cout << "Results saved to " << settings.csv_name << endl;
+		}
+		if (!settings.json_name.empty())
+		{
+			runner.saveJSON(settings.json_name);
+			cout << "Results saved to " << settings.json_name << endl;
+		}
+	}
+	catch (exception& e)
+	{
+		cout << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
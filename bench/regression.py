@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+# End-to-end performance regression runner for hmap
+# Runs a fixed set of command lines, records the wall time, peak memory and the time of each stage hmap reports,
+# then compares them against a baseline and fails if anything has slowed down by more than its tolerance
+#
+# Usage: regression.py path/to/hmap [options]
+#	--baseline file		The baseline to compare against (default: baseline.json next to this script)
+#	--update			Save the results as the new baseline instead of comparing them
+#	--sizes a,b,c		The heightmap sizes to run (default: 1024,4096,16384)
+#	--filter text		Only run configurations with names containing this text
+#	--reps n			The number of runs of each configuration, the median time is used (default: 3)
+#	--json file			Also save the results to a file
+
+import json
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+# The canonical configurations, each is run with and without normals at every size
+GENERATORS = [
+	("worley", []),
+	("plasma", ["-g", "plasma", "10"]),
+	("perlin", ["-g", "perlin", "4", "8", "0.5"]),
+	("random", ["-g", "random", "4", "6", "0.5"]),
+]
+DEFAULT_SIZES = [1024, 4096, 16384]
+SEED = "1"
+
+# Used when the baseline doesn't give its own tolerances
+DEFAULT_TOLERANCE = {
+	"time": 0.20,		# The fraction a time may grow by before it is a regression
+	"min_time": 0.05,	# Times that grow by less than this many seconds are never regressions
+	"rss": 0.10,		# The fraction the peak memory may grow by before it is a regression
+	"min_rss_mb": 16.0,	# Peak memory that grows by less than this many megabytes is never a regression
+}
+
+# Matches lines such as "Generating heightmap... 0.25s" and "Calculating normals... (cached) 0.01s"
+STAGE_PATTERN = re.compile(r"^([A-Z][\w ]*)\.\.\. (?:\(cached\) )?([0-9.]+(?:e[-+]?[0-9]+)?)s", re.MULTILINE)
+
+
+def sizeName(size):
+	return "%dk" % (size // 1024) if size % 1024 == 0 else str(size)
+
+
+def getConfigs(sizes, name_filter):
+	configs = []
+	for size in sizes:
+		for name, arguments in GENERATORS:
+			for normals in (False, True):
+				config_name = "%s-%s%s" % (name, sizeName(size), "-normals" if normals else "")
+				if name_filter and name_filter not in config_name:
+					continue
+				flags = ["-s", SEED, "-w", str(size), "-h", str(size)] + arguments + (["-n"] if normals else [])
+				configs.append((config_name, flags))
+	return configs
+
+
+# Run hmap once, returning its wall time, peak resident memory in megabytes and stage times
+def runOnce(hmap, flags, directory):
+	start = time.perf_counter()
+	# The output is relative to the working directory, since hmap takes a leading / as a switch
+	process = subprocess.Popen([hmap, "regression.png"] + flags, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, cwd=directory)
+	text = process.stdout.read().decode(errors="replace")
+	_, status, usage = os.wait4(process.pid, 0)
+	wall = time.perf_counter() - start
+	process.returncode = os.waitstatus_to_exitcode(status)
+	if process.returncode != 0 or "failed:" in text or "saved to" not in text:
+		raise RuntimeError("hmap %s exited with %d:\n%s" % (" ".join(flags), process.returncode, text))
+
+	# ru_maxrss is in kilobytes on Linux and bytes on macOS
+	rss = usage.ru_maxrss / (1024.0 * 1024.0 if sys.platform == "darwin" else 1024.0)
+	stages = {}
+	for stage, seconds in STAGE_PATTERN.findall(text):
+		stages[stage] = stages.get(stage, 0.0) + float(seconds)
+
+	# Clear out the outputs so large runs don't fill the disk
+	for name in os.listdir(directory):
+		os.remove(os.path.join(directory, name))
+	return wall, rss, stages
+
+
+def median(values):
+	values = sorted(values)
+	middle = len(values) // 2
+	return values[middle] if len(values) % 2 else (values[middle - 1] + values[middle]) / 2.0
+
+
+def runConfig(hmap, flags, repetitions, directory):
+	runs = [runOnce(hmap, flags, directory) for _ in range(repetitions)]
+	stages = {}
+	for stage in runs[0][2]:
+		stages[stage] = round(median([run[2].get(stage, 0.0) for run in runs]), 4)
+	return {
+		"wall": round(median([run[0] for run in runs]), 4),
+		"rss_mb": round(max(run[1] for run in runs), 1),
+		"stages": stages,
+	}
+
+
+def getMachine():
+	return "%s %s, %d threads" % (platform.system(), platform.machine(), os.cpu_count() or 1)
+
+
+# Compare one measurement against its baseline, returning a description of the regression or None
+def checkValue(label, value, base, fraction, minimum, unit):
+	if value > base * (1.0 + fraction) and value - base > minimum:
+		return "%s: %.3f%s -> %.3f%s (+%.0f%%, limit +%.0f%%)" % (label, base, unit, value, unit, (value / max(base, 1e-9) - 1.0) * 100.0, fraction * 100.0)
+	return None
+
+
+def compare(name, result, base, tolerance):
+	regressions = []
+	check = lambda *args: regressions.append(checkValue(*args))
+	check("%s wall time" % name, result["wall"], base["wall"], tolerance["time"], tolerance["min_time"], "s")
+	check("%s peak memory" % name, result["rss_mb"], base["rss_mb"], tolerance["rss"], tolerance["min_rss_mb"], "MB")
+	for stage, seconds in result["stages"].items():
+		if stage in base.get("stages", {}):
+			check("%s %s" % (name, stage.lower()), seconds, base["stages"][stage], tolerance["time"], tolerance["min_time"], "s")
+	return [regression for regression in regressions if regression is not None]
+
+
+def main(arguments):
+	if not arguments or arguments[0].startswith("-"):
+		print("Usage: regression.py path/to/hmap [--baseline file] [--update] [--sizes a,b,c] [--filter text] [--reps n] [--json file]")
+		return 2
+
+	hmap = os.path.abspath(arguments[0])
+	baseline_name = os.path.join(os.path.dirname(os.path.abspath(__file__)), "baseline.json")
+	update = False
+	sizes = DEFAULT_SIZES
+	name_filter = ""
+	repetitions = 3
+	json_name = ""
+	i = 1
+	while i < len(arguments):
+		option = arguments[i]
+		value = arguments[i + 1] if i + 1 < len(arguments) else None
+		if option == "--update":
+			update = True
+			i += 1
+			continue
+		if value is None:
+			print("Missing value for %s" % option)
+			return 2
+		if option == "--baseline":
+			baseline_name = value
+		elif option == "--sizes":
+			sizes = [int(size) for size in value.split(",")]
+		elif option == "--filter":
+			name_filter = value
+		elif option == "--reps":
+			repetitions = max(int(value), 1)
+		elif option == "--json":
+			json_name = value
+		else:
+			print("Unknown option %s" % option)
+			return 2
+		i += 2
+
+	baseline = {}
+	if os.path.exists(baseline_name):
+		with open(baseline_name) as file:
+			baseline = json.load(file)
+	tolerance = dict(DEFAULT_TOLERANCE, **baseline.get("tolerance", {}))
+	base_configs = baseline.get("configs", {})
+	if not update and baseline.get("machine", getMachine()) != getMachine():
+		print("Warning: the baseline was recorded on %s, this machine is %s" % (baseline["machine"], getMachine()))
+
+	results = {}
+	regressions = []
+	directory = tempfile.mkdtemp(prefix="hmap_regression_")
+	try:
+		print("%-24s %10s %10s %10s  %s" % ("Configuration", "Wall (s)", "Base (s)", "RSS (MB)", "Stages (s)"))
+		for name, flags in getConfigs(sizes, name_filter):
+			result = runConfig(hmap, flags, repetitions, directory)
+			results[name] = result
+			base = base_configs.get(name)
+			stages = ", ".join("%s %.3f" % (stage.lower(), seconds) for stage, seconds in result["stages"].items())
+			print("%-24s %10.3f %10s %10.1f  %s" % (name, result["wall"], "%.3f" % base["wall"] if base else "-", result["rss_mb"], stages), flush=True)
+			if base and not update:
+				regressions += compare(name, result, base, tolerance)
+	finally:
+		shutil.rmtree(directory, ignore_errors=True)
+
+	if json_name:
+		with open(json_name, "w") as file:
+			json.dump({"machine": getMachine(), "configs": results}, file, indent="\t")
+
+	if update:
+		# Keep the results of configurations that weren't run this time
+		base_configs.update(results)
+		with open(baseline_name, "w") as file:
+			json.dump({"machine": getMachine(), "tolerance": tolerance, "configs": base_configs}, file, indent="\t", sort_keys=True)
+		print("\nBaseline saved to %s" % baseline_name)
+		return 0
+
+	missing = [name for name in results if name not in base_configs]
+	if missing:
+		print("\nNo baseline for: %s" % ", ".join(missing))
+	if regressions:
+		print("\n" + "!" * 60)
+		print("PERFORMANCE REGRESSION in %d measurement%s:" % (len(regressions), "" if len(regressions) == 1 else "s"))
+		for regression in regressions:
+			print("  " + regression)
+		print("!" * 60)
+		return 1
+
+	print("\nNo regressions against %s" % baseline_name)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main(sys.argv[1:]))
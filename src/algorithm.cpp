@@ -1,6 +1,9 @@
 #include "algorithm.h"
+#include "simd.h"
+#include "trace.h"
 
 #include <random>
+#include <cmath>
 #include <stdexcept>
 
 constexpr float pi = 3.141592f;
@@ -34,6 +37,39 @@ inline float fade(float t)
 	return t * t * t * (t * (t * 6 - 15) + 10);
 }
 
+// Round towards negative infinity
+inline int fastFloor(float t)
+{
+	int i = (int)t;
+	return t < i ? i - 1 : i;
+}
+
+// Wrap a lattice index around a lattice of the given size
+inline unsigned wrapIndex(int i, unsigned size)
+{
+	i %= (int)size;
+	return (unsigned)(i < 0 ? i + (int)size : i);
+}
+
+// The lattice points either side of a scaled coordinate, and how far the coordinate is between them
+struct LatticeSpan
+{
+	unsigned first;
+	unsigned second;
+	float t;
+};
+
+// Find the lattice points either side of a scaled coordinate, wrapping them around a lattice of the given size if wrap is set
+inline LatticeSpan getSpan(float t, unsigned size, bool wrap)
+{
+	int i = wrap ? fastFloor(t) : (int)t;
+	LatticeSpan span;
+	span.t = t - i;
+	span.first = wrap ? wrapIndex(i, size) : (unsigned)i;
+	span.second = wrap ? wrapIndex(i + 1, size) : (unsigned)(i + 1);
+	return span;
+}
+
 ///
 /// Base noise
 ///
@@ -48,15 +84,39 @@ unsigned Noise::getHeight() const
 	return height;
 }
 
+bool Noise::isWrapped() const
+{
+	return wrap;
+}
+
+Vector2 Noise::wrapLocation(float x, float y) const
+{
+	if (wrap)
+	{
+		x = std::fmod(x, (float)width);
+		y = std::fmod(y, (float)height);
+		x = x < 0.0f ? x + width : x;
+		y = y < 0.0f ? y + height : y;
+
+		// Adding the width to a tiny negative remainder can round up to the width itself
+		x = x < width ? x : 0.0f;
+		y = y < height ? y : 0.0f;
+	}
+	return Vector2(x, y);
+}
+
 ///
 /// Perlin and simplex noise
 ///
 
-GradientNoise::GradientNoise(unsigned _width, unsigned _height, unsigned seed)
+GradientNoise::GradientNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap)
 {
+	TraceSpan span("Build lattice");
+
 	width = _width;
 	height = _height;
-	gradient = new Vector2[width * height];
+	wrap = _wrap;
+	gradient.resize((size_t)width * height);
 
 	// Generate gradient vectors
 	std::default_random_engine rando(seed);
@@ -73,26 +133,16 @@ GradientNoise::GradientNoise(unsigned _width, unsigned _height, unsigned seed)
 	}
 }
 
-GradientNoise::GradientNoise(const GradientNoise& copy)
-{
-	width = copy.width;
-	height = copy.height;
-	gradient = new Vector2[width * height];
-	memcpy(gradient, copy.gradient, width * height * sizeof(Vector2));
-}
-
-GradientNoise::~GradientNoise()
+GradientNoise GradientNoise::clone() const
 {
-	if (gradient != nullptr)
-	{
-		delete[] gradient;
-	}
+	return *this;
 }
 
 void GradientNoise::scale(unsigned sample_width, unsigned sample_height)
 {
-	scale_x = (float)(width - 1) / sample_width;
-	scale_y = (float)(height - 1) / sample_height;
+	// Wrapping noise uses the whole lattice, as the last lattice point is followed by the first
+	scale_x = (float)(wrap ? width : width - 1) / sample_width;
+	scale_y = (float)(wrap ? height : height - 1) / sample_height;
 }
 
 Vector2 GradientNoise::getGradient(unsigned x, unsigned y) const
@@ -106,23 +156,21 @@ float GradientNoise::perlin(float x, float y) const
 	x *= scale_x;
 	y *= scale_y;
 
-	// Get the coordinates of the grid cell containing x, y
-	int X = (int)x;
-	int Y = (int)y;
-
-	// Subtract the cell coordinates from x and y to get their fractional portion
-	x -= X;
-	y -= Y;
+	// Get the grid cell containing x, y and the fractional portion of x and y within it
+	LatticeSpan span_x = getSpan(x, width, wrap);
+	LatticeSpan span_y = getSpan(y, height, wrap);
+	x = span_x.t;
+	y = span_y.t;
 
 	// Get the fade curves of the coordinates
 	float u = fade(x);
 	float v = fade(y);
 
 	// Get the gradients at the corner of the unit cell
-	Vector2 g00 = gradient[Y * width + X];
-	Vector2 g01 = gradient[(Y + 1) * width + X];
-	Vector2 g10 = gradient[Y * width + X + 1];
-	Vector2 g11 = gradient[(Y + 1) * width + X + 1];
+	Vector2 g00 = gradient[span_y.first * width + span_x.first];
+	Vector2 g01 = gradient[span_y.second * width + span_x.first];
+	Vector2 g10 = gradient[span_y.first * width + span_x.second];
+	Vector2 g11 = gradient[span_y.second * width + span_x.second];
 
 	// Interpolate the dot products of each gradient and the cell coordinates
 	return lerp(u,
@@ -131,15 +179,242 @@ float GradientNoise::perlin(float x, float y) const
 	);
 }
 
+// Skewing factors for transforming between the square grid and the simplex grid
+constexpr float skew_f2 = 0.36602540378f;		// (sqrt(3) - 1) / 2
+constexpr float skew_g2 = 0.21132486540f;		// (3 - sqrt(3)) / 6
+
+// Gradient directions used by simplex noise
+constexpr float simplex_grad_x[12] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0 };
+constexpr float simplex_grad_y[12] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1 };
+
+SimplexNoise::SimplexNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap)
+{
+	TraceSpan span("Build lattice");
+
+	if (_wrap)
+	{
+		throw std::logic_error("Simplex noise can't wrap");
+	}
+
+	width = _width;
+	height = _height;
+
+	// Shuffle the permutation table
+	for (unsigned i = 0; i < 256; ++i)
+	{
+		perm[i] = (unsigned char)i;
+	}
+	std::default_random_engine rando(seed);
+	std::shuffle(perm, perm + 256, rando);
+	for (unsigned i = 0; i < 256; ++i)
+	{
+		perm[i + 256] = perm[i];
+	}
+
+	// Cache the gradient for each hash value
+	for (unsigned i = 0; i < 512; ++i)
+	{
+		grad_x[i] = simplex_grad_x[perm[i] % 12];
+		grad_y[i] = simplex_grad_y[perm[i] % 12];
+	}
+}
+
+SimplexNoise SimplexNoise::clone() const
+{
+	return *this;
+}
+
+void SimplexNoise::scale(unsigned sample_width, unsigned sample_height)
+{
+	scale_x = (float)(width - 1) / sample_width;
+	scale_y = (float)(height - 1) / sample_height;
+}
+
+float SimplexNoise::simplex(float x, float y) const
+{
+	// Scale noise values
+	x *= scale_x;
+	y *= scale_y;
+
+	// Skew the coordinates to find the simplex cell containing x, y
+	float s = (x + y) * skew_f2;
+	int i = fastFloor(x + s);
+	int j = fastFloor(y + s);
+
+	// Unskew the cell origin to get the distance to the first corner
+	float t = (i + j) * skew_g2;
+	float x0 = x - (i - t);
+	float y0 = y - (j - t);
+
+	// Determine which of the two triangles in the cell contains the point
+	int i1 = x0 > y0 ? 1 : 0;
+	int j1 = 1 - i1;
+
+	// Distances to the middle and last corners
+	float x1 = x0 - i1 + skew_g2;
+	float y1 = y0 - j1 + skew_g2;
+	float x2 = x0 - 1.0f + 2.0f * skew_g2;
+	float y2 = y0 - 1.0f + 2.0f * skew_g2;
+
+	// Hash the corners of the simplex to get their gradients
+	int ii = i & 255;
+	int jj = j & 255;
+	int g0 = ii + perm[jj];
+	int g1 = ii + i1 + perm[jj + j1];
+	int g2 = ii + 1 + perm[jj + 1];
+
+	// Add the contribution from each corner
+	float n = 0.0f;
+	float t0 = 0.5f - x0 * x0 - y0 * y0;
+	if (t0 > 0.0f)
+	{
+		t0 *= t0;
+		n += t0 * t0 * (grad_x[g0] * x0 + grad_y[g0] * y0);
+	}
+	float t1 = 0.5f - x1 * x1 - y1 * y1;
+	if (t1 > 0.0f)
+	{
+		t1 *= t1;
+		n += t1 * t1 * (grad_x[g1] * x1 + grad_y[g1] * y1);
+	}
+	float t2 = 0.5f - x2 * x2 - y2 * y2;
+	if (t2 > 0.0f)
+	{
+		t2 *= t2;
+		n += t2 * t2 * (grad_x[g2] * x2 + grad_y[g2] * y2);
+	}
+
+	// Scale the result to fit within [-1, 1]
+	return 70.0f * n;
+}
+
+#ifdef USE_SSE2
+// Get simplex noise at four scaled coordinates at once, using a permutation table and gradients from SimplexNoise
+static inline __m128 simplex4(__m128 vx, __m128 vy, const unsigned char* perm, const float* grad_x, const float* grad_y)
+{
+	const __m128 f2 = _mm_set1_ps(skew_f2);
+	const __m128 g2 = _mm_set1_ps(skew_g2);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	// Skew the coordinates to find the simplex cells
+	__m128 s = _mm_mul_ps(_mm_add_ps(vx, vy), f2);
+	__m128 fi = floor4(_mm_add_ps(vx, s));
+	__m128 fj = floor4(_mm_add_ps(vy, s));
+
+	// Unskew the cell origins
+	__m128 t = _mm_mul_ps(_mm_add_ps(fi, fj), g2);
+	__m128 x0 = _mm_sub_ps(vx, _mm_sub_ps(fi, t));
+	__m128 y0 = _mm_sub_ps(vy, _mm_sub_ps(fj, t));
+
+	// Pick the middle corner of each simplex
+	__m128 i1 = _mm_and_ps(_mm_cmpgt_ps(x0, y0), one);
+	__m128 j1 = _mm_sub_ps(one, i1);
+
+	__m128 x1 = _mm_add_ps(_mm_sub_ps(x0, i1), g2);
+	__m128 y1 = _mm_add_ps(_mm_sub_ps(y0, j1), g2);
+	__m128 x2 = _mm_add_ps(_mm_sub_ps(x0, one), _mm_add_ps(g2, g2));
+	__m128 y2 = _mm_add_ps(_mm_sub_ps(y0, one), _mm_add_ps(g2, g2));
+
+	// Hash the corners of each simplex
+	alignas(16) int ci[4], cj[4], ci1[4];
+	_mm_store_si128((__m128i*)ci, _mm_cvttps_epi32(fi));
+	_mm_store_si128((__m128i*)cj, _mm_cvttps_epi32(fj));
+	_mm_store_si128((__m128i*)ci1, _mm_cvttps_epi32(i1));
+
+	alignas(16) float gx0[4], gy0[4], gx1[4], gy1[4], gx2[4], gy2[4];
+	for (unsigned l = 0; l < 4; ++l)
+	{
+		int ii = ci[l] & 255;
+		int jj = cj[l] & 255;
+		int a = ii + perm[jj];
+		int b = ii + ci1[l] + perm[jj + 1 - ci1[l]];
+		int c = ii + 1 + perm[jj + 1];
+		gx0[l] = grad_x[a];
+		gy0[l] = grad_y[a];
+		gx1[l] = grad_x[b];
+		gy1[l] = grad_y[b];
+		gx2[l] = grad_x[c];
+		gy2[l] = grad_y[c];
+	}
+
+	// Add the contribution from each corner
+	__m128 t0 = _mm_max_ps(_mm_sub_ps(half, _mm_add_ps(_mm_mul_ps(x0, x0), _mm_mul_ps(y0, y0))), zero);
+	__m128 t1 = _mm_max_ps(_mm_sub_ps(half, _mm_add_ps(_mm_mul_ps(x1, x1), _mm_mul_ps(y1, y1))), zero);
+	__m128 t2 = _mm_max_ps(_mm_sub_ps(half, _mm_add_ps(_mm_mul_ps(x2, x2), _mm_mul_ps(y2, y2))), zero);
+	t0 = _mm_mul_ps(t0, t0);
+	t1 = _mm_mul_ps(t1, t1);
+	t2 = _mm_mul_ps(t2, t2);
+
+	__m128 n = _mm_mul_ps(_mm_mul_ps(t0, t0), _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx0), x0), _mm_mul_ps(_mm_load_ps(gy0), y0)));
+	n = _mm_add_ps(n, _mm_mul_ps(_mm_mul_ps(t1, t1), _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx1), x1), _mm_mul_ps(_mm_load_ps(gy1), y1))));
+	n = _mm_add_ps(n, _mm_mul_ps(_mm_mul_ps(t2, t2), _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx2), x2), _mm_mul_ps(_mm_load_ps(gy2), y2))));
+
+	return _mm_mul_ps(n, _mm_set1_ps(70.0f));
+}
+#endif
+
+void SimplexNoise::simplexRow(float x, float y, unsigned count, float* out) const
+{
+	unsigned k = 0;
+
+#ifdef USE_SSE2
+	// Sample four points at a time
+	const __m128 sx = _mm_set1_ps(scale_x);
+	const __m128 vy = _mm_set1_ps(y * scale_y);
+	const __m128 steps = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128 vx = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(x + k), steps), sx);
+		_mm_storeu_ps(out + k, simplex4(vx, vy, perm, grad_x, grad_y));
+	}
+#endif
+
+	// Sample any remaining points one at a time
+	for (; k < count; ++k)
+	{
+		out[k] = simplex(x + k, y);
+	}
+}
+
+void SimplexNoise::simplexPoints(const float* x, const float* y, unsigned count, float* out) const
+{
+	unsigned k = 0;
+
+#ifdef USE_SSE2
+	// Sample four points at a time
+	const __m128 sx = _mm_set1_ps(scale_x);
+	const __m128 sy = _mm_set1_ps(scale_y);
+
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128 vx = _mm_mul_ps(_mm_loadu_ps(x + k), sx);
+		__m128 vy = _mm_mul_ps(_mm_loadu_ps(y + k), sy);
+		_mm_storeu_ps(out + k, simplex4(vx, vy, perm, grad_x, grad_y));
+	}
+#endif
+
+	// Sample any remaining points one at a time
+	for (; k < count; ++k)
+	{
+		out[k] = simplex(x[k], y[k]);
+	}
+}
+
 ///
 /// Value & diamond square noise
 ///
 
-ValueNoise::ValueNoise(unsigned _width, unsigned _height, unsigned seed)
+ValueNoise::ValueNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap)
 {
+	TraceSpan span("Build lattice");
+
 	width = _width;
 	height = _height;
-	value = new float[width * height];
+	wrap = _wrap;
+	value.resize((size_t)width * height);
 
 	// Generate random values at each grid point
 	std::default_random_engine rando(seed);
@@ -153,26 +428,16 @@ ValueNoise::ValueNoise(unsigned _width, unsigned _height, unsigned seed)
 	}
 }
 
-ValueNoise::ValueNoise(const ValueNoise& copy)
+ValueNoise ValueNoise::clone() const
 {
-	width = copy.width;
-	height = copy.height;
-	value = new float[width * height];
-	memcpy(value, copy.value, width * height * sizeof(float));
-}
-
-ValueNoise::~ValueNoise()
-{
-	if (value != nullptr)
-	{
-		delete[] value;
-	}
+	return *this;
 }
 
 void ValueNoise::scale(unsigned sample_width, unsigned sample_height)
 {
-	scale_x = (float)(width - 1) / sample_width;
-	scale_y = (float)(height - 1) / sample_height;
+	// Wrapping noise uses the whole lattice, as the last lattice point is followed by the first
+	scale_x = (float)(wrap ? width : width - 1) / sample_width;
+	scale_y = (float)(wrap ? height : height - 1) / sample_height;
 }
 
 float ValueNoise::getValue(unsigned x, unsigned y) const
@@ -186,18 +451,18 @@ float ValueNoise::linear(float x, float y) const
 	x *= scale_x;
 	y *= scale_y;
 
-	// Get the coordinates of the grid cell containing x, y
-	int X = (int)x;
-	int Y = (int)y;
-
-	// Subtract the cell coordinates from x and y to get their fractional portion
-	x -= X;
-	y -= Y;
+	// Get the grid cell containing x, y and the fractional portion of x and y within it
+	LatticeSpan span_x = getSpan(x, width, wrap);
+	LatticeSpan span_y = getSpan(y, height, wrap);
+	x = span_x.t;
+	y = span_y.t;
+	unsigned top = span_y.first * width;
+	unsigned bottom = span_y.second * width;
 
 	// Interpolate the noise
 	return lerp(x,
-		lerp(y, value[Y * width + X],			value[(Y + 1) * width + X]),
-		lerp(y, value[Y * width + (X + 1)],		value[(Y + 1) * width + (X + 1)])
+		lerp(y, value[top + span_x.first],		value[bottom + span_x.first]),
+		lerp(y, value[top + span_x.second],		value[bottom + span_x.second])
 	);
 }
 
@@ -207,18 +472,18 @@ float ValueNoise::cosine(float x, float y) const
 	x *= scale_x;
 	y *= scale_y;
 
-	// Get the coordinates of the grid cell containing x, y
-	int X = (int)x;
-	int Y = (int)y;
-
-	// Subtract the cell coordinates from x and y to get their fractional portion
-	x -= X;
-	y -= Y;
+	// Get the grid cell containing x, y and the fractional portion of x and y within it
+	LatticeSpan span_x = getSpan(x, width, wrap);
+	LatticeSpan span_y = getSpan(y, height, wrap);
+	x = span_x.t;
+	y = span_y.t;
+	unsigned top = span_y.first * width;
+	unsigned bottom = span_y.second * width;
 
 	// Interpolate the noise
 	return corp(x,
-		corp(y, value[Y * width + X], value[(Y + 1) * width + X]),
-		corp(y, value[Y * width + (X + 1)], value[(Y + 1) * width + (X + 1)])
+		corp(y, value[top + span_x.first], value[bottom + span_x.first]),
+		corp(y, value[top + span_x.second], value[bottom + span_x.second])
 	);
 }
 
@@ -228,6 +493,33 @@ float ValueNoise::cubic(float x, float y) const
 	x *= scale_x;
 	y *= scale_y;
 
+	if (wrap)
+	{
+		// Every point around the cell exists when the lattice wraps, so no points need to be extrapolated
+		int X = fastFloor(x);
+		int Y = fastFloor(y);
+		x -= X;
+		y -= Y;
+
+		unsigned columns[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			columns[i] = wrapIndex(X + i - 1, width);
+		}
+
+		float a[4], p[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			const float* row = value.data() + (size_t)wrapIndex(Y + j - 1, height) * width;
+			for (int i = 0; i < 4; ++i)
+			{
+				p[i] = row[columns[i]];
+			}
+			a[j] = curp(x, p);
+		}
+		return std::min(1.0f, std::max(curp(y, a), -1.0f));
+	}
+
 	// Get the coordinates of the grid cell containing x, y
 	int X = (int)x;
 	int Y = (int)y;
@@ -349,11 +641,14 @@ float ValueNoise::cubic(float x, float y) const
 	return std::min(1.0f, std::max(curp(y, a), -1.0f));
 }
 
-PlasmaNoise::PlasmaNoise(unsigned size, unsigned seed)
+PlasmaNoise::PlasmaNoise(unsigned size, unsigned seed, bool _wrap)
 {
-	width = (unsigned)pow(2, size) + 1;
+	TraceSpan span("Build lattice");
+
+	wrap = _wrap;
+	width = (unsigned)pow(2, size) + (wrap ? 0 : 1);
 	height = width;
-	value = new float[width * height];
+	value.resize((size_t)width * height);
 
 	std::default_random_engine rando(seed);
 	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
@@ -361,6 +656,56 @@ PlasmaNoise::PlasmaNoise(unsigned size, unsigned seed)
 	// The range of the random values generated
 	float range = 0.5;
 
+	if (wrap)
+	{
+		// A single corner is shared by every cell of the repeating lattice
+		value[0] = dist(rando) * range;
+
+		// Diamond-square algorithm, reading neighbours across the edges of the lattice
+		unsigned mask = width - 1;
+		for (unsigned stride = width; stride > 1; stride /= 2)
+		{
+			range *= 0.5;
+			unsigned half = stride / 2;
+
+			// Diamond step
+			for (unsigned y = 0; y < height; y += stride)
+			{
+				for (unsigned x = 0; x < width; x += stride)
+				{
+					// Get the values of the four grid points at the corner of the current grid point
+					float v00 = value[y * width + x];
+					float v10 = value[y * width + ((x + stride) & mask)];
+					float v01 = value[((y + stride) & mask) * width + x];
+					float v11 = value[((y + stride) & mask) * width + ((x + stride) & mask)];
+
+					// Set the value of the current point to the average of the corners + a random value
+					value[(y + half) * width + (x + half)] = (v00 + v10 + v01 + v11) / 4.0f + dist(rando) * range;
+				}
+			}
+
+			// Square step, where every point has four neighbours once the edges wrap
+			bool offset = true;
+			for (unsigned y = 0; y < height; y += half)
+			{
+				for (unsigned x = offset ? half : 0; x < width; x += stride)
+				{
+					// Get the values of the four grid points adjacent the current grid point
+					float v_top = value[((y - half) & mask) * width + x];
+					float v_bottom = value[((y + half) & mask) * width + x];
+					float v_left = value[y * width + ((x - half) & mask)];
+					float v_right = value[y * width + ((x + half) & mask)];
+
+					// Set the value of the current point to the average of the adjacent points + a random value
+					value[y * width + x] = (v_top + v_bottom + v_left + v_right) / 4.0f + dist(rando) * range;
+				}
+
+				offset = !offset;
+			}
+		}
+		return;
+	}
+
 	// Generate corner values
 	value[0] = dist(rando) * range;
 	value[width - 1] = dist(rando) * range;
@@ -458,22 +803,22 @@ PlasmaNoise::PlasmaNoise(unsigned size, unsigned seed)
 	}
 }
 
-PlasmaNoise::PlasmaNoise(const PlasmaNoise& copy)
+PlasmaNoise PlasmaNoise::clone() const
 {
-	width = copy.width;
-	height = copy.height;
-	value = new float[width * height];
-	memcpy(value, copy.value, width * height * sizeof(float));
+	return *this;
 }
 
 ///
 /// Random point noise
 ///
 
-PointNoise::PointNoise(unsigned x_bias, unsigned y_bias, unsigned num_points, unsigned seed)
+PointNoise::PointNoise(unsigned x_bias, unsigned y_bias, unsigned num_points, unsigned seed, bool _wrap)
 {
+	TraceSpan span("Build lattice");
+
 	width = x_bias;
 	height = y_bias;
+	wrap = _wrap;
 	array_size = width * height;
 
 	// Generate points using random x and y values
@@ -481,42 +826,34 @@ PointNoise::PointNoise(unsigned x_bias, unsigned y_bias, unsigned num_points, un
 	std::uniform_real_distribution<float> x_dist(0.0f, (float)width);
 	std::uniform_real_distribution<float> y_dist(0.0f, (float)height);
 
-	points = new std::vector<Vector2>[array_size];
+	// Generate the points, then sort them into their cells, keeping the order they were generated in within each cell
+	std::vector<Vector2> generated;
+	generated.reserve(num_points);
+	cell_start.assign(array_size + 1, 0);
 	for (unsigned i = 0; i < num_points; ++i)
 	{
 		Vector2 point(x_dist(rando), y_dist(rando));
-
-		// Add the point to the point grid
-		int X = (int)point.x;
-		int Y = (int)point.y;
-		points[X + Y * width].push_back(point);
+		generated.push_back(point);
+		cell_start[(int)point.x + (int)point.y * width + 1]++;
 	}
-}
-
-PointNoise::PointNoise(const PointNoise& copy)
-{
-	width = copy.width;
-	height = copy.height;
-	array_size = copy.array_size;
-
-	points = new std::vector<Vector2>[array_size];
 	for (unsigned i = 0; i < array_size; ++i)
 	{
-		for (unsigned j = 0; j < copy.points[i].size(); ++j)
-		{
-			points[i].push_back(copy.points[i][j]);
-		}
+		cell_start[i + 1] += cell_start[i];
 	}
-}
 
-PointNoise::~PointNoise()
-{
-	if (points != nullptr)
+	points.resize(num_points);
+	std::vector<unsigned> next(cell_start.begin(), cell_start.end() - 1);
+	for (const Vector2& point : generated)
 	{
-		delete[] points;
+		points[next[(int)point.x + (int)point.y * width]++] = point;
 	}
 }
 
+PointNoise PointNoise::clone() const
+{
+	return *this;
+}
+
 void PointNoise::scale(unsigned sample_width, unsigned sample_height)
 {
 	scale_x = (float)width / sample_width;
@@ -534,6 +871,33 @@ Vector2 PointNoise::getNearest(Vector2 location) const
 	// The distance to the closest point
 	float nearest_distance = (float)width;
 
+	if (wrap)
+	{
+		// Check the surrounding cells across the edges of the lattice, moving their points next to the current point
+		for (int y = Y; y < Y + 3; ++y)
+		{
+			unsigned cell_y = wrapIndex(y, height);
+			float shift_y = (float)(y - (int)cell_y);
+			for (int x = X; x < X + 3; ++x)
+			{
+				unsigned cell_x = wrapIndex(x, width);
+				float shift_x = (float)(x - (int)cell_x);
+				unsigned cell = cell_y * width + cell_x;
+				for (unsigned i = cell_start[cell]; i < cell_start[cell + 1]; ++i)
+				{
+					Vector2 point(points[i].x + shift_x, points[i].y + shift_y);
+					float dist = distance2D(location, point);
+					if (dist < nearest_distance)
+					{
+						nearest_distance = dist;
+						nearest = point;
+					}
+				}
+			}
+		}
+		return nearest;
+	}
+
 	// Check each grid cell surrounding the cell containing to current point
 	for (unsigned y = 0; y < 3; ++y)
 	{
@@ -545,15 +909,14 @@ Vector2 PointNoise::getNearest(Vector2 location) const
 			if (cell > -1 && cell < (long)array_size)
 			{
 				// Check each point in the cell
-				std::vector<Vector2>* point_data = &points[cell];
-				for (unsigned i = 0; i < point_data->size(); ++i)
+				for (unsigned i = cell_start[cell]; i < cell_start[cell + 1]; ++i)
 				{
 					// Check the distance to the point
-					float dist = distance2D(location, point_data->at(i));
+					float dist = distance2D(location, points[i]);
 					if (dist < nearest_distance)
 					{
 						nearest_distance = dist;
-						nearest = point_data->at(i);
+						nearest = points[i];
 					}
 				}
 			}
@@ -570,7 +933,7 @@ float PointNoise::dot(float x, float y) const
 	y *= scale_y;
 
 	// Get the nearest neighbor to the current point
-	Vector2 loc(x, y);
+	Vector2 loc = wrapLocation(x, y);
 	Vector2 nearest = getNearest(loc);
 
 	// Calculate the noise value based on distance
@@ -586,7 +949,7 @@ float PointNoise::worley(float x, float y) const
 	y *= scale_y;
 
 	// Get the nearest neighbor to the current point
-	Vector2 loc(x, y);
+	Vector2 loc = wrapLocation(x, y);
 	Vector2 nearest = getNearest(loc);
 
 	// Calculate the noise value based on distance
@@ -595,17 +958,20 @@ float PointNoise::worley(float x, float y) const
 	return std::min(1.0f, value);
 }
 
-GridNoise::GridNoise(unsigned _width, unsigned _height, unsigned seed)
+GridNoise::GridNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap)
 {
+	TraceSpan span("Build lattice");
+
 	width = _width;
 	height = _height;
+	wrap = _wrap;
 	array_size = width * height;
 
 	// Generate points at random locations within a unit grid
 	std::default_random_engine rando(seed);
 	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
 
-	points = new Vector2[array_size];
+	points.resize(array_size);
 	for (unsigned y = 0; y < height; ++y)
 	{
 		for (unsigned x = 0; x < width; ++x)
@@ -617,21 +983,9 @@ GridNoise::GridNoise(unsigned _width, unsigned _height, unsigned seed)
 	}
 }
 
-GridNoise::GridNoise(const GridNoise& copy)
-{
-	width = copy.width;
-	height = copy.height;
-	array_size = copy.array_size;
-	points = new Vector2[array_size];
-	memcpy(points, copy.points, array_size * sizeof(Vector2));
-}
-
-GridNoise::~GridNoise()
+GridNoise GridNoise::clone() const
 {
-	if (points != nullptr)
-	{
-		delete[] points;
-	}
+	return *this;
 }
 
 inline Vector2 GridNoise::getPoint(unsigned x, unsigned y) const
@@ -650,6 +1004,29 @@ inline Vector2 GridNoise::getNearest(Vector2 location) const
 	// The distance to the closest point
 	float nearest_distance = (float)width;
 
+	if (wrap)
+	{
+		// Check the surrounding cells across the edges of the lattice, moving their points next to the current point
+		for (int y = Y; y < Y + 3; ++y)
+		{
+			unsigned cell_y = wrapIndex(y, height);
+			float shift_y = (float)(y - (int)cell_y);
+			for (int x = X; x < X + 3; ++x)
+			{
+				unsigned cell_x = wrapIndex(x, width);
+				float shift_x = (float)(x - (int)cell_x);
+				Vector2 point(points[cell_y * width + cell_x].x + shift_x, points[cell_y * width + cell_x].y + shift_y);
+				float dist = distance2D(location, point);
+				if (dist < nearest_distance)
+				{
+					nearest_distance = dist;
+					nearest = point;
+				}
+			}
+		}
+		return nearest;
+	}
+
 	// Check each grid cell surrounding the cell containing to current point
 	for (unsigned y = 0; y < 3; ++y)
 	{
@@ -681,7 +1058,7 @@ float GridNoise::dot(float x, float y) const
 	y *= scale_y;
 
 	// Get the nearest neighbor to the current point
-	Vector2 loc(x, y);
+	Vector2 loc = wrapLocation(x, y);
 	Vector2 nearest = getNearest(loc);
 
 	// Calculate the noise value based on distance
@@ -697,7 +1074,7 @@ float GridNoise::worley(float x, float y) const
 	y *= scale_y;
 
 	// Get the nearest neighbor to the current point
-	Vector2 loc(x, y);
+	Vector2 loc = wrapLocation(x, y);
 	Vector2 nearest = getNearest(loc);
 
 	// Calculate the noise value based on distance
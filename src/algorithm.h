@@ -14,6 +14,8 @@ inline float corp(float t, float a, float b);
 inline float curp(float t, float a[4]);
 // Perlin smoothstep function
 inline float fade(float t);
+// Round towards negative infinity
+inline int fastFloor(float t);
 
 // The square of the distance between two vectors in the x and y dimensions
 template <class T>
@@ -25,17 +27,32 @@ float distance2D(const T& a, const T& b)
 	return dx * dx + dy * dy;
 }
 
+/*
+ * Noise sampled from a lattice, scaled so that the lattice covers a given number of samples
+ *
+ * Noise constructed with wrap set repeats across the edges of its lattice: lattice indices wrap around the lattice, and
+ * point noise searches the cells across the opposite edge. The whole lattice is then scaled across the samples, so
+ * the noise tiles seamlessly every sample_width by sample_height samples.
+ */
 class Noise
 {
 public:
+	virtual ~Noise() {};
+
 	unsigned getWidth() const;
 	unsigned getHeight() const;
+	// Check if the noise wraps around the edges of its lattice
+	bool isWrapped() const;
 
 	virtual void scale(unsigned sample_width, unsigned sample_height) = 0;
 
 protected:
+	// Wrap a scaled location onto the lattice if the noise wraps
+	Vector2 wrapLocation(float x, float y) const;
+
 	unsigned width = 0;
 	unsigned height = 0;
+	bool wrap = false;
 
 	float scale_x = 0.0f;
 	float scale_y = 0.0f;
@@ -45,9 +62,10 @@ protected:
 class GradientNoise : public Noise
 {
 public:
-	GradientNoise(unsigned _width, unsigned _height, unsigned seed);
-	GradientNoise(const GradientNoise& copy);
-	virtual ~GradientNoise();
+	GradientNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap = false);
+
+	// Make a copy of the noise, including its lattice
+	GradientNoise clone() const;
 
 	virtual void scale(unsigned sample_width, unsigned sample_height) override;
 
@@ -58,7 +76,41 @@ public:
 	float perlin(float x, float y) const;
 
 protected:
-	Vector2* gradient = nullptr;
+	std::vector<Vector2> gradient;
+};
+
+// Noise generated by hashing gradients onto the corners of a grid of triangles
+class SimplexNoise : public Noise
+{
+public:
+	// The skewed simplex lattice doesn't repeat across a rectangle, so simplex noise can't wrap
+	// (THROWS logic_error if wrap is set)
+	SimplexNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap = false);
+
+	// Make a copy of the noise, including its permutation table
+	SimplexNoise clone() const;
+
+	virtual void scale(unsigned sample_width, unsigned sample_height) override;
+
+	// Get simplex noise at the specified coordinate
+	float simplex(float x, float y) const;
+	// Get simplex noise for a row of count samples starting at the specified coordinate, writing the results to out
+	// Samples are taken in groups of row_group, with any left over sampled by simplex(), so two rows starting at
+	// multiples of row_group give identical samples where they overlap unless one of them ends part way through a group
+	void simplexRow(float x, float y, unsigned count, float* out) const;
+
+	// Get simplex noise at count separate coordinates, writing the results to out
+	// Points are sampled in groups of row_group with the same kernel as simplexRow, with any left over sampled by simplex()
+	void simplexPoints(const float* x, const float* y, unsigned count, float* out) const;
+
+	static constexpr unsigned row_group = 4;
+
+protected:
+	// Permutation table used to hash lattice points, repeated twice to avoid wrapping indices
+	unsigned char perm[512];
+	// The gradient selected by each entry of the permutation table
+	float grad_x[512];
+	float grad_y[512];
 };
 
 // Noise generated by creating a grid of random values
@@ -66,9 +118,10 @@ class ValueNoise : public Noise
 {
 public:
 	ValueNoise() {};
-	ValueNoise(unsigned _width, unsigned _height, unsigned seed);
-	ValueNoise(const ValueNoise& copy);
-	virtual ~ValueNoise();
+	ValueNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap = false);
+
+	// Make a copy of the noise, including its lattice
+	ValueNoise clone() const;
 
 	virtual void scale(unsigned sample_width, unsigned sample_height) override;
 
@@ -83,15 +136,19 @@ public:
 	virtual float cubic(float x, float y) const;
 
 protected:
-	float* value = nullptr;
+	std::vector<float> value;
 };
 
 // A value noise grid created using the diamond square algorithm
 class PlasmaNoise : public ValueNoise
 {
 public:
-	PlasmaNoise(unsigned size, unsigned seed);
-	PlasmaNoise(const PlasmaNoise& copy);
+	// A wrapping plasma lattice is built with the diamond-square steps reaching across its edges, so it has no edge row or
+	// column and is 2 ^ size points wide rather than (2 ^ size) + 1
+	PlasmaNoise(unsigned size, unsigned seed, bool _wrap = false);
+
+	// Make a copy of the noise, including its lattice
+	PlasmaNoise clone() const;
 };
 
 // Noise generated by choosing random points in a given area
@@ -99,9 +156,10 @@ class PointNoise : public Noise
 {
 public:
 	PointNoise() {};
-	PointNoise(unsigned x_bias, unsigned y_bias, unsigned points, unsigned seed);
-	PointNoise(const PointNoise& copy);
-	virtual ~PointNoise();
+	PointNoise(unsigned x_bias, unsigned y_bias, unsigned points, unsigned seed, bool _wrap = false);
+
+	// Make a copy of the noise, including its points
+	PointNoise clone() const;
 
 	virtual void scale(unsigned sample_width, unsigned sample_height) override;
 
@@ -117,7 +175,8 @@ private:
 	// Get the closest point to the provided point in the given cell
 	//inline void getNearestPoint(Vector2 location, Vector2& nearest, float& distance);
 
-	std::vector<Vector2>* points = nullptr;
+	std::vector<Vector2> points;		// Every point, grouped by the grid cell it is in
+	std::vector<unsigned> cell_start;	// The index of the first point in each cell, followed by the number of points
 	unsigned array_size = 0;
 };
 
@@ -125,9 +184,10 @@ private:
 class GridNoise : public PointNoise
 {
 public:
-	GridNoise(unsigned _width, unsigned _height, unsigned seed);
-	GridNoise(const GridNoise& copy);
-	virtual ~GridNoise();
+	GridNoise(unsigned _width, unsigned _height, unsigned seed, bool _wrap = false);
+
+	// Make a copy of the noise, including its points
+	GridNoise clone() const;
 
 	// Get the point in the provided grid cell
 	inline Vector2 getPoint(unsigned x, unsigned y) const;
@@ -143,6 +203,6 @@ private:
 	// Get the closest point to the provided point in the given cell
 	//inline void getNearestPoint(Vector2 location, Vector2& nearest, float& distance);
 
-	Vector2* points = nullptr;
+	std::vector<Vector2> points;
 	unsigned array_size = 0;
 };
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "allocstats.h"
+
+#include <new>
+#include <atomic>
+#include <vector>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#define getAllocationSize _msize
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define getAllocationSize malloc_size
+#else
+#include <malloc.h>
+#define getAllocationSize malloc_usable_size
+#endif
+
+bool AllocStats::enabled = false;
+
+namespace
+{
+	std::atomic<int64_t> allocation_count(0);
+	std::atomic<int64_t> allocated_bytes(0);
+	std::atomic<int64_t> live_bytes(0);
+	std::atomic<int64_t> peak_bytes(0);
+
+	// The allocations made by a finished stage
+	struct StageTotals
+	{
+		const char* name;
+		int64_t count;
+		int64_t bytes;
+		int64_t peak;
+	};
+
+	std::vector<StageTotals> stages;
+
+	// Raise the peak to a live size if it is higher
+	void updatePeak(int64_t live)
+	{
+		int64_t peak = peak_bytes.load(std::memory_order_relaxed);
+		while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// Sizes are taken from the allocator, so an allocation and its free always count the same number of bytes
+	void countAllocation(void* pointer)
+	{
+		int64_t size = (int64_t)getAllocationSize(pointer);
+		allocation_count.fetch_add(1, std::memory_order_relaxed);
+		allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+		updatePeak(live_bytes.fetch_add(size, std::memory_order_relaxed) + size);
+	}
+
+	void countFree(void* pointer)
+	{
+		live_bytes.fetch_sub((int64_t)getAllocationSize(pointer), std::memory_order_relaxed);
+	}
+
+	double toMegabytes(int64_t bytes)
+	{
+		return bytes / (1024.0 * 1024.0);
+	}
+}
+
+void AllocStats::enable()
+{
+	enabled = true;
+}
+
+AllocStats::Totals AllocStats::beginStage()
+{
+	Totals start = { allocation_count.load(), allocated_bytes.load(), live_bytes.load(), peak_bytes.load() };
+	peak_bytes.store(start.live);
+	return start;
+}
+
+void AllocStats::endStage(const char* stage, const Totals& start)
+{
+	int64_t peak = peak_bytes.load();
+	stages.push_back({ stage, allocation_count.load() - start.count, allocated_bytes.load() - start.bytes, peak - start.live });
+	updatePeak(start.peak);
+}
+
+void AllocStats::printSummary(std::ostream& out)
+{
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+	out << "\n" << std::left << std::setw(24) << "Stage" << std::right << std::setw(14) << "Allocations" << std::setw(16) << "Allocated (MB)"
+		<< std::setw(14) << "Peak (MB)" << "\n";
+	for (const StageTotals& stage : stages)
+	{
+		out << std::left << std::setw(24) << stage.name << std::right << std::setw(14) << stage.count << std::setw(16) << toMegabytes(stage.bytes)
+			<< std::setw(14) << toMegabytes(std::max(stage.peak, (int64_t)0)) << "\n";
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
+
+///
+/// Replacement allocation functions
+///
+
+void* operator new(size_t size)
+{
+	void* pointer = std::malloc(size > 0 ? size : 1);
+	if (pointer == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	if (AllocStats::enabled)
+	{
+		countAllocation(pointer);
+	}
+	return pointer;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	if (pointer != nullptr)
+	{
+		if (AllocStats::enabled)
+		{
+			countFree(pointer);
+		}
+		std::free(pointer);
+	}
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+	operator delete(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+	operator delete(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+	operator delete(pointer);
+}
\ No newline at end of file
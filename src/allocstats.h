@@ -0,0 +1,65 @@
+#pragma once
+
+#include <ostream>
+#include <cstdint>
+
+/*
+ * Counting of heap allocations, for finding allocations that scale with the size of the heightmap
+ *
+ * allocstats.cpp replaces the global operator new and delete, so every allocation made with new, including those made by
+ * standard containers, is counted. Memory that libpng and zlib allocate with malloc is not. While counting is disabled
+ * the operators only check a flag.
+ */
+namespace AllocStats
+{
+	// Set to true while allocations are being counted
+	extern bool enabled;
+
+	// The allocations made so far
+	struct Totals
+	{
+		int64_t count;		// The number of allocations
+		int64_t bytes;		// The total size of every allocation
+		int64_t live;		// The size of the allocations that haven't been freed
+		int64_t peak;		// The largest live size since the current stage started
+	};
+
+	// Start counting allocations
+	void enable();
+
+	// Get the current totals and restart the peak for a new stage
+	Totals beginStage();
+	// Record the allocations made since a stage began, and restore the peak of any stage it was part of
+	void endStage(const char* stage, const Totals& start);
+
+	// Print the allocation count, bytes allocated and peak memory above the starting point of each recorded stage
+	void printSummary(std::ostream& out);
+}
+
+// Counts allocations between its construction and destruction as a stage if allocation counting is enabled
+// The name must outlive the counts, so it should be a string literal
+class AllocStage
+{
+public:
+	AllocStage(const char* _name) : name(_name)
+	{
+		if (AllocStats::enabled)
+		{
+			start = AllocStats::beginStage();
+		}
+	}
+	~AllocStage()
+	{
+		if (AllocStats::enabled)
+		{
+			AllocStats::endStage(name, start);
+		}
+	}
+
+	AllocStage(const AllocStage&) = delete;
+	AllocStage& operator=(const AllocStage&) = delete;
+
+private:
+	const char* name;
+	AllocStats::Totals start;
+};
\ No newline at end of file
@@ -0,0 +1,288 @@
+#include "cache.h"
+#include "mappedfile.h"
+
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Increase when a change to the generators or the file format makes existing cache files invalid
+constexpr uint32_t cache_version = 3;
+
+// The header at the start of each cache file, padded so that the data after it is aligned
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t type;
+	uint32_t width;
+	uint32_t height;
+	uint64_t block_size;
+	uint8_t padding[32];
+};
+
+static const char cache_magic[8] = { 'H', 'M', 'A', 'P', 'S', 'T', 'G', 0 };
+
+// The type of data stored in a cache file
+enum CacheType : uint32_t
+{
+	CacheFloat = 1,
+	CacheFixed16 = 2,
+	CacheHalf = 3,
+	CacheNormals = 4
+};
+
+template <class T>
+static uint32_t getCacheType();
+
+template <>
+uint32_t getCacheType<float>()
+{
+	return CacheFloat;
+}
+
+template <>
+uint32_t getCacheType<fixed16>()
+{
+	return CacheFixed16;
+}
+
+template <>
+uint32_t getCacheType<half>()
+{
+	return CacheHalf;
+}
+
+///
+/// Cache keys
+///
+
+CacheKey::CacheKey()
+{
+	add((uint64_t)cache_version);
+}
+
+CacheKey& CacheKey::add(const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return *this;
+}
+
+CacheKey& CacheKey::add(const std::string& text)
+{
+	// Include the length so that adjacent strings can't run together
+	add((uint64_t)text.size());
+	return add(text.data(), text.size());
+}
+
+CacheKey& CacheKey::add(uint64_t value)
+{
+	return add(&value, sizeof(value));
+}
+
+CacheKey& CacheKey::add(float value)
+{
+	return add(&value, sizeof(value));
+}
+
+std::string CacheKey::getName() const
+{
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+	return name;
+}
+
+///
+/// Stage cache
+///
+
+StageCache::StageCache(const std::string& _directory, uint64_t _max_size)
+{
+	directory = _directory;
+	max_size = _max_size;
+
+	std::error_code error;
+	fs::create_directories(directory, error);
+}
+
+// Map a cache file and check that its header matches the expected data
+// Returns nullptr if the file is missing or invalid
+static std::shared_ptr<MappedFile> openCacheFile(const fs::path& path, uint32_t type, unsigned blocks, size_t element_size)
+{
+	std::error_code error;
+	if (!fs::is_regular_file(path, error))
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<MappedFile> file;
+	try
+	{
+		file = std::make_shared<MappedFile>(path.string());
+	}
+	catch (std::exception&)
+	{
+		return nullptr;
+	}
+
+	CacheHeader header;
+	if (file->getSize() < sizeof(CacheHeader))
+	{
+		return nullptr;
+	}
+	memcpy(&header, file->getData(), sizeof(CacheHeader));
+
+	if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version || header.type != type
+		|| header.block_size != (uint64_t)header.width * header.height * element_size
+		|| file->getSize() != sizeof(CacheHeader) + header.block_size * blocks)
+	{
+		return nullptr;
+	}
+
+	// Mark the file as recently used
+	fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+	return file;
+}
+
+template <class T>
+bool StageCache::load(const CacheKey& key, BasicHeightmap<T>& map)
+{
+	std::shared_ptr<MappedFile> file = openCacheFile(fs::path(directory) / (key.getName() + ".hmc"), getCacheType<T>(), 1, sizeof(T));
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	CacheHeader header;
+	memcpy(&header, file->getData(), sizeof(CacheHeader));
+	map.view((const T*)(file->getData() + sizeof(CacheHeader)), header.width, header.height, file);
+	return true;
+}
+
+bool StageCache::load(const CacheKey& key, Vectormap& normal, Vectormap& tangent)
+{
+	std::shared_ptr<MappedFile> file = openCacheFile(fs::path(directory) / (key.getName() + ".hmc"), CacheNormals, 2, sizeof(Vector3));
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	// Copy the normals and tangents out of the mapped file
+	CacheHeader header;
+	memcpy(&header, file->getData(), sizeof(CacheHeader));
+	normal.resize(header.width, header.height);
+	tangent.resize(header.width, header.height);
+	const unsigned char* data = file->getData() + sizeof(CacheHeader);
+	memcpy(normal.getData(), data, header.block_size);
+	memcpy(tangent.getData(), data + header.block_size, header.block_size);
+	return true;
+}
+
+template <class T>
+void StageCache::store(const CacheKey& key, const BasicHeightmap<T>& map)
+{
+	size_t block_size = (size_t)map.getWidthX() * map.getWidthY() * sizeof(T);
+	write(key, getCacheType<T>(), map.getWidthX(), map.getWidthY(), map.getData(), nullptr, block_size);
+}
+
+void StageCache::store(const CacheKey& key, const Vectormap& normal, const Vectormap& tangent)
+{
+	size_t block_size = (size_t)normal.getWidthX() * normal.getWidthY() * sizeof(Vector3);
+	write(key, CacheNormals, normal.getWidthX(), normal.getWidthY(), normal.getData(), tangent.getData(), block_size);
+}
+
+void StageCache::write(const CacheKey& key, uint32_t type, unsigned width, unsigned height, const void* a, const void* b, size_t block_size)
+{
+	CacheHeader header = {};
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = cache_version;
+	header.type = type;
+	header.width = width;
+	header.height = height;
+	header.block_size = block_size;
+
+	// Write to a temporary file first so that other processes never see a partial file
+	fs::path path = fs::path(directory) / (key.getName() + ".hmc");
+	fs::path temp = fs::path(directory) / (key.getName() + ".tmp");
+	FILE* file = fopen(temp.string().c_str(), "wb");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Unable to create cache file " + temp.string());
+	}
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(a, 1, block_size, file) == block_size;
+	if (b != nullptr)
+	{
+		written = written && fwrite(b, 1, block_size, file) == block_size;
+	}
+	written = fclose(file) == 0 && written;
+
+	std::error_code error;
+	if (!written)
+	{
+		fs::remove(temp, error);
+		throw std::runtime_error("Unable to write cache file " + temp.string());
+	}
+
+	// Replace any existing file
+	fs::remove(path, error);
+	fs::rename(temp, path, error);
+	if (error)
+	{
+		fs::remove(temp, error);
+		throw std::runtime_error("Unable to write cache file " + path.string());
+	}
+
+	evict();
+}
+
+void StageCache::evict()
+{
+	struct CacheFile
+	{
+		fs::path path;
+		fs::file_time_type time;
+		uint64_t size;
+	};
+
+	// Find every cache file and the total size of the cache
+	std::vector<CacheFile> files;
+	uint64_t total = 0;
+	std::error_code error;
+	for (const fs::directory_entry& entry : fs::directory_iterator(directory, error))
+	{
+		if (entry.path().extension() == ".hmc" && entry.is_regular_file(error))
+		{
+			CacheFile file = { entry.path(), entry.last_write_time(error), entry.file_size(error) };
+			total += file.size;
+			files.push_back(file);
+		}
+	}
+
+	// Delete the least recently used files first
+	std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.time < b.time; });
+	for (unsigned i = 0; i < files.size() && total > max_size; ++i)
+	{
+		if (fs::remove(files[i].path, error))
+		{
+			total -= files[i].size;
+		}
+	}
+}
+
+// Instantiate the cache functions for each heightmap storage type
+template bool StageCache::load(const CacheKey&, BasicHeightmap<float>&);
+template bool StageCache::load(const CacheKey&, BasicHeightmap<fixed16>&);
+template bool StageCache::load(const CacheKey&, BasicHeightmap<half>&);
+template void StageCache::store(const CacheKey&, const BasicHeightmap<float>&);
+template void StageCache::store(const CacheKey&, const BasicHeightmap<fixed16>&);
+template void StageCache::store(const CacheKey&, const BasicHeightmap<half>&);
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "heightmap.h"
+
+#include <string>
+#include <cstdint>
+
+// A hash of everything that affects the output of a pipeline stage
+class CacheKey
+{
+public:
+	// Create a key for the current version of the cache format and generators
+	CacheKey();
+
+	// Add raw bytes to the key
+	CacheKey& add(const void* data, size_t size);
+	// Add a string to the key
+	CacheKey& add(const std::string& text);
+	// Add a number to the key
+	CacheKey& add(uint64_t value);
+	CacheKey& add(float value);
+
+	// Get the name of the cache file for the key
+	std::string getName() const;
+
+private:
+	// 64 bit FNV-1a hash
+	uint64_t hash = 14695981039346656037ull;
+};
+
+/*
+ * A directory of cached pipeline stages, each stored in a file named after the hash of its inputs
+ *
+ * Files are stored uncompressed and memory mapped when loaded. When the total size of the cache goes over its limit,
+ * the least recently used files are deleted.
+ */
+class StageCache
+{
+public:
+	/*
+	 * directory:	The directory cached files are stored in - it is created if it does not exist
+	 * max_size:	The maximum size of all cached files in bytes
+	 */
+	StageCache(const std::string& directory, uint64_t max_size);
+
+	// Load a cached heightmap as a read-only view of the cache file
+	// Returns false if the heightmap is not cached
+	template <class T>
+	bool load(const CacheKey& key, BasicHeightmap<T>& map);
+	// Load cached normals and tangents
+	// Returns false if they are not cached
+	bool load(const CacheKey& key, Vectormap& normal, Vectormap& tangent);
+
+	// Add a heightmap to the cache
+	// (THROWS runtime_error if the file can't be written)
+	template <class T>
+	void store(const CacheKey& key, const BasicHeightmap<T>& map);
+	// Add normals and tangents to the cache
+	// (THROWS runtime_error if the file can't be written)
+	void store(const CacheKey& key, const Vectormap& normal, const Vectormap& tangent);
+
+private:
+	// Write a cache file made of a header and one or two blocks of data
+	void write(const CacheKey& key, uint32_t type, unsigned width, unsigned height, const void* a, const void* b, size_t block_size);
+	// Delete the least recently used files until the cache fits within its size limit
+	void evict();
+
+	std::string directory;
+	uint64_t max_size;
+};
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "contour.h"
+#include "parallel.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+// The width and height in cells of the tiles traced by each work item
+constexpr unsigned contour_tile_size = 128;
+
+// A piece of a contour line, starting and ending on the edges of cells
+// Edges are numbered 2 * (y * width_x + x) for the edge from (x, y) to (x + 1, y) and one more for (x, y) to (x, y + 1)
+struct ContourPiece
+{
+	unsigned level;
+	uint64_t start;
+	uint64_t end;
+	bool closed;
+	std::vector<float> points;
+};
+
+// Join pieces that end where another starts into longer pieces, where each edge starts at most one piece of each level
+static void joinPieces(std::vector<ContourPiece>& pieces, unsigned level_count, std::vector<ContourPiece>& joined)
+{
+	std::unordered_map<uint64_t, size_t> starts;
+	std::vector<bool> has_previous(pieces.size(), false);
+	std::vector<bool> used(pieces.size(), false);
+	auto getKey = [level_count](unsigned level, uint64_t edge)
+	{
+		return edge * level_count + level;
+	};
+	for (size_t i = 0; i < pieces.size(); ++i)
+	{
+		starts[getKey(pieces[i].level, pieces[i].start)] = i;
+	}
+	for (size_t i = 0; i < pieces.size(); ++i)
+	{
+		auto next = starts.find(getKey(pieces[i].level, pieces[i].end));
+		if (next != starts.end() && !pieces[i].closed)
+		{
+			has_previous[next->second] = true;
+		}
+	}
+
+	// Follow each line from its first piece, then follow the loops that are left from any piece
+	for (unsigned pass = 0; pass < 2; ++pass)
+	{
+		for (size_t i = 0; i < pieces.size(); ++i)
+		{
+			if (used[i] || (pass == 0 && has_previous[i]))
+			{
+				continue;
+			}
+
+			ContourPiece line = std::move(pieces[i]);
+			used[i] = true;
+			while (!line.closed)
+			{
+				auto next = starts.find(getKey(line.level, line.end));
+				if (next == starts.end() || used[next->second])
+				{
+					break;
+				}
+
+				// The first point of the next piece is the same as the last point of the line
+				ContourPiece& piece = pieces[next->second];
+				used[next->second] = true;
+				line.points.insert(line.points.end(), piece.points.begin() + 2, piece.points.end());
+				line.end = piece.end;
+				line.closed = line.end == line.start;
+			}
+			joined.push_back(std::move(line));
+		}
+	}
+}
+
+template <class T>
+void MapContour::extract(const BasicHeightmap<T>& map, const std::vector<float>& levels, std::vector<Contour>& contours)
+{
+	contours.clear();
+	std::vector<float> sorted = levels;
+	std::sort(sorted.begin(), sorted.end());
+	sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	if (width_x < 2 || width_y < 2 || sorted.empty())
+	{
+		return;
+	}
+
+	// Each work item traces one tile of cells, where a cell is the square between four heights
+	unsigned cells_x = width_x - 1;
+	unsigned cells_y = width_y - 1;
+	unsigned tiles_x = (cells_x + contour_tile_size - 1) / contour_tile_size;
+	unsigned tiles_y = (cells_y + contour_tile_size - 1) / contour_tile_size;
+	std::vector<std::vector<ContourPiece>> tiles(tiles_x * tiles_y);
+	parallelFor(tiles_x * tiles_y, [&](unsigned tile, unsigned thread)
+	{
+		unsigned start_x = (tile % tiles_x) * contour_tile_size;
+		unsigned start_y = (tile / tiles_x) * contour_tile_size;
+		unsigned end_x = std::min(start_x + contour_tile_size, cells_x);
+		unsigned end_y = std::min(start_y + contour_tile_size, cells_y);
+
+		std::vector<ContourPiece> pieces;
+		for (unsigned y = start_y; y < end_y; ++y)
+		{
+			for (unsigned x = start_x; x < end_x; ++x)
+			{
+				// Corners and edges go clockwise from the top left, and edge i goes from corner i to corner i + 1
+				float corners[4] = { map.getHeight(x, y), map.getHeight(x + 1, y), map.getHeight(x + 1, y + 1), map.getHeight(x, y + 1) };
+				uint64_t edges[4] =
+				{
+					2 * ((uint64_t)y * width_x + x),
+					2 * ((uint64_t)y * width_x + x + 1) + 1,
+					2 * ((uint64_t)(y + 1) * width_x + x),
+					2 * ((uint64_t)y * width_x + x) + 1
+				};
+
+				// Only levels above the lowest corner and at or below the highest corner cross the cell
+				float low = std::min(std::min(corners[0], corners[1]), std::min(corners[2], corners[3]));
+				float high = std::max(std::max(corners[0], corners[1]), std::max(corners[2], corners[3]));
+				unsigned first = (unsigned)(std::upper_bound(sorted.begin(), sorted.end(), low) - sorted.begin());
+				unsigned last = (unsigned)(std::upper_bound(sorted.begin(), sorted.end(), high) - sorted.begin());
+				for (unsigned level = first; level < last; ++level)
+				{
+					float value = sorted[level];
+
+					// Find where the level crosses each edge, noting whether the edge goes up or down through it
+					unsigned count = 0;
+					unsigned crossings[4];
+					bool rising[4];
+					float points[4][2];
+					for (unsigned i = 0; i < 4; ++i)
+					{
+						bool above = corners[i] >= value;
+						if (above == (corners[(i + 1) % 4] >= value))
+						{
+							continue;
+						}
+
+						// Interpolate from the top or left end of the edge, so that both cells sharing it find the same point
+						static const float offsets[4][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 0 } };
+						static const float directions[4][2] = { { 1, 0 }, { 0, 1 }, { 1, 0 }, { 0, 1 } };
+						float from = i < 2 ? corners[i] : corners[(i + 1) % 4];
+						float to = i < 2 ? corners[(i + 1) % 4] : corners[i];
+						float t = (value - from) / (to - from);
+						crossings[count] = i;
+						rising[count] = !above;
+						points[count][0] = x + offsets[i][0] + directions[i][0] * t;
+						points[count][1] = y + offsets[i][1] + directions[i][1] * t;
+						++count;
+					}
+
+					// Each piece goes from a rising crossing to a falling one, so higher ground is always on the same side
+					// In saddles, pair each rising crossing with the falling crossing before it if the centre is high,
+					// so that the high corners are joined, or with the one after it if the centre is low
+					bool centre_above = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f >= value;
+					for (unsigned i = 0; i < count; ++i)
+					{
+						if (!rising[i])
+						{
+							continue;
+						}
+						unsigned j = count == 4 && centre_above ? (i + count - 1) % count : (i + 1) % count;
+
+						ContourPiece piece;
+						piece.level = level;
+						piece.start = edges[crossings[i]];
+						piece.end = edges[crossings[j]];
+						piece.closed = false;
+						piece.points = { points[i][0], points[i][1], points[j][0], points[j][1] };
+						pieces.push_back(std::move(piece));
+					}
+				}
+			}
+		}
+
+		joinPieces(pieces, (unsigned)sorted.size(), tiles[tile]);
+	});
+
+	// Join the lines that cross the edges of the tiles
+	std::vector<ContourPiece> open;
+	std::vector<ContourPiece> lines;
+	for (std::vector<ContourPiece>& tile : tiles)
+	{
+		for (ContourPiece& piece : tile)
+		{
+			if (piece.closed)
+			{
+				lines.push_back(std::move(piece));
+			}
+			else
+			{
+				open.push_back(std::move(piece));
+			}
+		}
+	}
+	joinPieces(open, (unsigned)sorted.size(), lines);
+
+	std::stable_sort(lines.begin(), lines.end(), [](const ContourPiece& a, const ContourPiece& b) { return a.level < b.level; });
+	contours.resize(lines.size());
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		contours[i].level = sorted[lines[i].level];
+		contours[i].closed = lines[i].closed;
+		contours[i].points = std::move(lines[i].points);
+	}
+}
+
+void MapContour::saveGeoJSON(const std::vector<Contour>& contours, const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Unable to create file " + filename);
+	}
+
+	fprintf(file, "{\"type\":\"FeatureCollection\",\"features\":[");
+	for (size_t i = 0; i < contours.size(); ++i)
+	{
+		// Start a new feature for each level, as the contours are sorted by level
+		bool first_line = i == 0 || contours[i].level != contours[i - 1].level;
+		if (first_line)
+		{
+			fprintf(file, "%s\n{\"type\":\"Feature\",\"properties\":{\"level\":%.7g},\"geometry\":{\"type\":\"MultiLineString\",\"coordinates\":[", i == 0 ? "" : "]}},", contours[i].level);
+		}
+
+		fprintf(file, "%s[", first_line ? "" : ",");
+		for (size_t p = 0; p + 1 < contours[i].points.size(); p += 2)
+		{
+			fprintf(file, "%s[%.7g,%.7g]", p == 0 ? "" : ",", contours[i].points[p], contours[i].points[p + 1]);
+		}
+		fprintf(file, "]");
+	}
+	fprintf(file, "%s\n]}\n", contours.empty() ? "" : "]}}");
+
+	bool written = !ferror(file);
+	if (fclose(file) != 0 || !written)
+	{
+		throw std::runtime_error("Unable to write file " + filename);
+	}
+}
+
+// Instantiate the contour functions for each heightmap storage type
+template void MapContour::extract(const BasicHeightmap<float>&, const std::vector<float>&, std::vector<Contour>&);
+template void MapContour::extract(const BasicHeightmap<fixed16>&, const std::vector<float>&, std::vector<Contour>&);
+template void MapContour::extract(const BasicHeightmap<half>&, const std::vector<float>&, std::vector<Contour>&);
\ No newline at end of file
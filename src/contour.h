@@ -0,0 +1,43 @@
+#pragma once
+
+#include "heightmap.h"
+
+#include <string>
+#include <vector>
+
+/*
+ * A contour line following a constant height across a heightmap
+ *
+ * level:	The height the line follows
+ * closed:	True if the line is a loop, in which case the last point is the same as the first
+ * points:	The x and y position of each point in cells, where cell (x, y) is at (x, y)
+ *
+ * Lines are wound so that heights at or above the level are on their left, with +y pointing down the heightmap
+ */
+struct Contour
+{
+	float level = 0.0f;
+	bool closed = false;
+	std::vector<float> points;
+};
+
+namespace MapContour
+{
+	/*
+	 * Trace contour lines for a list of heights with marching squares, across multiple threads
+	 *
+	 * The heightmap is split into tiles that are each traced by one thread in a single pass over the cells, where each
+	 * cell only checks the levels between its lowest and highest corner. The pieces of each line are then joined into
+	 * polylines within each tile, and finally the pieces that cross the edges of the tiles are joined together.
+	 * Saddle cells are resolved using the average height of their corners.
+	 *
+	 * levels:		The heights to trace, in any order
+	 * contours:	Set to the traced lines, sorted by level
+	 */
+	template <class T>
+	void extract(const BasicHeightmap<T>& map, const std::vector<float>& levels, std::vector<Contour>& contours);
+
+	// Save contour lines as a GeoJSON feature collection with one MultiLineString for each level
+	// (THROWS runtime_error if the file can't be written)
+	void saveGeoJSON(const std::vector<Contour>& contours, const std::string& filename);
+}
\ No newline at end of file
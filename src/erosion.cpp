@@ -0,0 +1,344 @@
+#include "erosion.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+// The number of droplets simulated by each work item
+constexpr unsigned erosion_batch_size = 1024;
+// The width and height of the tiles used for thermal erosion, not including their border
+constexpr unsigned thermal_tile_size = 64;
+
+// Add to an atomic float
+static inline void atomicAdd(std::atomic<float>& target, float value)
+{
+	float current = target.load(std::memory_order_relaxed);
+	while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+	{
+	}
+}
+
+// The working copy of a heightmap shared by all threads
+class ErosionGrid
+{
+public:
+	ErosionGrid(unsigned _width_x, unsigned _width_y) : heights((size_t)_width_x * _width_y), width_x(_width_x)
+	{
+	}
+
+	float get(unsigned x, unsigned y) const
+	{
+		return heights[(size_t)y * width_x + x].load(std::memory_order_relaxed);
+	}
+
+	void set(unsigned x, unsigned y, float value)
+	{
+		heights[(size_t)y * width_x + x].store(value, std::memory_order_relaxed);
+	}
+
+	// Get the bilinear height and gradient at a location, where X and Y are the cell containing it and u and v its offset in the cell
+	float sample(unsigned X, unsigned Y, float u, float v, float& gradient_x, float& gradient_y) const
+	{
+		float h00 = get(X, Y);
+		float h10 = get(X + 1, Y);
+		float h01 = get(X, Y + 1);
+		float h11 = get(X + 1, Y + 1);
+
+		gradient_x = (h10 - h00) * (1.0f - v) + (h11 - h01) * v;
+		gradient_y = (h01 - h00) * (1.0f - u) + (h11 - h10) * u;
+		return h00 * (1.0f - u) * (1.0f - v) + h10 * u * (1.0f - v) + h01 * (1.0f - u) * v + h11 * u * v;
+	}
+
+	// Spread a change in height over the corners of a cell using bilinear weights
+	void add(unsigned X, unsigned Y, float u, float v, float amount)
+	{
+		size_t top = (size_t)Y * width_x + X;
+		size_t bottom = top + width_x;
+		atomicAdd(heights[top], amount * (1.0f - u) * (1.0f - v));
+		atomicAdd(heights[top + 1], amount * u * (1.0f - v));
+		atomicAdd(heights[bottom], amount * (1.0f - u) * v);
+		atomicAdd(heights[bottom + 1], amount * u * v);
+	}
+
+private:
+	std::vector<std::atomic<float>> heights;
+	unsigned width_x;
+};
+
+// Simulate a single droplet from a random starting point
+template <class R>
+static void simulateDroplet(ErosionGrid& grid, unsigned width_x, unsigned width_y, R& rando, const HydraulicSettings& settings)
+{
+	std::uniform_real_distribution<float> x_dist(0.0f, (float)(width_x - 1));
+	std::uniform_real_distribution<float> y_dist(0.0f, (float)(width_y - 1));
+	float x = x_dist(rando);
+	float y = y_dist(rando);
+
+	// The distributions can round up to their upper limit, where the cell below and to the right of the droplet would be
+	// past the edge of the map
+	if (!(x < (float)(width_x - 1) && y < (float)(width_y - 1)))
+	{
+		return;
+	}
+	float dir_x = 0.0f;
+	float dir_y = 0.0f;
+	float speed = 1.0f;
+	float water = 1.0f;
+	float sediment = 0.0f;
+
+	for (unsigned step = 0; step < settings.lifetime; ++step)
+	{
+		unsigned X = (unsigned)x;
+		unsigned Y = (unsigned)y;
+		float u = x - X;
+		float v = y - Y;
+
+		// Move downhill, keeping some of the previous direction
+		float gradient_x, gradient_y;
+		float height = grid.sample(X, Y, u, v, gradient_x, gradient_y);
+		dir_x = dir_x * settings.inertia - gradient_x * (1.0f - settings.inertia);
+		dir_y = dir_y * settings.inertia - gradient_y * (1.0f - settings.inertia);
+		float length = std::sqrt(dir_x * dir_x + dir_y * dir_y);
+		if (length == 0.0f)
+		{
+			// The droplet is stuck in a perfectly flat area
+			break;
+		}
+		dir_x /= length;
+		dir_y /= length;
+		x += dir_x;
+		y += dir_y;
+
+		// Stop when the droplet flows off the edge of the map
+		if (!(x >= 0.0f && y >= 0.0f && x < (float)(width_x - 1) && y < (float)(width_y - 1)))
+		{
+			break;
+		}
+
+		float new_height = grid.sample((unsigned)x, (unsigned)y, x - (unsigned)x, y - (unsigned)y, gradient_x, gradient_y);
+		float delta = new_height - height;
+
+		// Faster droplets with more water moving down steeper slopes carry more sediment
+		float capacity = std::max(-delta * speed * water * settings.capacity, settings.min_capacity);
+		if (sediment > capacity || delta > 0.0f)
+		{
+			// Fill in pits when moving uphill, otherwise drop some of the excess sediment
+			float deposit = delta > 0.0f ? std::min(delta, sediment) : (sediment - capacity) * settings.deposition;
+			sediment -= deposit;
+			grid.add(X, Y, u, v, deposit);
+		}
+		else
+		{
+			// Never erode more than the height difference, so that droplets don't dig holes
+			float erode = std::min((capacity - sediment) * settings.erosion, -delta);
+			sediment += erode;
+			grid.add(X, Y, u, v, -erode);
+		}
+
+		speed = std::sqrt(std::max(0.0f, speed * speed - delta * settings.gravity));
+		water *= 1.0f - settings.evaporation;
+	}
+}
+
+template <class T>
+double MapErosion::hydraulic(BasicHeightmap<T>& map, unsigned seed, const HydraulicSettings& settings)
+{
+	if (map.isReadOnly())
+	{
+		throw std::logic_error("Read-only heightmaps can't be eroded");
+	}
+
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	if (width_x < 2 || width_y < 2 || settings.droplets == 0)
+	{
+		return 0.0;
+	}
+
+	// Copy the heightmap into the shared working copy
+	ErosionGrid grid(width_x, width_y);
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			grid.set(x, y, map.getHeight(x, y));
+		}
+	});
+
+	// Run every batch with a random stream seeded by its index
+	auto t_start = std::chrono::steady_clock::now();
+	unsigned batches = (unsigned)(((uint64_t)settings.droplets + erosion_batch_size - 1) / erosion_batch_size);
+	parallelFor(batches, [&](unsigned batch, unsigned thread)
+	{
+		std::seed_seq sequence = { seed, batch };
+		std::mt19937 rando(sequence);
+		unsigned count = std::min(erosion_batch_size, settings.droplets - batch * erosion_batch_size);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			simulateDroplet(grid, width_x, width_y, rando, settings);
+		}
+	});
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t_start;
+
+	// Copy the result back to the heightmap
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			map.setHeight(x, y, grid.get(x, y));
+		}
+	});
+
+	return elapsed.count() > 0.0 ? settings.droplets / elapsed.count() : 0.0;
+}
+
+// The flow of material into a cell from one neighbour, which is the negative of the flow in the other direction
+static inline float thermalFlow(float centre, float neighbour, float talus, float rate)
+{
+	float difference = neighbour - centre;
+	return rate * (std::max(difference - talus, 0.0f) - std::max(-difference - talus, 0.0f));
+}
+
+#ifdef USE_SSE2
+static inline __m128 thermalFlow4(__m128 centre, __m128 neighbour, __m128 talus, __m128 rate)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 difference = _mm_sub_ps(neighbour, centre);
+	__m128 in = _mm_max_ps(_mm_sub_ps(difference, talus), zero);
+	__m128 out = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(zero, difference), talus), zero);
+	return _mm_mul_ps(rate, _mm_sub_ps(in, out));
+}
+#endif
+
+// Apply one iteration of thermal erosion to a tile with a one-cell border, stored with the given row stride
+// Writes size_x by size_y cells to out, which has a stride of out_stride
+static void thermalTile(const float* tile, unsigned stride, unsigned size_x, unsigned size_y, float* out, unsigned out_stride, float talus, float rate)
+{
+	float talus_diagonal = talus * 1.41421356f;
+	for (unsigned y = 0; y < size_y; ++y)
+	{
+		const float* above = tile + y * stride + 1;
+		const float* row = above + stride;
+		const float* below = row + stride;
+		float* out_row = out + y * out_stride;
+
+		unsigned x = 0;
+#ifdef USE_SSE2
+		// Process four cells at a time
+		__m128 talus4 = _mm_set1_ps(talus);
+		__m128 diagonal4 = _mm_set1_ps(talus_diagonal);
+		__m128 rate4 = _mm_set1_ps(rate);
+		for (; x + 4 <= size_x; x += 4)
+		{
+			__m128 centre = _mm_loadu_ps(row + x);
+			__m128 sum = thermalFlow4(centre, _mm_loadu_ps(row + x - 1), talus4, rate4);
+			sum = _mm_add_ps(sum, thermalFlow4(centre, _mm_loadu_ps(row + x + 1), talus4, rate4));
+			sum = _mm_add_ps(sum, thermalFlow4(centre, _mm_loadu_ps(above + x), talus4, rate4));
+			sum = _mm_add_ps(sum, thermalFlow4(centre, _mm_loadu_ps(below + x), talus4, rate4));
+			sum = _mm_add_ps(sum, thermalFlow4(centre, _mm_loadu_ps(above + x - 1), diagonal4, rate4));
+			sum = _mm_add_ps(sum, thermalFlow4(centre, _mm_loadu_ps(above + x + 1), diagonal4, rate4));
+			sum = _mm_add_ps(sum, thermalFlow4(centre, _mm_loadu_ps(below + x - 1), diagonal4, rate4));
+			sum = _mm_add_ps(sum, thermalFlow4(centre, _mm_loadu_ps(below + x + 1), diagonal4, rate4));
+			_mm_storeu_ps(out_row + x, _mm_add_ps(centre, sum));
+		}
+#endif
+		for (; x < size_x; ++x)
+		{
+			const float* a = above + x;
+			const float* r = row + x;
+			const float* b = below + x;
+			float centre = r[0];
+			float sum = thermalFlow(centre, r[-1], talus, rate) + thermalFlow(centre, r[1], talus, rate)
+				+ thermalFlow(centre, a[0], talus, rate) + thermalFlow(centre, b[0], talus, rate)
+				+ thermalFlow(centre, a[-1], talus_diagonal, rate) + thermalFlow(centre, a[1], talus_diagonal, rate)
+				+ thermalFlow(centre, b[-1], talus_diagonal, rate) + thermalFlow(centre, b[1], talus_diagonal, rate);
+			out_row[x] = centre + sum;
+		}
+	}
+}
+
+template <class T>
+void MapErosion::thermal(BasicHeightmap<T>& map, const ThermalSettings& settings)
+{
+	if (map.isReadOnly())
+	{
+		throw std::logic_error("Read-only heightmaps can't be eroded");
+	}
+
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	if (width_x == 0 || width_y == 0 || settings.iterations == 0)
+	{
+		return;
+	}
+
+	// Read from one buffer and write to the other, swapping them after each iteration
+	size_t size = (size_t)width_x * width_y;
+	std::vector<float> buffer_a(size);
+	std::vector<float> buffer_b(size);
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			buffer_a[(size_t)y * width_x + x] = map.getHeight(x, y);
+		}
+	});
+	float* source = buffer_a.data();
+	float* target = buffer_b.data();
+
+	// Each cell has 8 neighbours that can each move rate / 16 of the difference, so a pair of cells never overshoots
+	float rate = std::min(std::max(settings.rate, 0.0f), 1.0f) / 16.0f;
+	unsigned tiles_x = (width_x + thermal_tile_size - 1) / thermal_tile_size;
+	unsigned tiles_y = (width_y + thermal_tile_size - 1) / thermal_tile_size;
+	unsigned stride = thermal_tile_size + 2;
+	std::vector<std::vector<float>> tiles(getThreadCount(), std::vector<float>(stride * stride));
+
+	for (unsigned i = 0; i < settings.iterations; ++i)
+	{
+		parallelFor(tiles_x * tiles_y, [&](unsigned index, unsigned thread)
+		{
+			unsigned start_x = (index % tiles_x) * thermal_tile_size;
+			unsigned start_y = (index / tiles_x) * thermal_tile_size;
+			unsigned size_x = std::min(thermal_tile_size, width_x - start_x);
+			unsigned size_y = std::min(thermal_tile_size, width_y - start_y);
+
+			// Copy the tile and its border, repeating the edge of the map so that nothing flows over it
+			float* tile = tiles[thread].data();
+			for (unsigned y = 0; y < size_y + 2; ++y)
+			{
+				unsigned source_y = (unsigned)std::min(std::max((int)(start_y + y) - 1, 0), (int)width_y - 1);
+				const float* source_row = source + (size_t)source_y * width_x;
+				float* tile_row = tile + y * stride;
+				tile_row[0] = source_row[start_x > 0 ? start_x - 1 : 0];
+				std::copy(source_row + start_x, source_row + start_x + size_x, tile_row + 1);
+				tile_row[size_x + 1] = source_row[std::min(start_x + size_x, width_x - 1)];
+			}
+
+			thermalTile(tile, stride, size_x, size_y, target + (size_t)start_y * width_x + start_x, width_x, settings.talus, rate);
+		});
+		std::swap(source, target);
+	}
+
+	// Copy the result back to the heightmap
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			map.setHeight(x, y, source[(size_t)y * width_x + x]);
+		}
+	});
+}
+
+// Instantiate erosion for each heightmap storage type
+template double MapErosion::hydraulic(BasicHeightmap<float>&, unsigned, const HydraulicSettings&);
+template double MapErosion::hydraulic(BasicHeightmap<fixed16>&, unsigned, const HydraulicSettings&);
+template double MapErosion::hydraulic(BasicHeightmap<half>&, unsigned, const HydraulicSettings&);
+template void MapErosion::thermal(BasicHeightmap<float>&, const ThermalSettings&);
+template void MapErosion::thermal(BasicHeightmap<fixed16>&, const ThermalSettings&);
+template void MapErosion::thermal(BasicHeightmap<half>&, const ThermalSettings&);
\ No newline at end of file
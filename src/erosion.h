@@ -0,0 +1,71 @@
+#pragma once
+
+#include "heightmap.h"
+
+/*
+ * Settings for particle-based hydraulic erosion
+ *
+ * droplets:		The number of water droplets simulated
+ * lifetime:		The maximum number of steps each droplet takes before it evaporates
+ * inertia:			How much droplets keep their direction instead of following the slope (0.0 to 1.0)
+ * capacity:		How much sediment a droplet can carry, relative to its speed, water and the slope it is moving down
+ * min_capacity:	The least sediment a droplet can carry, so that droplets on flat ground still erode
+ * erosion:			The fraction of the free capacity of a droplet filled by eroding the ground on each step
+ * deposition:		The fraction of excess sediment deposited on each step
+ * evaporation:		The fraction of a droplet's water lost on each step
+ * gravity:			How quickly droplets speed up when moving downhill
+ */
+struct HydraulicSettings
+{
+	unsigned droplets = 1000000;
+	unsigned lifetime = 30;
+	float inertia = 0.05f;
+	float capacity = 4.0f;
+	float min_capacity = 0.01f;
+	float erosion = 0.3f;
+	float deposition = 0.3f;
+	float evaporation = 0.01f;
+	float gravity = 4.0f;
+};
+
+/*
+ * Settings for thermal erosion, where material slides down slopes that are steeper than the talus angle
+ *
+ * iterations:	The number of times material is moved between neighbouring cells
+ * talus:		The largest stable height difference between horizontally or vertically adjacent cells
+ *				(diagonal neighbours use the same slope over the longer distance)
+ * rate:		The fraction of the unstable height difference moved on each iteration (0.0 to 1.0)
+ */
+struct ThermalSettings
+{
+	unsigned iterations = 50;
+	float talus = 0.004f;
+	float rate = 0.5f;
+};
+
+namespace MapErosion
+{
+	/*
+	 * Erode a heightmap by simulating water droplets running down it across multiple threads
+	 *
+	 * Droplets run in batches, each with its own random number stream seeded from the seed and the batch index.
+	 * Heights are updated with atomic adds to a shared working copy of the heightmap, so droplets on different
+	 * threads crossing the same cells never lose each other's changes.
+	 *
+	 * Returns the number of droplets simulated per second
+	 * (THROWS logic_error if the heightmap is read-only)
+	 */
+	template <class T>
+	double hydraulic(BasicHeightmap<T>& map, unsigned seed, const HydraulicSettings& settings);
+
+	/*
+	 * Erode a heightmap by moving material from each cell to any of its 8 neighbours that are below the talus angle
+	 *
+	 * Each iteration reads one buffer and writes another, in tiles with a one-cell border copied from the neighbouring
+	 * tiles so that every tile can be processed by a different thread. The flow between two cells is always equal and
+	 * opposite, so material is only moved and never created or lost.
+	 * (THROWS logic_error if the heightmap is read-only)
+	 */
+	template <class T>
+	void thermal(BasicHeightmap<T>& map, const ThermalSettings& settings);
+}
\ No newline at end of file
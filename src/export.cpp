@@ -1,7 +1,10 @@
 #include "export.h"
+#include "trace.h"
 
 #include <stdexcept>
 #include <cstdio>
+#include <cstring>
+#include <utility>
 #include <png.h>
 
 PixelBuffer::PixelBuffer(unsigned _width, unsigned _height, unsigned _size)
@@ -15,37 +18,13 @@ PixelBuffer::PixelBuffer(unsigned _width, unsigned _height, unsigned _size)
 	height = _height;
 	size = _size;
 
-	// Create pixel row pointers
-	data = new byte* [height];
-
-	// Create the pixel rows
-	for (unsigned y = 0; y < height; ++y)
-	{
-		data[y] = new byte[width * size];
-
-		for (unsigned x = 0; x < width; ++x)
-		{
-			for (unsigned b = 0; b < size; ++b)
-			{
-				data[y][x * size + b] = 0;
-			}
-		}
-	}
+	// Create the pixels, cleared to zero
+	pixels.assign((size_t)width * height * size, 0);
 }
 
-PixelBuffer::~PixelBuffer()
+PixelBuffer PixelBuffer::clone() const
 {
-	for (unsigned i = 0; i < height; ++i)
-	{
-		if (data[i] != nullptr)
-		{
-			delete[] data[i];
-		}
-	}
-	if (data != nullptr)
-	{
-		delete[] data;
-	}
+	return *this;
 }
 
 unsigned PixelBuffer::getWidth() const
@@ -76,12 +55,13 @@ void PixelBuffer::fillPixel(unsigned x, unsigned y, uint16_t value)
 	}
 
 	// Add the data to the pixel buffer one byte at a time
+	byte* pixel = &pixels[((size_t)y * width + x) * size];
 #ifndef BIGENDIAN
-	data[y][x * size] = (value >> 8) & 0xFF;
-	data[y][x * size + 1] = value & 0xFF;
+	pixel[0] = (value >> 8) & 0xFF;
+	pixel[1] = value & 0xFF;
 #else
-	data[y][x * size] = value & 0xFF;
-	data[y][x * size + 1] = (value >> 8) & 0xFF;
+	pixel[0] = value & 0xFF;
+	pixel[1] = (value >> 8) & 0xFF;
 #endif
 }
 
@@ -94,11 +74,20 @@ void PixelBuffer::fillPixel(unsigned x, unsigned y, uint8_t value)
 	}
 
 	// Add the data to the pixel buffer one byte at a time
-	data[y][x * size] = value;
+	pixels[((size_t)y * width + x) * size] = value;
 }
 
 void PixelBuffer::save(std::string filename)
 {
+	TraceSpan span("Encode PNG");
+
+	// libpng takes a pointer to each row, created before setjmp so that a png error can't skip its destructor
+	std::vector<byte*> rows(height);
+	for (unsigned y = 0; y < height; ++y)
+	{
+		rows[y] = &pixels[(size_t)y * width * size];
+	}
+
 	// Open the file
 	FILE* file;
 	if (fopen_s(&file, filename.c_str(), "wb"))
@@ -145,9 +134,39 @@ void PixelBuffer::save(std::string filename)
 
 	// Write image data
 	png_init_io(png_ptr, file);
-	png_set_rows(png_ptr, info_ptr, data);
+	png_set_rows(png_ptr, info_ptr, rows.data());
 	png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, nullptr);
 
 	png_destroy_write_struct(&png_ptr, &info_ptr);
 	fclose(file);
+}
+
+void saveRaw32(const std::string& filename, const float* data, unsigned width, unsigned height)
+{
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Unable to create file " + filename);
+	}
+
+	size_t count = (size_t)width * height;
+#ifndef BIGENDIAN
+	bool written = fwrite(data, sizeof(float), count, file) == count;
+#else
+	// Swap each value to little-endian before writing it
+	bool written = true;
+	for (size_t i = 0; i < count && written; ++i)
+	{
+		unsigned char bytes[4];
+		memcpy(bytes, data + i, sizeof(float));
+		std::swap(bytes[0], bytes[3]);
+		std::swap(bytes[1], bytes[2]);
+		written = fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+	}
+#endif
+
+	if (fclose(file) != 0 || !written)
+	{
+		throw std::runtime_error("Unable to write file " + filename);
+	}
 }
\ No newline at end of file
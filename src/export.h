@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 typedef unsigned char byte;
 
@@ -9,7 +10,9 @@ class PixelBuffer
 {
 public:
 	PixelBuffer(unsigned _width, unsigned _height, unsigned _size);
-	~PixelBuffer();
+
+	// Make a copy of the pixel buffer and its pixels
+	PixelBuffer clone() const;
 
 	unsigned getWidth() const;
 	unsigned getHeight() const;
@@ -31,5 +34,9 @@ private:
 	unsigned height;	// The number of rows of pixels in the buffer
 	unsigned size;		// The size, in bytes, of each pixel
 
-	byte** data = nullptr;
-};
\ No newline at end of file
+	std::vector<byte> pixels;	// Every row of pixels in a single allocation
+};
+
+// Save a grid of floats as a raw file of little-endian 32 bit floats (.r32), one row at a time
+// (THROWS runtime_error if the file can't be written)
+void saveRaw32(const std::string& filename, const float* data, unsigned width, unsigned height);
\ No newline at end of file
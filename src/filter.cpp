@@ -0,0 +1,395 @@
+#include "filter.h"
+#include "stats.h"
+#include "simd.h"
+
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+
+// The number of columns blurred together by each work item in the vertical pass
+constexpr unsigned filter_strip_width = 64;
+// The number of columns processed by each work item of the median filter
+constexpr unsigned median_strip_width = 256;
+// The median filter sorts heights into coarse bins, each split into fine bins
+constexpr unsigned median_coarse_bins = 64;
+constexpr unsigned median_fine_bins = 64;
+constexpr unsigned median_levels = median_coarse_bins * median_fine_bins;
+
+// Make sure a heightmap can be filtered
+template <class T>
+static void checkFilterable(const BasicHeightmap<T>& map)
+{
+	if (map.isReadOnly())
+	{
+		throw std::logic_error("Read-only heightmaps can't be filtered");
+	}
+}
+
+///
+/// Box and Gaussian blur
+///
+
+// Write the scaled running sum of each lane to out, then slide the window by adding one row and removing another
+static inline void slideLanes(float* out, float* sum, const float* add, const float* remove, float scale, unsigned lanes)
+{
+	unsigned i = 0;
+#ifdef USE_SSE2
+	__m128 scale4 = _mm_set1_ps(scale);
+	for (; i + 4 <= lanes; i += 4)
+	{
+		__m128 total = _mm_loadu_ps(sum + i);
+		_mm_storeu_ps(out + i, _mm_mul_ps(total, scale4));
+		total = _mm_add_ps(total, _mm_sub_ps(_mm_loadu_ps(add + i), _mm_loadu_ps(remove + i)));
+		_mm_storeu_ps(sum + i, total);
+	}
+#endif
+	for (; i < lanes; ++i)
+	{
+		out[i] = sum[i] * scale;
+		sum[i] += add[i] - remove[i];
+	}
+}
+
+/*
+ * Box blur count rows of values, where each row holds one value for each of a number of independent lanes
+ *
+ * With one lane this blurs a single line of values, and with many lanes it blurs columns side by side
+ * sum:		Space for one running sum per lane
+ */
+static void boxLines(const float* in, float* out, unsigned count, unsigned lanes, unsigned radius, BorderPolicy border, float* sum)
+{
+	// Sum the window around the first row
+	std::fill(sum, sum + lanes, 0.0f);
+	for (int i = -(int)radius; i <= (int)radius; ++i)
+	{
+		const float* row = in + (size_t)borderIndex(i, count, border) * lanes;
+		for (unsigned l = 0; l < lanes; ++l)
+		{
+			sum[l] += row[l];
+		}
+	}
+
+	float scale = 1.0f / (radius * 2 + 1);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		const float* add = in + (size_t)borderIndex((int)(i + radius + 1), count, border) * lanes;
+		const float* remove = in + (size_t)borderIndex((int)i - (int)radius, count, border) * lanes;
+		slideLanes(out + (size_t)i * lanes, sum, add, remove, scale, lanes);
+	}
+}
+
+// Apply a box blur with each of the radii, blurring every row and then every column
+// All the blurs in each direction run on a buffer while it is in the cache
+template <class T>
+static void boxPasses(BasicHeightmap<T>& map, const std::vector<unsigned>& radii, BorderPolicy border)
+{
+	checkFilterable(map);
+
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	if (width_x == 0 || width_y == 0 || radii.empty())
+	{
+		return;
+	}
+
+	// Each thread keeps two buffers to blur between and the running sums
+	struct Buffers
+	{
+		std::vector<float> a;
+		std::vector<float> b;
+		std::vector<float> sum;
+	};
+	std::vector<Buffers> buffers(getThreadCount());
+	T* data = map.getData();
+
+	// Blur each row
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		Buffers& buffer = buffers[thread];
+		buffer.a.resize(width_x);
+		buffer.b.resize(width_x);
+		buffer.sum.resize(1);
+
+		T* row = data + (size_t)y * width_x;
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			buffer.a[x] = HeightStorage<T>::load(row[x]);
+		}
+		for (unsigned radius : radii)
+		{
+			boxLines(buffer.a.data(), buffer.b.data(), width_x, 1, radius, border, buffer.sum.data());
+			buffer.a.swap(buffer.b);
+		}
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			row[x] = HeightStorage<T>::store(buffer.a[x]);
+		}
+	});
+
+	// Blur strips of columns together, so that each row of the strip can be processed with SIMD
+	unsigned strips = (width_x + filter_strip_width - 1) / filter_strip_width;
+	parallelFor(strips, [&](unsigned strip, unsigned thread)
+	{
+		unsigned start_x = strip * filter_strip_width;
+		unsigned lanes = std::min(filter_strip_width, width_x - start_x);
+		Buffers& buffer = buffers[thread];
+		buffer.a.resize((size_t)width_y * lanes);
+		buffer.b.resize((size_t)width_y * lanes);
+		buffer.sum.resize(lanes);
+
+		for (unsigned y = 0; y < width_y; ++y)
+		{
+			const T* row = data + (size_t)y * width_x + start_x;
+			for (unsigned l = 0; l < lanes; ++l)
+			{
+				buffer.a[(size_t)y * lanes + l] = HeightStorage<T>::load(row[l]);
+			}
+		}
+		for (unsigned radius : radii)
+		{
+			boxLines(buffer.a.data(), buffer.b.data(), width_y, lanes, radius, border, buffer.sum.data());
+			buffer.a.swap(buffer.b);
+		}
+		for (unsigned y = 0; y < width_y; ++y)
+		{
+			T* row = data + (size_t)y * width_x + start_x;
+			for (unsigned l = 0; l < lanes; ++l)
+			{
+				row[l] = HeightStorage<T>::store(buffer.a[(size_t)y * lanes + l]);
+			}
+		}
+	});
+}
+
+template <class T>
+void MapFilter::boxBlur(BasicHeightmap<T>& map, unsigned radius, BorderPolicy border)
+{
+	checkFilterable(map);
+	if (radius > max_blur_radius)
+	{
+		throw std::logic_error("Box blur radius is too large");
+	}
+	if (radius > 0)
+	{
+		boxPasses(map, { radius }, border);
+	}
+}
+
+template <class T>
+void MapFilter::gaussianBlur(BasicHeightmap<T>& map, float sigma, BorderPolicy border)
+{
+	checkFilterable(map);
+	if (sigma > max_blur_sigma)
+	{
+		throw std::logic_error("Gaussian blur sigma is too large");
+	}
+	if (!(sigma > 0.0f))
+	{
+		return;
+	}
+
+	// Pick the sizes of three box blurs whose combined variance is closest to sigma squared
+	// The ideal width is rounded down to an odd number, and the first m blurs use it while the rest are two cells wider
+	const int passes = 3;
+	float variance = sigma * sigma;
+	int lower = (int)std::floor(std::sqrt(12.0f * variance / passes + 1.0f));
+	if (lower % 2 == 0)
+	{
+		--lower;
+	}
+	int m = (int)std::round((12.0f * variance - passes * lower * lower - 4 * passes * lower - 3 * passes) / (-4.0f * lower - 4.0f));
+
+	std::vector<unsigned> radii;
+	for (int i = 0; i < passes; ++i)
+	{
+		int size = i < m ? lower : lower + 2;
+		if (size > 1)
+		{
+			radii.push_back((unsigned)(size - 1) / 2);
+		}
+	}
+	boxPasses(map, radii, border);
+}
+
+///
+/// Median filter
+///
+
+template <class T>
+void MapFilter::medianFilter(BasicHeightmap<T>& map, unsigned radius, BorderPolicy border)
+{
+	checkFilterable(map);
+	if (radius > max_median_radius)
+	{
+		throw std::logic_error("Median filter radius is too large");
+	}
+
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	if (width_x == 0 || width_y == 0 || radius == 0)
+	{
+		return;
+	}
+
+	// Sort heights into levels across the range of the heightmap - a flat heightmap is unchanged
+	HeightStats stats = measureHeights(map);
+	float range = stats.max - stats.min;
+	if (!(range > 0.0f))
+	{
+		return;
+	}
+	float to_level = median_levels / range;
+	float from_level = range / median_levels;
+	auto getLevel = [&](unsigned x, unsigned y)
+	{
+		return std::min((unsigned)((map.getHeight(x, y) - stats.min) * to_level), median_levels - 1);
+	};
+
+	// Each thread keeps a histogram of the column of heights around the current row for each column of its strip,
+	// and a histogram of the square around the current cell
+	struct Histograms
+	{
+		std::vector<uint16_t> column_fine;
+		std::vector<uint16_t> column_coarse;
+		std::vector<unsigned> column_x;
+		std::vector<uint32_t> kernel_fine;
+		std::vector<uint32_t> kernel_coarse;
+		std::vector<int> updated;
+	};
+	std::vector<Histograms> thread_histograms(getThreadCount());
+
+	unsigned diameter = radius * 2 + 1;
+	unsigned median = diameter * diameter / 2;
+	BasicHeightmap<T> result(width_x, width_y);
+	unsigned strips = (width_x + median_strip_width - 1) / median_strip_width;
+	parallelFor(strips, [&](unsigned strip, unsigned thread)
+	{
+		unsigned start_x = strip * median_strip_width;
+		unsigned end_x = std::min(width_x, start_x + median_strip_width);
+
+		// Columns of the strip start radius cells to the left of the first cell
+		Histograms& h = thread_histograms[thread];
+		unsigned columns = end_x - start_x + radius * 2;
+		h.column_fine.assign((size_t)columns * median_levels, 0);
+		h.column_coarse.assign((size_t)columns * median_coarse_bins, 0);
+		h.column_x.resize(columns);
+		for (unsigned c = 0; c < columns; ++c)
+		{
+			h.column_x[c] = borderIndex((int)(start_x + c) - (int)radius, width_x, border);
+		}
+		h.kernel_fine.resize(median_levels);
+		h.kernel_coarse.resize(median_coarse_bins);
+		h.updated.resize(median_coarse_bins);
+
+		auto addRow = [&](unsigned y, int change)
+		{
+			for (unsigned c = 0; c < columns; ++c)
+			{
+				unsigned level = getLevel(h.column_x[c], y);
+				h.column_fine[(size_t)c * median_levels + level] += change;
+				h.column_coarse[(size_t)c * median_coarse_bins + level / median_fine_bins] += change;
+			}
+		};
+
+		// Fill the column histograms with the rows around the first row
+		for (int y = -(int)radius; y <= (int)radius; ++y)
+		{
+			addRow(borderIndex(y, width_y, border), 1);
+		}
+
+		for (unsigned y = 0; y < width_y; ++y)
+		{
+			// Move the column histograms down to the current row
+			if (y > 0)
+			{
+				addRow(borderIndex((int)y - (int)radius - 1, width_y, border), -1);
+				addRow(borderIndex((int)(y + radius), width_y, border), 1);
+			}
+
+			// Start the coarse kernel histogram at the left of the strip, and mark every fine kernel histogram as out of date
+			std::fill(h.kernel_coarse.begin(), h.kernel_coarse.end(), 0);
+			for (unsigned c = 0; c < diameter; ++c)
+			{
+				const uint16_t* coarse = h.column_coarse.data() + (size_t)c * median_coarse_bins;
+				for (unsigned k = 0; k < median_coarse_bins; ++k)
+				{
+					h.kernel_coarse[k] += coarse[k];
+				}
+			}
+			std::fill(h.updated.begin(), h.updated.end(), -(int)diameter);
+
+			for (unsigned c = 0; c < end_x - start_x; ++c)
+			{
+				// Slide the coarse kernel histogram one column to the right
+				if (c > 0)
+				{
+					const uint16_t* add = h.column_coarse.data() + (size_t)(c + diameter - 1) * median_coarse_bins;
+					const uint16_t* remove = h.column_coarse.data() + (size_t)(c - 1) * median_coarse_bins;
+					for (unsigned k = 0; k < median_coarse_bins; ++k)
+					{
+						h.kernel_coarse[k] += add[k] - remove[k];
+					}
+				}
+
+				// Find the coarse bin containing the median
+				unsigned below = 0;
+				unsigned k = 0;
+				while (below + h.kernel_coarse[k] <= median)
+				{
+					below += h.kernel_coarse[k++];
+				}
+
+				// Only the fine histogram of that bin is brought up to date, either by sliding it across the columns
+				// since it was last used or by summing the columns again if that would be faster
+				uint32_t* fine = h.kernel_fine.data() + k * median_fine_bins;
+				size_t offset = k * median_fine_bins;
+				if ((int)c - h.updated[k] > (int)radius)
+				{
+					std::fill(fine, fine + median_fine_bins, 0);
+					for (unsigned i = c; i < c + diameter; ++i)
+					{
+						const uint16_t* column = h.column_fine.data() + (size_t)i * median_levels + offset;
+						for (unsigned j = 0; j < median_fine_bins; ++j)
+						{
+							fine[j] += column[j];
+						}
+					}
+				}
+				else
+				{
+					for (unsigned i = h.updated[k] + 1; i <= c; ++i)
+					{
+						const uint16_t* add = h.column_fine.data() + (size_t)(i + diameter - 1) * median_levels + offset;
+						const uint16_t* remove = h.column_fine.data() + (size_t)(i - 1) * median_levels + offset;
+						for (unsigned j = 0; j < median_fine_bins; ++j)
+						{
+							fine[j] += add[j] - remove[j];
+						}
+					}
+				}
+				h.updated[k] = c;
+
+				// Find the level of the median within the coarse bin
+				unsigned j = 0;
+				while (below + fine[j] <= median)
+				{
+					below += fine[j++];
+				}
+				result.setHeight(start_x + c, y, stats.min + (offset + j + 0.5f) * from_level);
+			}
+		}
+	});
+
+	map.set(result);
+}
+
+// Instantiate the filters for each heightmap storage type
+template void MapFilter::boxBlur(BasicHeightmap<float>&, unsigned, BorderPolicy);
+template void MapFilter::boxBlur(BasicHeightmap<fixed16>&, unsigned, BorderPolicy);
+template void MapFilter::boxBlur(BasicHeightmap<half>&, unsigned, BorderPolicy);
+template void MapFilter::gaussianBlur(BasicHeightmap<float>&, float, BorderPolicy);
+template void MapFilter::gaussianBlur(BasicHeightmap<fixed16>&, float, BorderPolicy);
+template void MapFilter::gaussianBlur(BasicHeightmap<half>&, float, BorderPolicy);
+template void MapFilter::medianFilter(BasicHeightmap<float>&, unsigned, BorderPolicy);
+template void MapFilter::medianFilter(BasicHeightmap<fixed16>&, unsigned, BorderPolicy);
+template void MapFilter::medianFilter(BasicHeightmap<half>&, unsigned, BorderPolicy);
\ No newline at end of file
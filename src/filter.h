@@ -0,0 +1,35 @@
+#pragma once
+
+#include "heightmap.h"
+
+/*
+ * Smoothing filters for heightmaps
+ *
+ * The cost of each filter does not depend on its radius. All filters run across multiple threads,
+ * and read heights beyond the edges of the heightmap using the border policy.
+ * (All filters THROW logic_error if the heightmap is read-only, or the radius or sigma is above its limit)
+ */
+namespace MapFilter
+{
+	// The largest box blur radius, which keeps the size of the box within an int
+	constexpr unsigned max_blur_radius = 65535;
+	// The largest Gaussian blur sigma, which keeps the radius of each of its box blurs within max_blur_radius
+	constexpr float max_blur_sigma = 32767.0f;
+	// The largest median filter radius, which keeps the counts of its 16 bit column histograms from overflowing and
+	// limits the histograms each thread keeps to around 19MB
+	constexpr unsigned max_median_radius = 1024;
+
+	// Replace each height with the mean of the heights in a square of (2 * radius + 1) cells centred on it
+	template <class T>
+	void boxBlur(BasicHeightmap<T>& map, unsigned radius, BorderPolicy border = BorderPolicy::Clamp);
+
+	// Approximate a Gaussian blur with standard deviation sigma (in cells) using three box blurs
+	template <class T>
+	void gaussianBlur(BasicHeightmap<T>& map, float sigma, BorderPolicy border = BorderPolicy::Clamp);
+
+	// Replace each height with the median of the heights in a square of (2 * radius + 1) cells centred on it
+	// Heights are sorted into 4096 levels spread evenly across the range of the heightmap, so the result is
+	// accurate to 1/4096 of that range
+	template <class T>
+	void medianFilter(BasicHeightmap<T>& map, unsigned radius, BorderPolicy border = BorderPolicy::Clamp);
+}
\ No newline at end of file
@@ -3,149 +3,432 @@
 
 #include <iostream>
 
-void MapGenerator::defaultGenerator(Heightmap& map, unsigned seed, float min, float max)
+// The strides of the previews generated before the full heightmap, coarsest first
+constexpr unsigned preview_strides[] = { 4, 2 };
+
+// Set each height to height(x, y), coarse to fine with a preview after each level if a preview callback is given
+// finish(preview) applies any steps the generator runs on the whole heightmap afterwards to a preview
+template <class T, class F, class G>
+static void fillHeights(BasicHeightmap<T>& map, F height, const PreviewCallback& preview, G finish)
 {
-	PointNoise noise(5, 5, 100, seed);
-	map.sample(noise, &PointNoise::worley);
+	if (!preview)
+	{
+		map.generate(height);
+		return;
+	}
 
-	//GradientNoise base(10, 10, seed);
-	//map.sample(base, &GradientNoise::perlin);
+	bool skip_coarser = false;
+	for (unsigned stride : preview_strides)
+	{
+		map.generate(height, stride, skip_coarser);
+		skip_coarser = true;
 
-	//ValueNoise noise(10, 10, seed);
-	//map.sample(noise, &ValueNoise::cubic);
+		// Copy out the cells generated so far
+		Heightmap level((map.getWidthX() + stride - 1) / stride, (map.getWidthY() + stride - 1) / stride);
+		level.generate([&](unsigned x, unsigned y)
+		{
+			return map.getHeight(x * stride, y * stride);
+		});
+		finish(level);
+		preview(level, stride);
+	}
+	map.generate(height, 1, true);
+}
 
-	//GridNoise noise(10, 10, seed);
-	//map.sample(noise, &GridNoise::worley);
+// Get a region with the size of the virtual heightmap filled in
+template <class T>
+static MapRegion getRegion(const BasicHeightmap<T>& map, MapRegion region)
+{
+	if (region.width_x == 0 || region.width_y == 0)
+	{
+		region.width_x = map.getWidthX();
+		region.width_y = map.getWidthY();
+	}
+	return region;
 }
 
-void MapGenerator::plasma(Heightmap& map, unsigned seed, float min, float max, unsigned scale)
+// Scale noise in [-1, 1] to fit within the specified limits
+template <class T>
+static void scaleNoise(BasicHeightmap<T>& map, float min, float max)
 {
-	// Check input values
-	if (scale < 2)
+	float delta = (max - min) / 2.0f;
+	map.multiply(delta);
+	map.add(min + delta);
+}
+
+///
+/// Generator noise
+///
+
+// Noise in [-1, 1] that a generator scales to fit within the limits of the heightmap after sampling it
+// sample is the member function of N (or a class it inherits from) that samples the noise
+template <class N, auto sample>
+struct ScaledNoise
+{
+	N noise;
+	float delta;
+	float bottom;
+
+	ScaledNoise(N&& _noise, float min, float max, unsigned width_x, unsigned width_y) : noise(std::move(_noise))
 	{
-		scale = 2;
+		noise.scale(width_x, width_y);
+		delta = (max - min) / 2.0f;
+		bottom = min + delta;
 	}
 
-	// Generate noise
-	PlasmaNoise noise(scale, seed);
-	noise.scale(map.getWidthX(), map.getWidthY());
+	// Get the noise before it is scaled
+	float getNoise(float x, float y) const
+	{
+		return (noise.*sample)(x, y);
+	}
 
-	// Apply noise
-	map.sample<PlasmaNoise>(noise, &PlasmaNoise::cubic);
+	// Get the noise scaled the same way as scaleNoise, which multiplies and then adds
+	float getHeight(float x, float y) const
+	{
+		float height = getNoise(x, y) * delta;
+		return height + bottom;
+	}
+};
 
-	// Get the limits of the heightmap
-	float delta = (max - min) / 2.0f;
-	float bottom = min + delta;
+typedef ScaledNoise<PointNoise, &PointNoise::worley> DefaultNoise;
+typedef ScaledNoise<PlasmaNoise, &PlasmaNoise::cubic> PlasmaHeights;
 
-	// Scale the noise to fit within the specified limits
-	map.multiply(delta);
-	map.add(bottom);
+static DefaultNoise createDefaultNoise(unsigned seed, float min, float max, unsigned width_x, unsigned width_y, bool wrap)
+{
+	//GradientNoise base(10, 10, seed);
+	//ValueNoise noise(10, 10, seed);
+	//GridNoise noise(10, 10, seed);
+	return DefaultNoise(PointNoise(5, 5, 100, seed, wrap), min, max, width_x, width_y);
 }
 
-void MapGenerator::layeredWhiteNoise(Heightmap& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence)
+static PlasmaHeights createPlasmaNoise(unsigned seed, float min, float max, unsigned scale, unsigned width_x, unsigned width_y, bool wrap)
 {
 	// Check input values
-	if (frequency < 2)
+	if (scale < 2)
 	{
-		frequency = 2;
+		scale = 2;
 	}
-	if (octaves < 1)
+	return PlasmaHeights(PlasmaNoise(scale, seed, wrap), min, max, width_x, width_y);
+}
+
+// Multiple layers of noise stacked on top of one another, with the frequency of each layer doubling
+template <class N, float (N::* sample)(float, float) const>
+struct LayeredNoise
+{
+	std::vector<N> noise;
+	unsigned octaves;
+	float persistence;
+	float delta;
+	float bottom;
+
+	LayeredNoise(unsigned seed, float min, float max, unsigned frequency, unsigned _octaves, float _persistence, unsigned width_x, unsigned width_y, bool wrap)
+		: octaves(_octaves), persistence(_persistence)
 	{
-		octaves = 1;
+		// Check input values
+		if (frequency < 2)
+		{
+			frequency = 2;
+		}
+		if (octaves < 1)
+		{
+			octaves = 1;
+		}
+		if (persistence < 0.0f)
+		{
+			persistence = 0.0f;
+		}
+		else if (persistence > 1.0f)
+		{
+			persistence = 1.0f;
+		}
+
+		// Create noise data
+		// Construct each octave in place, so the lattices are never copied
+		noise.reserve(octaves);
+		for (unsigned i = 1; i <= octaves; ++i)
+		{
+			noise.emplace_back(frequency * i, frequency * i, seed++, wrap);
+			noise.back().scale(width_x, width_y);
+		}
+
+		// Get the limits of the heightmap
+		delta = (max - min) / 2.0f;
+		bottom = min + delta;
 	}
-	if (persistence < 0.0f)
+
+	// Sample each octave of noise at a position
+	float getHeight(float x, float y) const
 	{
-		persistence = 0.0f;
+		float amplitude = 1.0f;
+		float total_amplitude = 0.0f;
+		float height = 0.0f;
+		for (unsigned i = 0; i < octaves; ++i)
+		{
+			height += (noise[i].*sample)(x, y) * amplitude;
+			total_amplitude += amplitude;
+			amplitude *= persistence;
+		}
+
+		// Scale the noise to fit within the specified limits
+		return bottom + delta * height / total_amplitude;
 	}
-	else if (persistence > 1.0f)
+};
+
+typedef LayeredNoise<ValueNoise, &ValueNoise::cubic> LayeredWhiteNoise;
+typedef LayeredNoise<GradientNoise, &GradientNoise::perlin> LayeredPerlin;
+typedef LayeredNoise<SimplexNoise, &SimplexNoise::simplex> LayeredSimplex;
+
+///
+/// Generators
+///
+
+template <class T>
+void MapGenerator::defaultGenerator(BasicHeightmap<T>& map, unsigned seed, float min, float max, const MapRegion& region, const PreviewCallback& preview)
+{
+	MapRegion window = getRegion(map, region);
+	DefaultNoise source = createDefaultNoise(seed, min, max, window.width_x, window.width_y, window.wrap);
+	fillHeights(map, [&](unsigned x, unsigned y) { return source.getNoise((float)(window.x + x), (float)(window.y + y)); }, preview, [&](Heightmap& level) { scaleNoise(level, min, max); });
+
+	// Scale the noise to fit within the specified limits
+	scaleNoise(map, min, max);
+}
+
+template <class T>
+void MapGenerator::plasma(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned scale, const MapRegion& region, const PreviewCallback& preview)
+{
+	// Generate noise
+	MapRegion window = getRegion(map, region);
+	PlasmaHeights source = createPlasmaNoise(seed, min, max, scale, window.width_x, window.width_y, window.wrap);
+
+	// Apply noise
+	fillHeights(map, [&](unsigned x, unsigned y) { return source.getNoise((float)(window.x + x), (float)(window.y + y)); }, preview, [&](Heightmap& level) { scaleNoise(level, min, max); });
+
+	// Scale the noise to fit within the specified limits
+	scaleNoise(map, min, max);
+}
+
+template <class T>
+void MapGenerator::layeredWhiteNoise(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, const MapRegion& region, const PreviewCallback& preview)
+{
+	MapRegion window = getRegion(map, region);
+	LayeredWhiteNoise source(seed, min, max, frequency, octaves, persistence, window.width_x, window.width_y, window.wrap);
+
+	// Sample each octave of noise into the heightmap
+	fillHeights(map, [&](unsigned x, unsigned y) { return source.getHeight((float)(window.x + x), (float)(window.y + y)); }, preview, [](Heightmap& level) {});
+}
+
+template <class T>
+void MapGenerator::layeredPerlin(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, const MapRegion& region, const PreviewCallback& preview)
+{
+	MapRegion window = getRegion(map, region);
+	LayeredPerlin source(seed, min, max, frequency, octaves, persistence, window.width_x, window.width_y, window.wrap);
+
+	// Sample each octave of noise into the heightmap
+	fillHeights(map, [&](unsigned x, unsigned y) { return source.getHeight((float)(window.x + x), (float)(window.y + y)); }, preview, [](Heightmap& level) {});
+}
+
+template <class T>
+void MapGenerator::layeredSimplex(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, const MapRegion& region, const PreviewCallback& preview)
+{
+	MapRegion window = getRegion(map, region);
+	LayeredSimplex source(seed, min, max, frequency, octaves, persistence, window.width_x, window.width_y, window.wrap);
+
+	// The row kernel can't sample the scattered cells of each level, so progressive generation samples one cell at a time
+	if (preview)
 	{
-		persistence = 1.0f;
+		fillHeights(map, [&](unsigned x, unsigned y) { return source.getHeight((float)(window.x + x), (float)(window.y + y)); }, preview, [](Heightmap& level) {});
+		return;
 	}
 
-	// Create noise data
-	std::vector<ValueNoise> noise;
+	// Rows of a window are widened to the groups of the row kernel that a row of the whole virtual heightmap would use,
+	// so that the window gets the same samples
 	unsigned width_x = map.getWidthX();
 	unsigned width_y = map.getWidthY();
-	for (unsigned i = 1; i <= octaves; ++i)
-	{
-		noise.push_back(ValueNoise(frequency * i, frequency * i, seed++));
-		noise.back().scale(width_x, width_y);
-	}
-
-	// Get the limits of the heightmap
-	float delta = (max - min) / 2.0f;
-	float bottom = min + delta;
+	unsigned row_start = window.x / SimplexNoise::row_group * SimplexNoise::row_group;
+	unsigned row_end = std::min((window.x + width_x + SimplexNoise::row_group - 1) / SimplexNoise::row_group * SimplexNoise::row_group, window.width_x);
+	unsigned row_offset = window.x - row_start;
 
-	// Sample each octave of noise into the heightmap
+	// Sample each octave of noise into the heightmap one row at a time
+	TraceSpan span("Sample octaves");
+	std::vector<float> row(width_x);
+	std::vector<float> octave(row_end - row_start);
 	for (unsigned y = 0; y < width_y; ++y)
 	{
-		for (unsigned x = 0; x < width_x; ++x)
+		float amplitude = 1.0f;
+		float total_amplitude = 0.0f;
+		std::fill(row.begin(), row.end(), 0.0f);
+		for (unsigned i = 0; i < source.octaves; ++i)
 		{
-			float amplitude = 1.0f;
-			float total_amplitude = 0.0f;
-			float height = 0.0f;
-			for (unsigned i = 0; i < octaves; ++i)
+			source.noise[i].simplexRow((float)row_start, (float)(window.y + y), row_end - row_start, octave.data());
+			for (unsigned x = 0; x < width_x; ++x)
 			{
-				height += noise[i].cubic((float)x, (float)y) * amplitude;
-				total_amplitude += amplitude;
-				amplitude *= persistence;
+				row[x] += octave[row_offset + x] * amplitude;
 			}
+			total_amplitude += amplitude;
+			amplitude *= source.persistence;
+		}
 
-			map.setHeight(x, y, height);
+		// Scale the noise to fit within the specified limits
+		float row_scale = source.delta / total_amplitude;
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			map.setHeight(x, y, source.bottom + row[x] * row_scale);
 		}
 	}
 }
 
-void MapGenerator::layeredPerlin(Heightmap& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence)
+///
+/// Height fields
+///
+
+HeightField::HeightField(unsigned _width_x, unsigned _width_y, bool _wrap) : width_x(_width_x), width_y(_width_y), wrap(_wrap)
 {
-	// Check input values
-	if (frequency < 2)
+}
+
+unsigned HeightField::getWidthX() const
+{
+	return width_x;
+}
+
+unsigned HeightField::getWidthY() const
+{
+	return width_y;
+}
+
+bool HeightField::isWrapped() const
+{
+	return wrap;
+}
+
+void HeightField::sample(const float* x, const float* y, unsigned count, float* heights) const
+{
+	// Wrapping noise is defined everywhere, and repeats on its own
+	if (wrap)
 	{
-		frequency = 2;
+		for (unsigned start = 0; start < count; start += batch_size)
+		{
+			sampleBatch(x + start, y + start, std::min(count - start, batch_size), heights + start);
+		}
+		return;
 	}
-	if (octaves < 1)
+
+	// The noise is only defined within the virtual heightmap
+	float max_x = (float)(std::max(width_x, 1u) - 1);
+	float max_y = (float)(std::max(width_y, 1u) - 1);
+
+	// Clamp the positions a batch at a time
+	float batch_x[batch_size];
+	float batch_y[batch_size];
+	for (unsigned start = 0; start < count; start += batch_size)
 	{
-		octaves = 1;
+		unsigned batch = std::min(count - start, batch_size);
+		for (unsigned i = 0; i < batch; ++i)
+		{
+			batch_x[i] = std::min(std::max(x[start + i], 0.0f), max_x);
+			batch_y[i] = std::min(std::max(y[start + i], 0.0f), max_y);
+		}
+		sampleBatch(batch_x, batch_y, batch, heights + start);
 	}
-	if (persistence < 0.0f)
+}
+
+// A height field that samples a generator's noise one position at a time
+template <class S>
+class NoiseField : public HeightField
+{
+public:
+	NoiseField(unsigned _width_x, unsigned _width_y, bool _wrap, S&& _source) : HeightField(_width_x, _width_y, _wrap), source(std::move(_source))
 	{
-		persistence = 0.0f;
 	}
-	else if (persistence > 1.0f)
+
+protected:
+	virtual void sampleBatch(const float* x, const float* y, unsigned count, float* heights) const override
 	{
-		persistence = 1.0f;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			heights[i] = source.getHeight(x[i], y[i]);
+		}
 	}
 
-	// Create noise data
-	std::vector<GradientNoise> noise;
-	unsigned width_x = map.getWidthX();
-	unsigned width_y = map.getWidthY();
-	for (unsigned i = 1; i <= octaves; ++i)
+private:
+	S source;
+};
+
+// A layered simplex height field, which samples each octave for a whole batch at a time like the generator's row kernel
+class SimplexField : public HeightField
+{
+public:
+	SimplexField(unsigned _width_x, unsigned _width_y, bool _wrap, LayeredSimplex&& _source) : HeightField(_width_x, _width_y, _wrap), source(std::move(_source))
 	{
-		noise.push_back(GradientNoise(frequency * i, frequency * i, seed++));
-		noise.back().scale(width_x, width_y);
 	}
 
-	// Get the limits of the heightmap
-	float delta = (max - min) / 2.0f;
-	float bottom = min + delta;
-
-	// Sample each octave of noise into the heightmap
-	for (unsigned y = 0; y < width_y; ++y)
+protected:
+	virtual void sampleBatch(const float* x, const float* y, unsigned count, float* heights) const override
 	{
-		for (unsigned x = 0; x < width_x; ++x)
+		float octave[batch_size];
+		float amplitude = 1.0f;
+		float total_amplitude = 0.0f;
+		std::fill(heights, heights + count, 0.0f);
+		for (unsigned i = 0; i < source.octaves; ++i)
 		{
-			float amplitude = 1.0f;
-			float total_amplitude = 0.0f;
-			float height = 0.0f;
-			for (unsigned i = 0; i < octaves; ++i)
+			source.noise[i].simplexPoints(x, y, count, octave);
+			for (unsigned k = 0; k < count; ++k)
 			{
-				height += noise[i].perlin((float)x, (float)y) * amplitude;
-				total_amplitude += amplitude;
-				amplitude *= persistence;
+				heights[k] += octave[k] * amplitude;
 			}
+			total_amplitude += amplitude;
+			amplitude *= source.persistence;
+		}
 
-			map.setHeight(x, y, height);
+		// Scale the noise to fit within the specified limits
+		float batch_scale = source.delta / total_amplitude;
+		for (unsigned k = 0; k < count; ++k)
+		{
+			heights[k] = source.bottom + heights[k] * batch_scale;
 		}
 	}
-}
\ No newline at end of file
+
+private:
+	LayeredSimplex source;
+};
+
+std::unique_ptr<HeightField> MapGenerator::defaultField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, bool wrap)
+{
+	return std::make_unique<NoiseField<DefaultNoise>>(width_x, width_y, wrap, createDefaultNoise(seed, min, max, width_x, width_y, wrap));
+}
+
+std::unique_ptr<HeightField> MapGenerator::plasmaField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned scale, bool wrap)
+{
+	return std::make_unique<NoiseField<PlasmaHeights>>(width_x, width_y, wrap, createPlasmaNoise(seed, min, max, scale, width_x, width_y, wrap));
+}
+
+std::unique_ptr<HeightField> MapGenerator::layeredWhiteNoiseField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, bool wrap)
+{
+	return std::make_unique<NoiseField<LayeredWhiteNoise>>(width_x, width_y, wrap, LayeredWhiteNoise(seed, min, max, frequency, octaves, persistence, width_x, width_y, wrap));
+}
+
+std::unique_ptr<HeightField> MapGenerator::layeredPerlinField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, bool wrap)
+{
+	return std::make_unique<NoiseField<LayeredPerlin>>(width_x, width_y, wrap, LayeredPerlin(seed, min, max, frequency, octaves, persistence, width_x, width_y, wrap));
+}
+
+std::unique_ptr<HeightField> MapGenerator::layeredSimplexField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, bool wrap)
+{
+	return std::make_unique<SimplexField>(width_x, width_y, wrap, LayeredSimplex(seed, min, max, frequency, octaves, persistence, width_x, width_y, wrap));
+}
+
+// Instantiate the generators for each heightmap storage type
+template void MapGenerator::defaultGenerator(BasicHeightmap<float>&, unsigned, float, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::plasma(BasicHeightmap<float>&, unsigned, float, float, unsigned, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredWhiteNoise(BasicHeightmap<float>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredPerlin(BasicHeightmap<float>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredSimplex(BasicHeightmap<float>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::defaultGenerator(BasicHeightmap<fixed16>&, unsigned, float, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::plasma(BasicHeightmap<fixed16>&, unsigned, float, float, unsigned, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredWhiteNoise(BasicHeightmap<fixed16>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredPerlin(BasicHeightmap<fixed16>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredSimplex(BasicHeightmap<fixed16>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::defaultGenerator(BasicHeightmap<half>&, unsigned, float, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::plasma(BasicHeightmap<half>&, unsigned, float, float, unsigned, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredWhiteNoise(BasicHeightmap<half>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredPerlin(BasicHeightmap<half>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
+template void MapGenerator::layeredSimplex(BasicHeightmap<half>&, unsigned, float, float, unsigned, unsigned, float, const MapRegion&, const PreviewCallback&);
\ No newline at end of file
@@ -2,6 +2,56 @@
 
 #include "heightmap.h"
 
+#include <functional>
+#include <memory>
+
+// Called with a preview of a heightmap that is being generated progressively
+// stride:	The spacing of the generated cells the preview holds, so the preview is 1 / stride of the size of the heightmap
+typedef std::function<void(const Heightmap& preview, unsigned stride)> PreviewCallback;
+
+// A window of a larger virtual heightmap, which lets part of a heightmap be generated without generating all of it
+struct MapRegion
+{
+	unsigned x = 0;			// The position of the first cell of the window within the virtual heightmap
+	unsigned y = 0;
+	unsigned width_x = 0;	// The size of the virtual heightmap, or 0 to use the size of the heightmap being generated
+	unsigned width_y = 0;
+	bool wrap = false;		// Set to true to make the virtual heightmap tile seamlessly, so its last cell runs on into its first
+};
+
+/*
+ * The heights a generator produces, as a function of position in a virtual heightmap
+ *
+ * Fields sample the generator's noise directly, so heights can be found anywhere without generating a heightmap, and
+ * positions between cells get the height of the noise there rather than an interpolation of the cells around them.
+ */
+class HeightField
+{
+public:
+	HeightField(unsigned _width_x, unsigned _width_y, bool _wrap = false);
+	virtual ~HeightField() {};
+
+	unsigned getWidthX() const;
+	unsigned getWidthY() const;
+	bool isWrapped() const;
+
+	// Get the heights at count positions, in cells of the virtual heightmap, writing them to heights
+	// Positions outside the virtual heightmap are clamped to its edges, or repeat it if the field wraps
+	void sample(const float* x, const float* y, unsigned count, float* heights) const;
+
+protected:
+	// The largest number of positions passed to sampleBatch at once
+	static constexpr unsigned batch_size = 256;
+
+	// Get the heights at count positions within the virtual heightmap, given as separate x and y coordinates
+	virtual void sampleBatch(const float* x, const float* y, unsigned count, float* heights) const = 0;
+
+private:
+	unsigned width_x;
+	unsigned width_y;
+	bool wrap;
+};
+
 /*
  * Default parameters for all map generators:
  *
@@ -9,18 +59,25 @@
  * seed:	The RNG seed used to generate map data
  * min:		The minimum elevation of the heightmap produced
  * max:		The maximum elevation of the heightmap produced
+ * region:	The window of the virtual heightmap that map holds - each cell gets the same height it has in the virtual heightmap,
+ *			and only the cells of the window are sampled. If region.wrap is set, the noise lattices wrap so that the
+ *			virtual heightmap tiles seamlessly
+ * preview:	If set, the heightmap is generated coarse to fine, calling preview with every 4th and then every 2nd cell in
+ *			each direction before the rest of the heightmap is generated - no cell is sampled twice
  */
 namespace MapGenerator
 {
 	// The default heightmap generator
-	void defaultGenerator(Heightmap& map, unsigned seed, float min, float max);
+	template <class T>
+	void defaultGenerator(BasicHeightmap<T>& map, unsigned seed, float min, float max, const MapRegion& region = MapRegion(), const PreviewCallback& preview = nullptr);
 
 	/*
 	 * Generate a heightmap using the diamond-square fractal pattern
 	 *
-	 * scale:		The scale of the noise map generated - the frequency of the noise will be equal to (2 ^ scale) + 1
+	 * scale:		The scale of the noise map generated - the frequency of the noise will be equal to (2 ^ scale) + 1, or 2 ^ scale when wrapping
 	 */
-	void plasma(Heightmap& map, unsigned seed, float min, float max, unsigned scale);
+	template <class T>
+	void plasma(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned scale, const MapRegion& region = MapRegion(), const PreviewCallback& preview = nullptr);
 
 	/*
 	 * Generate a heightmap using multiple layers of white noise stacked on top of one another, with the frequency of each layer doubling
@@ -29,7 +86,8 @@ namespace MapGenerator
 	 * octaves:		The number of layers of noise to use - lower numbers of ocataves results in smoother and simpler noise, higher octaves are more diverse and rough (must be > 0)
 	 * persistence:	The level of influence each successive octave has - higher persistence results in bumpier terrain, while lower persistence creates smoother terrain (must be between 0.0 and 1.0)
 	 */
-	void layeredWhiteNoise(Heightmap& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence);
+	template <class T>
+	void layeredWhiteNoise(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, const MapRegion& region = MapRegion(), const PreviewCallback& preview = nullptr);
 
 	/*
 	 * Generate a heightmap using multiple layers of Perlin noise stacked on top of one another, with the frequency of each layer doubling
@@ -38,5 +96,38 @@ namespace MapGenerator
 	 * octaves:		The number of layers of noise to use - lower numbers of ocataves results in smoother and simpler noise, higher octaves are more diverse and rough (must be > 0)
 	 * persistence:	The level of influence each successive octave has - higher persistence results in bumpier terrain, while lower persistence creates smoother terrain (must be between 0.0 and 1.0)
 	 */
-	void layeredPerlin(Heightmap& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence);
+	template <class T>
+	void layeredPerlin(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, const MapRegion& region = MapRegion(), const PreviewCallback& preview = nullptr);
+
+	/*
+	 * Generate a heightmap using multiple layers of simplex noise stacked on top of one another, with the frequency of each layer doubling
+	 *
+	 * frequency:	The frequency of the first layer of noise - lower frequency mean smoother noise, while higher frequency will be rougher and bumpier (must be > 2)
+	 * octaves:		The number of layers of noise to use - lower numbers of ocataves results in smoother and simpler noise, higher octaves are more diverse and rough (must be > 0)
+	 * persistence:	The level of influence each successive octave has - higher persistence results in bumpier terrain, while lower persistence creates smoother terrain (must be between 0.0 and 1.0)
+	 *
+	 * Progressive generation samples one cell at a time rather than a row at a time, so its heights can differ in the last bits
+	 * (THROWS logic_error if region.wrap is set, as simplex noise can't wrap)
+	 */
+	template <class T>
+	void layeredSimplex(BasicHeightmap<T>& map, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, const MapRegion& region = MapRegion(), const PreviewCallback& preview = nullptr);
+
+	///
+	/// Height fields
+	///
+
+	/*
+	 * Create a field with the heights each generator gives a width_x by width_y heightmap, taking the same parameters
+	 *
+	 * Heights match the generated heightmap up to the precision of its storage type. Layered simplex fields sample
+	 * in groups with the same kernel as the generator, so they can differ in the last bits from the scalar samples the
+	 * generator takes at the end of each row.
+	 *
+	 * wrap:	Set to true to match a generator given a region that wraps - the field then tiles every width_x by width_y cells
+	 */
+	std::unique_ptr<HeightField> defaultField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, bool wrap = false);
+	std::unique_ptr<HeightField> plasmaField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned scale, bool wrap = false);
+	std::unique_ptr<HeightField> layeredWhiteNoiseField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, bool wrap = false);
+	std::unique_ptr<HeightField> layeredPerlinField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, bool wrap = false);
+	std::unique_ptr<HeightField> layeredSimplexField(unsigned width_x, unsigned width_y, unsigned seed, float min, float max, unsigned frequency, unsigned octaves, float persistence, bool wrap = false);
 }
\ No newline at end of file
@@ -0,0 +1,728 @@
+#include "graph.h"
+#include "algorithm.h"
+#include "parallel.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+
+// The width and height of the tiles a graph is run on
+constexpr unsigned graph_tile_size = 64;
+
+///
+/// Noise sources
+///
+
+// A noise node that can be sampled one row at a time
+class GraphSource
+{
+public:
+	virtual ~GraphSource() {};
+
+	// Sample count points starting at x, y and write them to out
+	virtual void sampleRow(float x, float y, unsigned count, float* out) const = 0;
+};
+
+// Multiple octaves of noise added together
+template <class N>
+class LayeredSource : public GraphSource
+{
+public:
+	LayeredSource(float (N::* _sample)(float, float) const) : sample(_sample) {};
+
+	virtual void sampleRow(float x, float y, unsigned count, float* out) const override
+	{
+		for (unsigned k = 0; k < count; ++k)
+		{
+			out[k] = 0.0f;
+		}
+
+		for (unsigned i = 0; i < layers.size(); ++i)
+		{
+			const N& layer = layers[i];
+			float amplitude = amplitudes[i];
+			for (unsigned k = 0; k < count; ++k)
+			{
+				out[k] += (layer.*sample)(x + k, y) * amplitude;
+			}
+		}
+	}
+
+	std::vector<N> layers;
+	std::vector<float> amplitudes;
+
+protected:
+	float (N::* sample)(float, float) const;
+};
+
+// Multiple octaves of simplex noise, sampled with the row kernel
+class SimplexSource : public LayeredSource<SimplexNoise>
+{
+public:
+	SimplexSource() : LayeredSource<SimplexNoise>(&SimplexNoise::simplex) {};
+
+	virtual void sampleRow(float x, float y, unsigned count, float* out) const override
+	{
+		for (unsigned k = 0; k < count; ++k)
+		{
+			out[k] = 0.0f;
+		}
+
+		float row[graph_tile_size];
+		for (unsigned i = 0; i < layers.size(); ++i)
+		{
+			float amplitude = amplitudes[i];
+			for (unsigned start = 0; start < count; start += graph_tile_size)
+			{
+				unsigned length = std::min(count - start, graph_tile_size);
+				layers[i].simplexRow(x + start, y, length, row);
+				for (unsigned k = 0; k < length; ++k)
+				{
+					out[start + k] += row[k] * amplitude;
+				}
+			}
+		}
+	}
+};
+
+// Add octaves of noise to a layered source, matching the layered map generators
+template <class N, class S>
+static void addOctaves(S& source, unsigned frequency, unsigned octaves, float persistence, unsigned seed, unsigned width, unsigned height)
+{
+	source.layers.reserve(octaves);
+	float amplitude = 1.0f;
+	for (unsigned i = 1; i <= octaves; ++i)
+	{
+		source.layers.emplace_back(frequency * i, frequency * i, seed++);
+		source.layers.back().scale(width, height);
+		source.amplitudes.push_back(amplitude);
+		amplitude *= persistence;
+	}
+}
+
+///
+/// Graph loading
+///
+
+// Remove whitespace from both ends of a string
+static std::string trim(const std::string& text)
+{
+	size_t start = text.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos)
+	{
+		return "";
+	}
+	size_t end = text.find_last_not_of(" \t\r\n");
+	return text.substr(start, end - start + 1);
+}
+
+GeneratorGraph::GeneratorGraph(const std::string& filename)
+{
+	parse(filename);
+	compile();
+}
+
+unsigned GeneratorGraph::getOutputCount() const
+{
+	return (unsigned)output_files.size();
+}
+
+const std::string& GeneratorGraph::getOutputFile(unsigned output) const
+{
+	return output_files[output];
+}
+
+unsigned GeneratorGraph::getMainOutput() const
+{
+	for (unsigned i = 0; i < output_files.size(); ++i)
+	{
+		if (output_files[i].empty())
+		{
+			return i;
+		}
+	}
+	return 0;
+}
+
+float GeneratorGraph::getFloat(const Node& node, const std::string& key, float fallback) const
+{
+	auto param = node.params.find(key);
+	if (param == node.params.end())
+	{
+		return fallback;
+	}
+
+	try
+	{
+		return std::stof(param->second);
+	}
+	catch (std::exception&)
+	{
+		throw std::runtime_error("Invalid value for " + key + " in node " + node.name);
+	}
+}
+
+unsigned GeneratorGraph::getUnsigned(const Node& node, const std::string& key, unsigned fallback) const
+{
+	float value = getFloat(node, key, (float)fallback);
+	if (value < 0.0f)
+	{
+		throw std::runtime_error("Invalid value for " + key + " in node " + node.name);
+	}
+	return (unsigned)value;
+}
+
+void GeneratorGraph::parse(const std::string& filename)
+{
+	std::ifstream file(filename);
+	if (!file)
+	{
+		throw std::runtime_error("Unable to open graph file " + filename);
+	}
+
+	// Read each section as a node
+	std::string line;
+	unsigned line_number = 0;
+	while (std::getline(file, line))
+	{
+		++line_number;
+
+		// Remove comments
+		line = trim(line.substr(0, line.find_first_of(";#")));
+		if (line.empty())
+		{
+			continue;
+		}
+
+		if (line.front() == '[' && line.back() == ']')
+		{
+			// Start a new node
+			Node node;
+			node.name = trim(line.substr(1, line.size() - 2));
+			for (const Node& other : nodes)
+			{
+				if (other.name == node.name)
+				{
+					throw std::runtime_error("Duplicate node " + node.name + " on line " + std::to_string(line_number));
+				}
+			}
+			nodes.push_back(node);
+		}
+		else
+		{
+			// Add a parameter to the current node
+			size_t split = line.find('=');
+			if (split == std::string::npos || nodes.empty())
+			{
+				throw std::runtime_error("Unable to read line " + std::to_string(line_number) + " of " + filename);
+			}
+
+			std::string key = trim(line.substr(0, split));
+			std::string value = trim(line.substr(split + 1));
+			if (key == "type")
+			{
+				nodes.back().type = value;
+			}
+			else
+			{
+				nodes.back().params[key == "inputs" ? "input" : key] = value;
+			}
+		}
+	}
+
+	// Link the inputs of each node
+	for (Node& node : nodes)
+	{
+		std::istringstream inputs(node.params["input"]);
+		std::string name;
+		while (inputs >> name)
+		{
+			unsigned input = 0;
+			while (input < nodes.size() && nodes[input].name != name)
+			{
+				++input;
+			}
+			if (input == nodes.size())
+			{
+				throw std::runtime_error("Node " + node.name + " uses missing input " + name);
+			}
+			node.inputs.push_back(input);
+		}
+	}
+}
+
+///
+/// Graph compilation
+///
+
+// The number of inputs used by each type of node, or -1 for types that combine two or more inputs
+static int getInputCount(const std::string& type)
+{
+	if (type == "perlin" || type == "simplex" || type == "value" || type == "grid" || type == "worley" || type == "plasma" || type == "constant")
+	{
+		return 0;
+	}
+	else if (type == "scale" || type == "clamp" || type == "remap" || type == "abs" || type == "normals" || type == "output")
+	{
+		return 1;
+	}
+	else if (type == "add" || type == "subtract" || type == "multiply" || type == "min" || type == "max")
+	{
+		return -1;
+	}
+	return -2;
+}
+
+void GeneratorGraph::compile()
+{
+	// Check the inputs of each node
+	for (const Node& node : nodes)
+	{
+		int inputs = getInputCount(node.type);
+		if (inputs == -2)
+		{
+			throw std::runtime_error("Node " + node.name + " has unknown type '" + node.type + "'");
+		}
+		if ((inputs >= 0 && node.inputs.size() != (size_t)inputs) || (inputs == -1 && node.inputs.size() < 2))
+		{
+			throw std::runtime_error("Node " + node.name + " has the wrong number of inputs");
+		}
+		for (unsigned input : node.inputs)
+		{
+			if (nodes[input].type == "output" || nodes[input].type == "normals")
+			{
+				throw std::runtime_error("Node " + node.name + " can't use " + nodes[input].name + " as an input");
+			}
+		}
+	}
+
+	// Sort the nodes used by the outputs so that each node comes after its inputs
+	std::vector<unsigned> order;
+	std::vector<int> state(nodes.size(), 0);
+	std::vector<unsigned> consumers(nodes.size(), 0);
+	std::vector<std::pair<unsigned, unsigned>> stack;
+	for (unsigned sink = 0; sink < nodes.size(); ++sink)
+	{
+		if (nodes[sink].type != "output" && nodes[sink].type != "normals")
+		{
+			continue;
+		}
+
+		// Depth first search, tracking the next input to visit for each node on the stack
+		stack.push_back({ sink, 0 });
+		state[sink] = 1;
+		while (!stack.empty())
+		{
+			unsigned node = stack.back().first;
+			unsigned next = stack.back().second++;
+			if (next < nodes[node].inputs.size())
+			{
+				unsigned input = nodes[node].inputs[next];
+				consumers[input]++;
+				if (state[input] == 1)
+				{
+					throw std::runtime_error("Node " + nodes[input].name + " depends on itself");
+				}
+				else if (state[input] == 0)
+				{
+					state[input] = 1;
+					stack.push_back({ input, 0 });
+				}
+			}
+			else
+			{
+				state[node] = 2;
+				order.push_back(node);
+				stack.pop_back();
+			}
+		}
+	}
+
+	// Index the outputs in file order
+	std::vector<unsigned> result_index(nodes.size(), 0);
+	for (unsigned i = 0; i < nodes.size(); ++i)
+	{
+		if (nodes[i].type == "output")
+		{
+			result_index[i] = (unsigned)output_files.size();
+			auto file = nodes[i].params.find("file");
+			output_files.push_back(file != nodes[i].params.end() ? file->second : "");
+		}
+		else if (nodes[i].type == "normals")
+		{
+			result_index[i] = normals_count++;
+		}
+	}
+	if (output_files.empty())
+	{
+		throw std::runtime_error("The graph has no output nodes");
+	}
+
+	// Create steps, tracking which node holds the value of each node
+	std::vector<unsigned> value(nodes.size(), 0);
+	std::vector<unsigned> producer(nodes.size(), 0);
+	for (unsigned n : order)
+	{
+		const Node& node = nodes[n];
+		const std::string& type = node.type;
+		Step step;
+		step.node = n;
+		value[n] = n;
+
+		if (type == "constant")
+		{
+			step.type = StepType::Constant;
+			step.value = getFloat(node, "value", 0.0f);
+		}
+		else if (getInputCount(type) == 0)
+		{
+			step.type = StepType::Source;
+		}
+		else if (type == "output" || type == "normals")
+		{
+			step.type = type == "output" ? StepType::Store : StepType::Normals;
+			step.inputs.push_back(value[node.inputs[0]]);
+			step.output = result_index[n];
+		}
+		else if (getInputCount(type) == 1)
+		{
+			// Convert the node into an operation on a single value
+			UnaryOp op;
+			if (type == "scale")
+			{
+				op.type = UnaryOp::Scale;
+				op.a = getFloat(node, "scale", 1.0f);
+				op.b = getFloat(node, "bias", 0.0f);
+			}
+			else if (type == "remap")
+			{
+				float from_min = getFloat(node, "from_min", -1.0f);
+				float from_max = getFloat(node, "from_max", 1.0f);
+				float to_min = getFloat(node, "to_min", 0.0f);
+				float to_max = getFloat(node, "to_max", 1.0f);
+				if (from_max == from_min)
+				{
+					throw std::runtime_error("Node " + node.name + " remaps an empty range");
+				}
+
+				op.type = UnaryOp::Scale;
+				op.a = (to_max - to_min) / (from_max - from_min);
+				op.b = to_min - from_min * op.a;
+			}
+			else if (type == "clamp")
+			{
+				op.type = UnaryOp::Clamp;
+				op.a = getFloat(node, "min", -1.0f);
+				op.b = getFloat(node, "max", 1.0f);
+			}
+			else
+			{
+				op.type = UnaryOp::Abs;
+			}
+
+			unsigned input = node.inputs[0];
+			if (consumers[input] == 1)
+			{
+				// Fuse the operation into the step that produces the input
+				steps[producer[input]].post.push_back(op);
+				value[n] = value[input];
+				producer[n] = producer[input];
+				continue;
+			}
+
+			step.type = StepType::Unary;
+			step.inputs.push_back(value[input]);
+			step.post.push_back(op);
+		}
+		else
+		{
+			step.type = StepType::Combine;
+			if (type == "add")
+			{
+				step.combine = CombineOp::Add;
+			}
+			else if (type == "subtract")
+			{
+				step.combine = CombineOp::Subtract;
+			}
+			else if (type == "multiply")
+			{
+				step.combine = CombineOp::Multiply;
+			}
+			else if (type == "min")
+			{
+				step.combine = CombineOp::Min;
+			}
+			else
+			{
+				step.combine = CombineOp::Max;
+			}
+
+			for (unsigned input : node.inputs)
+			{
+				step.inputs.push_back(value[input]);
+			}
+		}
+
+		producer[n] = (unsigned)steps.size();
+		steps.push_back(step);
+	}
+
+	// Find the last step that reads each value
+	std::vector<unsigned> last_use(nodes.size(), 0);
+	for (unsigned s = 0; s < steps.size(); ++s)
+	{
+		for (unsigned input : steps[s].inputs)
+		{
+			last_use[input] = s;
+		}
+	}
+
+	// Assign buffers to values, reusing buffers once their values are no longer needed
+	std::vector<unsigned> buffer(nodes.size(), 0);
+	std::vector<unsigned> free_buffers;
+	for (unsigned s = 0; s < steps.size(); ++s)
+	{
+		Step& step = steps[s];
+		for (unsigned& input : step.inputs)
+		{
+			input = buffer[input];
+		}
+
+		// Allocate the output before releasing the inputs so that no step writes to a buffer it reads from
+		if (step.type != StepType::Store && step.type != StepType::Normals)
+		{
+			if (free_buffers.empty())
+			{
+				free_buffers.push_back(buffer_count++);
+			}
+			buffer[step.node] = free_buffers.back();
+			step.output = free_buffers.back();
+			free_buffers.pop_back();
+		}
+
+		for (unsigned v = 0; v < nodes.size(); ++v)
+		{
+			if (state[v] == 2 && value[v] == v && last_use[v] == s && producer[v] < s)
+			{
+				free_buffers.push_back(buffer[v]);
+			}
+		}
+	}
+}
+
+///
+/// Graph execution
+///
+
+template <class T>
+void GeneratorGraph::generate(GraphResult<T>& result, unsigned width, unsigned height, unsigned seed) const
+{
+	// Create the output heightmaps
+	result.heightmaps.resize(output_files.size());
+	for (BasicHeightmap<T>& map : result.heightmaps)
+	{
+		map.resize(width, height);
+	}
+	result.normals.resize(normals_count);
+	result.tangents.resize(normals_count);
+	std::vector<Heightmap> normal_inputs(normals_count);
+	for (Heightmap& map : normal_inputs)
+	{
+		map.resize(width, height);
+	}
+
+	// Create the noise used by each source step
+	std::vector<std::unique_ptr<GraphSource>> sources(steps.size());
+	for (unsigned s = 0; s < steps.size(); ++s)
+	{
+		if (steps[s].type != StepType::Source)
+		{
+			continue;
+		}
+
+		const Node& node = nodes[steps[s].node];
+		unsigned node_seed = seed + getUnsigned(node, "seed", 0);
+		unsigned frequency = std::max(getUnsigned(node, "frequency", 4), 2u);
+		unsigned octaves = std::max(getUnsigned(node, "octaves", 1), 1u);
+		float persistence = std::min(std::max(getFloat(node, "persistence", 0.5f), 0.0f), 1.0f);
+
+		if (node.type == "perlin")
+		{
+			auto source = std::make_unique<LayeredSource<GradientNoise>>(&GradientNoise::perlin);
+			addOctaves<GradientNoise>(*source, frequency, octaves, persistence, node_seed, width, height);
+			sources[s] = std::move(source);
+		}
+		else if (node.type == "simplex")
+		{
+			auto source = std::make_unique<SimplexSource>();
+			addOctaves<SimplexNoise>(*source, frequency, octaves, persistence, node_seed, width, height);
+			sources[s] = std::move(source);
+		}
+		else if (node.type == "value")
+		{
+			auto param = node.params.find("interpolation");
+			std::string interpolation = param != node.params.end() ? param->second : "cubic";
+			float (ValueNoise::* sample)(float, float) const = &ValueNoise::cubic;
+			if (interpolation == "linear")
+			{
+				sample = &ValueNoise::linear;
+			}
+			else if (interpolation == "cosine")
+			{
+				sample = &ValueNoise::cosine;
+			}
+
+			auto source = std::make_unique<LayeredSource<ValueNoise>>(sample);
+			addOctaves<ValueNoise>(*source, frequency, octaves, persistence, node_seed, width, height);
+			sources[s] = std::move(source);
+		}
+		else if (node.type == "grid")
+		{
+			auto source = std::make_unique<LayeredSource<GridNoise>>(&GridNoise::worley);
+			addOctaves<GridNoise>(*source, frequency, octaves, persistence, node_seed, width, height);
+			sources[s] = std::move(source);
+		}
+		else if (node.type == "worley")
+		{
+			unsigned size = std::max(getUnsigned(node, "size", 5), 1u);
+			auto source = std::make_unique<LayeredSource<PointNoise>>(&PointNoise::worley);
+			source->layers.emplace_back(size, size, getUnsigned(node, "points", 100), node_seed);
+			source->layers.back().scale(width, height);
+			source->amplitudes.push_back(1.0f);
+			sources[s] = std::move(source);
+		}
+		else if (node.type == "plasma")
+		{
+			auto source = std::make_unique<LayeredSource<PlasmaNoise>>(&PlasmaNoise::cubic);
+			source->layers.emplace_back(std::max(getUnsigned(node, "scale", 4), 2u), node_seed);
+			source->layers.back().scale(width, height);
+			source->amplitudes.push_back(1.0f);
+			sources[s] = std::move(source);
+		}
+	}
+
+	// Each thread gets its own set of tile buffers
+	const unsigned tile_area = graph_tile_size * graph_tile_size;
+	unsigned threads = getThreadCount();
+	std::vector<float> buffers((size_t)threads * buffer_count * tile_area);
+
+	unsigned tiles_x = (width + graph_tile_size - 1) / graph_tile_size;
+	unsigned tiles_y = (height + graph_tile_size - 1) / graph_tile_size;
+	parallelFor(tiles_x * tiles_y, [&](unsigned tile, unsigned thread)
+	{
+		// Get the area covered by the tile
+		unsigned x0 = (tile % tiles_x) * graph_tile_size;
+		unsigned y0 = (tile / tiles_x) * graph_tile_size;
+		unsigned tile_width = std::min(graph_tile_size, width - x0);
+		unsigned tile_height = std::min(graph_tile_size, height - y0);
+		unsigned count = tile_width * tile_height;
+		float* thread_buffers = buffers.data() + (size_t)thread * buffer_count * tile_area;
+
+		for (unsigned s = 0; s < steps.size(); ++s)
+		{
+			const Step& step = steps[s];
+			float* out = thread_buffers + step.output * tile_area;
+
+			switch (step.type)
+			{
+			case StepType::Source:
+				for (unsigned y = 0; y < tile_height; ++y)
+				{
+					sources[s]->sampleRow((float)x0, (float)(y0 + y), tile_width, out + y * tile_width);
+				}
+				break;
+
+			case StepType::Constant:
+				std::fill(out, out + count, step.value);
+				break;
+
+			case StepType::Unary:
+				std::copy(thread_buffers + step.inputs[0] * tile_area, thread_buffers + step.inputs[0] * tile_area + count, out);
+				break;
+
+			case StepType::Combine:
+			{
+				const float* a = thread_buffers + step.inputs[0] * tile_area;
+				std::copy(a, a + count, out);
+				for (unsigned i = 1; i < step.inputs.size(); ++i)
+				{
+					const float* b = thread_buffers + step.inputs[i] * tile_area;
+					switch (step.combine)
+					{
+					case CombineOp::Add:
+						for (unsigned k = 0; k < count; ++k) out[k] += b[k];
+						break;
+					case CombineOp::Subtract:
+						for (unsigned k = 0; k < count; ++k) out[k] -= b[k];
+						break;
+					case CombineOp::Multiply:
+						for (unsigned k = 0; k < count; ++k) out[k] *= b[k];
+						break;
+					case CombineOp::Min:
+						for (unsigned k = 0; k < count; ++k) out[k] = std::min(out[k], b[k]);
+						break;
+					case CombineOp::Max:
+						for (unsigned k = 0; k < count; ++k) out[k] = std::max(out[k], b[k]);
+						break;
+					}
+				}
+				break;
+			}
+
+			case StepType::Store:
+			case StepType::Normals:
+			{
+				// Write the tile to the output
+				const float* in = thread_buffers + step.inputs[0] * tile_area;
+				for (unsigned y = 0; y < tile_height; ++y)
+				{
+					for (unsigned x = 0; x < tile_width; ++x)
+					{
+						if (step.type == StepType::Store)
+						{
+							result.heightmaps[step.output].setHeight(x0 + x, y0 + y, in[y * tile_width + x]);
+						}
+						else
+						{
+							normal_inputs[step.output].setHeight(x0 + x, y0 + y, in[y * tile_width + x]);
+						}
+					}
+				}
+				continue;
+			}
+			}
+
+			// Apply fused operations while the tile is in the cache
+			for (const UnaryOp& op : step.post)
+			{
+				switch (op.type)
+				{
+				case UnaryOp::Scale:
+					for (unsigned k = 0; k < count; ++k) out[k] = out[k] * op.a + op.b;
+					break;
+				case UnaryOp::Clamp:
+					for (unsigned k = 0; k < count; ++k) out[k] = std::min(std::max(out[k], op.a), op.b);
+					break;
+				case UnaryOp::Abs:
+					for (unsigned k = 0; k < count; ++k) out[k] = std::fabs(out[k]);
+					break;
+				}
+			}
+		}
+	});
+
+	// Calculate normals once the full heightmap is available
+	for (unsigned i = 0; i < normals_count; ++i)
+	{
+		normal_inputs[i].calculateNormals(result.normals[i], result.tangents[i]);
+	}
+}
+
+// Instantiate the graph for each heightmap storage type
+template void GeneratorGraph::generate(GraphResult<float>&, unsigned, unsigned, unsigned) const;
+template void GeneratorGraph::generate(GraphResult<fixed16>&, unsigned, unsigned, unsigned) const;
+template void GeneratorGraph::generate(GraphResult<half>&, unsigned, unsigned, unsigned) const;
\ No newline at end of file
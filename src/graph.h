@@ -0,0 +1,145 @@
+#pragma once
+
+#include "heightmap.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+/*
+ * The heightmaps produced by a generator graph
+ *
+ * heightmaps:			One heightmap for each output node, in the order they appear in the graph file
+ * normals, tangents:	The normals and tangents for each normals node, in the order they appear in the graph file
+ */
+template <class T>
+struct GraphResult
+{
+	std::vector<BasicHeightmap<T>> heightmaps;
+	std::vector<Vectormap> normals;
+	std::vector<Vectormap> tangents;
+};
+
+/*
+ * A heightmap generator described by a graph of nodes in an ini file
+ *
+ * Each section of the file defines a node with the same name as the section:
+ *
+ *	[base]
+ *	type = perlin				; The type of the node
+ *	frequency = 4				; Parameters for the node
+ *
+ *	[out]
+ *	type = scale
+ *	input = base				; The nodes used as input, separated by spaces ("inputs" is also accepted)
+ *
+ * Node types and their parameters:
+ *
+ *	perlin, simplex, grid:	frequency, octaves, persistence, seed
+ *	value:					frequency, octaves, persistence, seed, interpolation (linear, cosine or cubic)
+ *	worley:					size, points, seed
+ *	plasma:					scale, seed
+ *	constant:				value
+ *	add, subtract, multiply, min, max:	Combine two or more inputs
+ *	scale:					scale, bias (input * scale + bias)
+ *	clamp:					min, max
+ *	remap:					from_min, from_max, to_min, to_max (linearly map one range onto another)
+ *	abs
+ *	normals:				Calculate the normals and tangents of the input
+ *	output:					file (optional - the heightmap is saved to this file instead of the main output)
+ *
+ * Noise parameters match those of the map generators, and the seed of each noise node is added to the seed of the graph
+ *
+ * The graph is compiled into a list of steps that are run on small tiles of the heightmap across multiple threads.
+ * Only tile-sized buffers are used for intermediate values, and chains of single-input nodes are applied in place
+ * to the buffer of the node that feeds them while the tile is still in the cache.
+ */
+class GeneratorGraph
+{
+public:
+	// Load and compile a graph from a file
+	// (THROWS runtime_error if the file can't be read or the graph is invalid)
+	GeneratorGraph(const std::string& filename);
+
+	// Get the number of output nodes
+	unsigned getOutputCount() const;
+	// Get the file an output node should be saved to, or an empty string if it is the main output
+	const std::string& getOutputFile(unsigned output) const;
+	// Get the index of the main output - the first output without a file, or the first output if all outputs have files
+	unsigned getMainOutput() const;
+
+	// Generate every output of the graph at the given size
+	template <class T>
+	void generate(GraphResult<T>& result, unsigned width, unsigned height, unsigned seed) const;
+
+private:
+	// A node as read from the graph file
+	struct Node
+	{
+		std::string name;
+		std::string type;
+		std::map<std::string, std::string> params;
+		std::vector<unsigned> inputs;
+	};
+
+	// An operation applied to a single value
+	struct UnaryOp
+	{
+		enum Type
+		{
+			Scale,		// value * a + b
+			Clamp,		// Clamp value to [a, b]
+			Abs			// The absolute value
+		} type;
+		float a = 0.0f;
+		float b = 0.0f;
+	};
+
+	// An operation used to combine multiple values
+	enum class CombineOp
+	{
+		Add,
+		Subtract,
+		Multiply,
+		Min,
+		Max
+	};
+
+	enum class StepType
+	{
+		Source,		// Sample a noise node
+		Constant,	// Fill the buffer with a constant
+		Unary,		// Copy an input, applying single-value operations to it
+		Combine,	// Combine two or more inputs
+		Store,		// Write an input to an output heightmap
+		Normals		// Write an input to a heightmap used to calculate normals
+	};
+
+	// A single operation on a tile
+	struct Step
+	{
+		StepType type;
+		unsigned node;						// The node this step was created from
+		CombineOp combine = CombineOp::Add;	// The operation used by combine steps
+		float value = 0.0f;					// The value used by constant steps
+		std::vector<unsigned> inputs;		// The buffers read by the step
+		unsigned output = 0;				// The buffer written by the step, or the result index for stores
+		std::vector<UnaryOp> post;			// Operations applied to the output buffer in place
+	};
+
+	// Get a parameter of a node
+	float getFloat(const Node& node, const std::string& key, float fallback) const;
+	unsigned getUnsigned(const Node& node, const std::string& key, unsigned fallback) const;
+
+	// Read the nodes from a graph file
+	void parse(const std::string& filename);
+	// Sort the nodes, fuse operations and assign tile buffers
+	void compile();
+
+	std::vector<Node> nodes;
+	std::vector<Step> steps;
+	unsigned buffer_count = 0;
+
+	std::vector<std::string> output_files;
+	unsigned normals_count = 0;
+};
\ No newline at end of file
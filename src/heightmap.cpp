@@ -1,27 +1,20 @@
 #include "heightmap.h"
 
+#include <stdexcept>
+
 Vectormap::Vectormap()
 {
 
 }
 
-Vectormap::Vectormap(const Vectormap& _copy)
-{
-	resize(_copy.width_x, _copy.width_y);
-	memcpy(data, _copy.data, width_x * width_y * sizeof(hdata));
-}
-
 Vectormap::Vectormap(unsigned x, unsigned y)
 {
 	resize(x, y);
 }
 
-Vectormap::~Vectormap()
+Vectormap Vectormap::clone() const
 {
-	if (data != nullptr)
-	{
-		delete[] data;
-	}
+	return *this;
 }
 
 unsigned Vectormap::getWidthX() const
@@ -36,12 +29,22 @@ unsigned Vectormap::getWidthY() const
 
 Vector3 Vectormap::getVector(unsigned x, unsigned y) const
 {
-	return data[y * width_x + x];
+	return data[(size_t)y * width_x + x];
+}
+
+Vector3* Vectormap::getData()
+{
+	return data.data();
+}
+
+const Vector3* Vectormap::getData() const
+{
+	return data.data();
 }
 
 void Vectormap::setVector(unsigned x, unsigned y, Vector3 value)
 {
-	data[y * width_x + x] = value;
+	data[(size_t)y * width_x + x] = value;
 }
 
 void Vectormap::resize(unsigned x, unsigned y)
@@ -49,87 +52,167 @@ void Vectormap::resize(unsigned x, unsigned y)
 	width_x = x;
 	width_y = y;
 
-	// Delete existing data if necessary
-	if (data != nullptr)
-	{
-		delete[] data;
-	}
-
-	// Create the data buffer
-	unsigned size = width_x * width_y;
-	data = new Vector3[size];
+	// Replace the data buffer
+	data.assign((size_t)width_x * width_y, Vector3());
 }
 
-Heightmap::Heightmap()
+template <class T>
+BasicHeightmap<T>::BasicHeightmap()
 {
 
 }
 
-Heightmap::Heightmap(const Heightmap& _copy)
+template <class T>
+BasicHeightmap<T>::BasicHeightmap(const BasicHeightmap& _copy)
 {
-	resize(_copy.width_x , _copy.width_y);
-	memcpy(data, _copy.data, width_x * width_y * sizeof(hdata));
+	*this = _copy;
 }
 
-Heightmap::Heightmap(unsigned size_x, unsigned size_y)
+template <class T>
+BasicHeightmap<T>::BasicHeightmap(BasicHeightmap&& _move) noexcept
+{
+	*this = std::move(_move);
+}
+
+template <class T>
+BasicHeightmap<T>::BasicHeightmap(unsigned size_x, unsigned size_y)
 {
 	resize(size_x, size_y);
 }
 
-Heightmap::~Heightmap()
+template <class T>
+BasicHeightmap<T>& BasicHeightmap<T>::operator=(const BasicHeightmap& _copy)
 {
-	if (data != nullptr)
+	if (this != &_copy)
 	{
-		delete[] data;
+		resize(_copy.width_x, _copy.width_y);
+		memcpy(data, _copy.data, (size_t)width_x * width_y * sizeof(T));
 	}
+	return *this;
 }
 
-void Heightmap::resize(unsigned x, unsigned y)
+template <class T>
+BasicHeightmap<T>& BasicHeightmap<T>::operator=(BasicHeightmap&& _move) noexcept
+{
+	if (this != &_move)
+	{
+		data = _move.data;
+		storage = std::move(_move.storage);
+		width_x = _move.width_x;
+		width_y = _move.width_y;
+		view_source = std::move(_move.view_source);
+		read_only = _move.read_only;
+
+		// Leave the moved from heightmap empty
+		_move.data = nullptr;
+		_move.width_x = 0;
+		_move.width_y = 0;
+		_move.read_only = false;
+	}
+	return *this;
+}
+
+template <class T>
+BasicHeightmap<T> BasicHeightmap<T>::clone() const
+{
+	return *this;
+}
+
+template <class T>
+void BasicHeightmap<T>::resize(unsigned x, unsigned y)
 {
 	width_x = x;
 	width_y = y;
 
-	// Delete existing data if necessary
-	if (data != nullptr)
-	{
-		delete[] data;
-	}
+	// Release the data of a read-only view
+	view_source.reset();
+	read_only = false;
 
-	// Create the data buffer
-	unsigned size = width_x * width_y;
-	data = new hdata[size];
-	for (unsigned i = 0; i < size; ++i)
+	// Replace the data buffer
+	size_t size = (size_t)width_x * width_y;
+	storage.reset(new T[size]);
+	data = storage.get();
+	T zero = HeightStorage<T>::store(0.0f);
+	for (size_t i = 0; i < size; ++i)
 	{
-		data[i] = 0;
+		data[i] = zero;
 	}
 }
 
-unsigned Heightmap::getWidthX() const
+template <class T>
+void BasicHeightmap<T>::view(const T* _data, unsigned x, unsigned y, std::shared_ptr<const void> source)
+{
+	// Release existing data
+	storage.reset();
+
+	width_x = x;
+	width_y = y;
+	data = const_cast<T*>(_data);
+	view_source = source;
+	read_only = true;
+}
+
+template <class T>
+unsigned BasicHeightmap<T>::getWidthX() const
 {
 	return width_x;
 }
 
-unsigned Heightmap::getWidthY() const
+template <class T>
+unsigned BasicHeightmap<T>::getWidthY() const
 {
 	return width_y;
 }
 
-unsigned Heightmap::getSize() const
+template <class T>
+unsigned BasicHeightmap<T>::getSize() const
+{
+	return sizeof(T);
+}
+
+template <class T>
+bool BasicHeightmap<T>::isReadOnly() const
+{
+	return read_only;
+}
+
+template <class T>
+void BasicHeightmap<T>::checkWritable() const
+{
+	if (read_only)
+	{
+		throw std::logic_error("Unable to modify a read-only heightmap");
+	}
+}
+
+template <class T>
+hdata BasicHeightmap<T>::getHeight(unsigned x, unsigned y) const
 {
-	return sizeof(hdata);
+	return HeightStorage<T>::load(data[(size_t)y * width_x + x]);
 }
 
-hdata Heightmap::getHeight(unsigned x, unsigned y) const
+template <class T>
+T* BasicHeightmap<T>::getData()
 {
-	return data[y * width_x + x];
+	checkWritable();
+	return data;
 }
 
-void Heightmap::setHeight(unsigned x, unsigned y, hdata value)
+template <class T>
+const T* BasicHeightmap<T>::getData() const
 {
-	data[y * width_x + x] = value;
+	return data;
 }
 
-void Heightmap::calculateNormals(Vectormap& normal, Vectormap& tangent, float scale)
+template <class T>
+void BasicHeightmap<T>::setHeight(unsigned x, unsigned y, hdata value)
+{
+	checkWritable();
+	data[(size_t)y * width_x + x] = HeightStorage<T>::store(value);
+}
+
+template <class T>
+void BasicHeightmap<T>::calculateNormals(Vectormap& normal, Vectormap& tangent, float scale, BorderPolicy border) const
 {
 	// Make sure the normal and tangent vector maps are the same size as the heightmap
 	if (normal.getWidthX() != width_x || normal.getWidthY() != width_y)
@@ -155,350 +238,61 @@ void Heightmap::calculateNormals(Vectormap& normal, Vectormap& tangent, float sc
 	}
 
 	// Calculate normals
-	for (unsigned y = 1; y < width_y - 1; ++y)
+	stencilRows(1, [&](unsigned x, unsigned y, unsigned count, const StencilWindow& window)
 	{
-		for (unsigned x = 1; x < width_x - 1; ++x)
-		{
-			float s01 = getHeight(x - 1, y) * scale;
-			float s21 = getHeight(x + 1, y) * scale;
-			float s10 = getHeight(x, y - 1) * scale;
-			float s12 = getHeight(x, y + 1) * scale;
+		float gradient_x[heightmap_tile_size];
+		float gradient_y[heightmap_tile_size];
+		calculateGradients(window, count, scale, gradient_x, gradient_y);
 
-			// Get tangents in the x and y directions
-			Vector3 vx(2.0f, 0, s21 - s01);
-			Vector3 vy(0, 2.0f, s10 - s12);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			// Get tangents in the x and y directions, where y points down the heightmap
+			Vector3 vx(1.0f, 0, gradient_x[i]);
+			Vector3 vy(0, 1.0f, -gradient_y[i]);
 
 			// Calculate the cross product of the two normals
 			vx = normalize(vx);
 			vy = normalize(vy);
-			normal.setVector(x, y, cross(vx, vy));
-			tangent.setVector(x, y, vx);
+			normal.setVector(x + i, y, cross(vx, vy));
+			tangent.setVector(x + i, y, vx);
 		}
-	}
-
-	// Calculate normals on the edges
-	for (unsigned x = 1; x < width_x - 1; ++x)
-	{
-		// Top edge
-		float s01 = getHeight(x - 1, 0) * scale;
-		float s21 = getHeight(x + 1, 0) * scale;
-		float s10 = getHeight(x, 0) * scale;
-		float s12 = getHeight(x, 1) * scale;
-
-		Vector3 vx(2.0f, 0, s21 - s01);
-		Vector3 vy(0, 2.0f, s10 - s12);
-
-		vx = normalize(vx);
-		vy = normalize(vy);
-		normal.setVector(x, 0, cross(vx, vy));
-		tangent.setVector(x, 0, vx);
-
-		// Bottom edge
-		unsigned y = width_y - 1;
-		s01 = getHeight(x - 1, y) * scale;
-		s21 = getHeight(x + 1, y) * scale;
-		s10 = getHeight(x, y - 1) * scale;
-		s12 = getHeight(x, y) * scale;
-
-		vx = { 2.0f, 0, s21 - s01 };
-		vy = { 0, 2.0f, s10 - s12 };
-
-		vx = normalize(vx);
-		vy = normalize(vy);
-		normal.setVector(x, y, cross(vx, vy));
-		tangent.setVector(x, y, vx);
-	}
-
-	for (unsigned y = 1; y < width_y - 1; ++y)
-	{
-		// Left edge
-		float s01 = getHeight(0, y) * scale;
-		float s21 = getHeight(1, y) * scale;
-		float s10 = getHeight(0, y - 1) * scale;
-		float s12 = getHeight(0, y + 1) * scale;
-
-		Vector3 vx(2.0f, 0, s21 - s01);
-		Vector3 vy(0, 2.0f, s10 - s12);
-
-		vx = normalize(vx);
-		vy = normalize(vy);
-		normal.setVector(0, y, cross(vx, vy));
-		tangent.setVector(0, y, vx);
-
-		// Right edge
-		unsigned x = width_x - 1;
-		s01 = getHeight(x - 1, y) * scale;
-		s21 = getHeight(x, y) * scale;
-		s10 = getHeight(x, y - 1) * scale;
-		s12 = getHeight(x, y + 1) * scale;
-
-		vx = { 2.0f, 0, s21 - s01 };
-		vy = { 0, 2.0f, s10 - s12 };
-
-		vx = normalize(vx);
-		vy = normalize(vy);
-		normal.setVector(x, y, cross(vx, vy));
-		tangent.setVector(x, y, vx);
-	}
-
-	// Get the corners last
-
-	// Top left corner
-	unsigned x = 0;
-	unsigned y = 0;
-	float s01 = getHeight(x, y) * scale;
-	float s21 = getHeight(x + 1, y) * scale;
-	float s10 = getHeight(x, y) * scale;
-	float s12 = getHeight(x, y + 1) * scale;
-
-	Vector3 vx(2.0f, 0, s21 - s01);
-	Vector3 vy(0, 2.0f, s10 - s12);
-
-	vx = normalize(vx);
-	vy = normalize(vy);
-	normal.setVector(x, y, cross(vx, vy));
-	tangent.setVector(x, y, vx);
-
-	// Top right corner
-	x = width_x - 1;
-	y = 0;
-	s01 = getHeight(x - 1, y) * scale;
-	s21 = getHeight(x, y) * scale;
-	s10 = getHeight(x, y) * scale;
-	s12 = getHeight(x, y + 1) * scale;
-
-	vx = { 2.0f, 0, s21 - s01 };
-	vy = { 0, 2.0f, s10 - s12 };
-
-	vx = normalize(vx);
-	vy = normalize(vy);
-	normal.setVector(x, y, cross(vx, vy));
-	tangent.setVector(x, y, vx);
-
-	// Bottom left corner
-	x = 0;
-	y = width_y - 1;
-	s01 = getHeight(x, y) * scale;
-	s21 = getHeight(x + 1, y) * scale;
-	s10 = getHeight(x, y - 1) * scale;
-	s12 = getHeight(x, y) * scale;
-
-	vx = { 2.0f, 0, s21 - s01 };
-	vy = { 0, 2.0f, s10 - s12 };
-
-	vx = normalize(vx);
-	vy = normalize(vy);
-	normal.setVector(x, y, cross(vx, vy));
-	tangent.setVector(x, y, vx);
-
-	// Bottom right corner
-	x = width_x - 1;
-	y = width_y - 1;
-	s01 = getHeight(x - 1, y) * scale;
-	s21 = getHeight(x, y) * scale;
-	s10 = getHeight(x, y - 1) * scale;
-	s12 = getHeight(x, y) * scale;
-
-	vx = { 2.0f, 0, s21 - s01 };
-	vy = { 0, 2.0f, s10 - s12 };
-
-	vx = normalize(vx);
-	vy = normalize(vy);
-	normal.setVector(x, y, cross(vx, vy));
-	tangent.setVector(x, y, vx);
+	}, border);
 }
 
 ///
-/// Heightmap arithmatic
+/// Constant arithmatic
 ///
 
-void Heightmap::set(const Heightmap& in)
+template <class T>
+void BasicHeightmap<T>::set(const float c)
 {
-	unsigned size_x = 0;
-	unsigned size_y = 0;
-
-	// Don't go outside of either heightmap
-	if (in.width_x < width_x)
-	{
-		size_x = in.width_x;
-	}
-	else
-	{
-		size_x = width_x;
-	}
-	if (in.width_y < width_y)
-	{
-		size_y = in.width_y;
-	}
-	else
-	{
-		size_y = width_y;
-	}
-
-	// Copy height data from the other map
-	for (unsigned y = 0; y < size_y; ++y)
-	{
-		for (unsigned x = 0; x < size_x; ++x)
-		{
-			data[y * width_x + x] = in.data[y * in.width_x + x];
-		}
-	}
+	apply([c](float) { return c; });
 }
 
-void Heightmap::add(const Heightmap& in)
+template <class T>
+void BasicHeightmap<T>::add(const float c)
 {
-	unsigned size_x = 0;
-	unsigned size_y = 0;
-
-	// Don't go outside of either heightmap
-	if (in.width_x < width_x)
-	{
-		size_x = in.width_x;
-	}
-	else
-	{
-		size_x = width_x;
-	}
-	if (in.width_y < width_y)
-	{
-		size_y = in.width_y;
-	}
-	else
-	{
-		size_y = width_y;
-	}
-
-	// Add the height values from the other heightmap
-	for (unsigned y = 0; y < size_y; ++y)
-	{
-		for (unsigned x = 0; x < size_x; ++x)
-		{
-			data[y * width_x + x] += in.data[y * in.width_x + x];
-		}
-	}
+	apply([c](float h) { return h + c; });
 }
 
-void Heightmap::remove(const Heightmap& in)
+template <class T>
+void BasicHeightmap<T>::remove(const float c)
 {
-	unsigned size_x = 0;
-	unsigned size_y = 0;
-
-	// Don't go outside of either heightmap
-	if (in.width_x < width_x)
-	{
-		size_x = in.width_x;
-	}
-	else
-	{
-		size_x = width_x;
-	}
-	if (in.width_y < width_y)
-	{
-		size_y = in.width_y;
-	}
-	else
-	{
-		size_y = width_y;
-	}
-
-	// Subtract the height values from the other heightmap
-	for (unsigned y = 0; y < size_y; ++y)
-	{
-		for (unsigned x = 0; x < size_x; ++x)
-		{
-			data[y * width_x + x] -= in.data[y * in.width_x + x];
-		}
-	}
+	apply([c](float h) { return h - c; });
 }
 
-void Heightmap::multiply(const Heightmap& in)
+template <class T>
+void BasicHeightmap<T>::multiply(const float c)
 {
-	unsigned size_x = 0;
-	unsigned size_y = 0;
-
-	// Don't go outside of either heightmap
-	if (in.width_x < width_x)
-	{
-		size_x = in.width_x;
-	}
-	else
-	{
-		size_x = width_x;
-	}
-	if (in.width_y < width_y)
-	{
-		size_y = in.width_y;
-	}
-	else
-	{
-		size_y = width_y;
-	}
-
-	// Multiply the height values of each heightmap
-	for (unsigned y = 0; y < size_y; ++y)
-	{
-		for (unsigned x = 0; x < size_x; ++x)
-		{
-			data[y * width_x + x] *= in.data[y * in.width_x + x];
-		}
-	}
-}
-
-///
-/// Constant arithmatic
-///
-
-void Heightmap::set(const float c)
-{
-	for (unsigned y = 0; y < width_y; ++y)
-	{
-		for (unsigned x = 0; x < width_x; ++x)
-		{
-			data[y * width_x + x] = c;
-		}
-	}
-}
-
-void Heightmap::add(const float c)
-{
-	for (unsigned y = 0; y < width_y; ++y)
-	{
-		for (unsigned x = 0; x < width_x; ++x)
-		{
-			data[y * width_x + x] += c;
-		}
-	}
-}
-
-void Heightmap::remove(const float c)
-{
-	for (unsigned y = 0; y < width_y; ++y)
-	{
-		for (unsigned x = 0; x < width_x; ++x)
-		{
-			data[y * width_x + x] -= c;
-		}
-	}
+	apply([c](float h) { return h * c; });
 }
 
-void Heightmap::multiply(const float c)
+template <class T>
+void BasicHeightmap<T>::divide(const float c)
 {
-	for (unsigned y = 0; y < width_y; ++y)
-	{
-		for (unsigned x = 0; x < width_x; ++x)
-		{
-			data[y * width_x + x] *= c;
-		}
-	}
+	apply([c](float h) { return h / c; });
 }
 
-void Heightmap::divide(const float c)
-{
-	for (unsigned y = 0; y < width_y; ++y)
-	{
-		for (unsigned x = 0; x < width_x; ++x)
-		{
-			data[y * width_x + x] /= c;
-		}
-	}
-}
\ No newline at end of file
+template class BasicHeightmap<float>;
+template class BasicHeightmap<fixed16>;
+template class BasicHeightmap<half>;
\ No newline at end of file
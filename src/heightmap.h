@@ -1,24 +1,35 @@
 #pragma once
 
 #include "data.h"
+#include "storage.h"
+#include "parallel.h"
+#include "trace.h"
 
 #include <string>
+#include <memory>
+#include <vector>
+#include <algorithm>
 
+// The type used for height calculations
 typedef float hdata;
 
 class Vectormap
 {
 public:
 	Vectormap();
-	Vectormap(const Vectormap& _copy);
 	Vectormap(unsigned x, unsigned y);
-	~Vectormap();
+
+	// Make a copy of the vectormap and its data
+	Vectormap clone() const;
 
 	unsigned getWidthX() const;
 	unsigned getWidthY() const;
 
 	// Get the vector at a given location
 	Vector3 getVector(unsigned x, unsigned y) const;
+	// Get the vector data, stored one row at a time
+	Vector3* getData();
+	const Vector3* getData() const;
 	// Set the vector of the heightmap at a given location
 	void setVector(unsigned x, unsigned y, Vector3 value);
 
@@ -26,45 +37,135 @@ public:
 	void resize(unsigned x, unsigned y);
 
 private:
-	Vector3* data = nullptr;
+	std::vector<Vector3> data;
 	unsigned width_x = 0;
 	unsigned width_y = 0;
 };
 
-class Heightmap
+// How stencils read heights beyond the edges of a heightmap
+enum class BorderPolicy
+{
+	Clamp,		// Repeat the height at the nearest edge
+	Mirror,		// Reflect the heightmap across its edges without repeating the edge heights
+	Wrap		// Repeat the whole heightmap, so that each edge continues from the opposite edge
+};
+
+// The heights surrounding a cell, passed to stencil functions
+class StencilWindow
 {
 public:
-	Heightmap();
-	Heightmap(const Heightmap& _copy);
-	Heightmap(unsigned size_x, unsigned size_y);
-	~Heightmap();
+	StencilWindow(const float* _centre, unsigned _stride);
+
+	// Get the height at an offset from the centre cell, where dx and dy are within the radius of the stencil
+	float at(int dx, int dy) const;
+	// Get a pointer to the heights in a row of the window, indexed by the x offset from the centre cell
+	const float* row(int dy) const;
+	// Get the window centred on the cell dx cells along the row from the centre cell
+	StencilWindow offset(int dx) const;
+
+private:
+	const float* centre;
+	int stride;
+};
+
+// Calculate the slope of the heights towards +x and +y for a run of cells from the heights either side of each cell,
+// with heights multiplied by scale (window must be centred on the first cell and reach at least one cell past the run)
+void calculateGradients(const StencilWindow& window, unsigned count, float scale, float* gradient_x, float* gradient_y);
+
+/*
+ * A grid of height values
+ *
+ * T:	The type used to store each height value (float, fixed16 or half)
+ *		Heights are always widened to floats for calculations and narrowed when they are stored
+ */
+template <class T>
+class BasicHeightmap
+{
+public:
+	BasicHeightmap();
+	// Copies always own their data, even when copying a read-only view
+	BasicHeightmap(const BasicHeightmap& _copy);
+	BasicHeightmap(BasicHeightmap&& _move) noexcept;
+	BasicHeightmap(unsigned size_x, unsigned size_y);
+
+	BasicHeightmap& operator=(const BasicHeightmap& _copy);
+	BasicHeightmap& operator=(BasicHeightmap&& _move) noexcept;
+
+	// Make a copy of the heightmap and its data
+	BasicHeightmap clone() const;
 
 	// Reallocate the data array
 	void resize(unsigned x, unsigned y);
+	// Make the heightmap a read-only view of existing height data without copying it
+	// source is kept alive for as long as the view exists
+	void view(const T* _data, unsigned x, unsigned y, std::shared_ptr<const void> source);
 
 	unsigned getWidthX() const;
 	unsigned getWidthY() const;
 	unsigned getSize() const;
+	// Check if the heightmap is a read-only view
+	// (setHeight, the non-const getData and the arithmetic functions THROW logic_error when used on a read-only heightmap)
+	bool isReadOnly() const;
 	// Get the height at a given location
 	hdata getHeight(unsigned x, unsigned y) const;
+	// Get the raw height data, stored one row at a time
+	// (THROWS logic_error if the heightmap is read-only - read-only heightmaps can only be read through the const version)
+	T* getData();
+	const T* getData() const;
 	// Set the height of the heightmap at a given location
+	// (THROWS logic_error if the heightmap is read-only)
 	void setHeight(unsigned x, unsigned y, hdata value);
 
 	// Set the heightmap to match a noise sample
-	template <class T>
-	void sample(T& noise, float (T::* sample)(float, float) const, float scale = 1.0f);
+	template <class N>
+	void sample(N& noise, float (N::* sample)(float, float) const, float scale = 1.0f);
+	/*
+	 * Set heights to op(x, y) across multiple threads, so op must be safe to call from several threads at once
+	 *
+	 * stride:		Only cells whose x and y are both multiples of stride are set
+	 * skip_coarser:	Set to true to skip the cells that a stride of twice this one would have set, so that a heightmap can
+	 *				be filled coarse to fine without setting any cell twice
+	 */
+	template <class F>
+	void generate(F op, unsigned stride = 1, bool skip_coarser = false);
 
 	// Calculate the normals and tangents for the heightmap
-	void calculateNormals(Vectormap& normal, Vectormap& tangent, float scale = 0.0f);
+	void calculateNormals(Vectormap& normal, Vectormap& tangent, float scale = 0.0f, BorderPolicy border = BorderPolicy::Clamp) const;
+
+	/*
+	 * Kernels run over the heightmap in tiles across multiple threads
+	 * The kernel functions may be called from several threads at once, and must only write to the cell they are given
+	 */
+
+	// Replace each height with op(height)
+	template <class F>
+	void apply(F op);
+	// Call op(x, y, window) for each cell, where window holds the heights up to one cell away
+	template <class F>
+	void stencil3x3(F op, BorderPolicy border = BorderPolicy::Clamp) const;
+	// Call op(x, y, window) for each cell, where window holds the heights up to radius cells away
+	template <class F>
+	void stencilNxN(unsigned radius, F op, BorderPolicy border = BorderPolicy::Clamp) const;
+	// Call op(x, y, count, window) for each run of up to heightmap_tile_size cells in a row, where window is centred on the
+	// first cell (x, y) and holds the heights up to radius cells away from every cell in the run, so op can loop over them
+	template <class F>
+	void stencilRows(unsigned radius, F op, BorderPolicy border = BorderPolicy::Clamp) const;
+	// Replace each height with op(window), where window holds the original heights up to radius cells away
+	template <class F>
+	void filter(unsigned radius, F op, BorderPolicy border = BorderPolicy::Clamp);
 
 	// Set the contents of the heightmap to match another heightmap
-	void set(const Heightmap& in);
+	template <class U>
+	void set(const BasicHeightmap<U>& in);
 	// Add the height of another heightmap to this one
-	void add(const Heightmap& in);
+	template <class U>
+	void add(const BasicHeightmap<U>& in);
 	// Subtract the height of another heightmap from this one
-	void remove(const Heightmap& in);
+	template <class U>
+	void remove(const BasicHeightmap<U>& in);
 	// Multiply the height of each point by the height of another heightmap
-	void multiply(const Heightmap& in);
+	template <class U>
+	void multiply(const BasicHeightmap<U>& in);
 
 	// Set the contents of the heightmap to a constant value
 	void set(const float c);
@@ -78,9 +179,32 @@ public:
 	void divide(const float c);
 
 private:
-	hdata* data = nullptr;
+	template <class U>
+	friend class BasicHeightmap;
+
+	// Apply an operation to the overlapping area of this heightmap and another heightmap
+	template <class U, class F>
+	void combine(const BasicHeightmap<U>& in, F op);
+	// Make sure the heightmap can be modified
+	// (THROWS logic_error if the heightmap is read-only)
+	void checkWritable() const;
+
+	// The heights, which point into storage unless the heightmap is a read-only view
+	T* data = nullptr;
+	std::unique_ptr<T[]> storage;
 	unsigned width_x = 0;
 	unsigned width_y = 0;
+
+	// The owner of the data for read-only views
+	std::shared_ptr<const void> view_source;
+	bool read_only = false;
 };
 
+// Heightmap storing full precision floats
+typedef BasicHeightmap<float> Heightmap;
+// Heightmap storing 16 bit fixed point values
+typedef BasicHeightmap<fixed16> Heightmap16;
+// Heightmap storing half precision floats
+typedef BasicHeightmap<half> HeightmapHalf;
+
 #include "heightmap.inl"
\ No newline at end of file
@@ -1,15 +1,284 @@
+// The width and height of the tiles that heightmap kernels are split into
+constexpr unsigned heightmap_tile_size = 64;
+
+// Get the index of the cell read for a coordinate that may be outside the heightmap
+inline unsigned borderIndex(int i, unsigned size, BorderPolicy border)
+{
+	int last = (int)size - 1;
+	if (i >= 0 && i <= last)
+	{
+		return (unsigned)i;
+	}
+
+	switch (border)
+	{
+	case BorderPolicy::Mirror:
+		if (last > 0)
+		{
+			// Reflect back and forth across the edges, which repeats every 2 * last cells
+			int period = last * 2;
+			i %= period;
+			if (i < 0)
+			{
+				i += period;
+			}
+			return (unsigned)(i <= last ? i : period - i);
+		}
+		return 0;
+
+	case BorderPolicy::Wrap:
+		i %= (int)size;
+		return (unsigned)(i < 0 ? i + (int)size : i);
+
+	default:
+		return i < 0 ? 0 : (unsigned)last;
+	}
+}
+
+inline StencilWindow::StencilWindow(const float* _centre, unsigned _stride) : centre(_centre), stride((int)_stride)
+{
+}
+
+inline float StencilWindow::at(int dx, int dy) const
+{
+	return centre[dy * stride + dx];
+}
+
+inline const float* StencilWindow::row(int dy) const
+{
+	return centre + dy * stride;
+}
+
+inline StencilWindow StencilWindow::offset(int dx) const
+{
+	return StencilWindow(centre + dx, (unsigned)stride);
+}
+
+inline void calculateGradients(const StencilWindow& window, unsigned count, float scale, float* gradient_x, float* gradient_y)
+{
+	// Separate contiguous loops so that the compiler can vectorise them
+	const float* above = window.row(-1);
+	const float* row = window.row(0);
+	const float* below = window.row(1);
+	float half_scale = scale * 0.5f;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		gradient_x[i] = (row[(int)i + 1] - row[(int)i - 1]) * half_scale;
+	}
+	for (unsigned i = 0; i < count; ++i)
+	{
+		gradient_y[i] = (below[i] - above[i]) * half_scale;
+	}
+}
+
 template <class T>
-void Heightmap::sample(T& noise, float (T::* sample)(float, float) const, float scale)
+template <class N>
+void BasicHeightmap<T>::sample(N& noise, float (N::* sample)(float, float) const, float scale)
 {
 	// Scale the noise
 	noise.scale(width_x, width_y);
 
 	// Apply noise
-	for (unsigned y = 0; y < width_y; ++y)
+	generate([&](unsigned x, unsigned y)
+	{
+		return (noise.*sample)((float)x, (float)y) * scale;
+	});
+}
+
+template <class T>
+template <class F>
+void BasicHeightmap<T>::generate(F op, unsigned stride, bool skip_coarser)
+{
+	checkWritable();
+
+	// Split the rows between threads
+	unsigned blocks = (width_y + heightmap_tile_size - 1) / heightmap_tile_size;
+	parallelFor(blocks, [&](unsigned block, unsigned thread)
+	{
+		TraceSpan span("Sample block");
+		unsigned end = std::min(width_y, (block + 1) * heightmap_tile_size);
+		unsigned start = (block * heightmap_tile_size + stride - 1) / stride * stride;
+		for (unsigned y = start; y < end; y += stride)
+		{
+			// On rows the coarser stride covered, only every other cell is left
+			bool coarse_row = skip_coarser && y % (stride * 2) == 0;
+			unsigned x_start = coarse_row ? stride : 0;
+			unsigned x_step = coarse_row ? stride * 2 : stride;
+			T* row = data + (size_t)y * width_x;
+			for (unsigned x = x_start; x < width_x; x += x_step)
+			{
+				row[x] = HeightStorage<T>::store(op(x, y));
+			}
+		}
+	});
+}
+
+template <class T>
+template <class U, class F>
+void BasicHeightmap<T>::combine(const BasicHeightmap<U>& in, F op)
+{
+	checkWritable();
+
+	// Don't go outside of either heightmap
+	unsigned size_x = in.width_x < width_x ? in.width_x : width_x;
+	unsigned size_y = in.width_y < width_y ? in.width_y : width_y;
+
+	// Widen both values, apply the operation and narrow the result, splitting the rows between threads
+	unsigned blocks = (size_y + heightmap_tile_size - 1) / heightmap_tile_size;
+	parallelFor(blocks, [&](unsigned block, unsigned thread)
 	{
-		for (unsigned x = 0; x < width_x; ++x)
+		unsigned end = std::min(size_y, (block + 1) * heightmap_tile_size);
+		for (unsigned y = block * heightmap_tile_size; y < end; ++y)
 		{
-			data[y * width_x + x] = (noise.*sample)((float)x, (float)y) * scale;
+			T* row = data + (size_t)y * width_x;
+			const U* in_row = in.data + (size_t)y * in.width_x;
+			for (unsigned x = 0; x < size_x; ++x)
+			{
+				row[x] = HeightStorage<T>::store(op(HeightStorage<T>::load(row[x]), HeightStorage<U>::load(in_row[x])));
+			}
 		}
+	});
+}
+
+///
+/// Kernels
+///
+
+template <class T>
+template <class F>
+void BasicHeightmap<T>::apply(F op)
+{
+	checkWritable();
+
+	// Split the heights into blocks of whole rows, each a single contiguous loop that the compiler can vectorise
+	size_t size = (size_t)width_x * width_y;
+	size_t block_size = (size_t)heightmap_tile_size * width_x;
+	unsigned blocks = (width_y + heightmap_tile_size - 1) / heightmap_tile_size;
+	parallelFor(blocks, [&](unsigned block, unsigned thread)
+	{
+		T* start = data + block * block_size;
+		T* end = data + std::min(size, (block + 1) * block_size);
+		for (T* height = start; height < end; ++height)
+		{
+			*height = HeightStorage<T>::store(op(HeightStorage<T>::load(*height)));
+		}
+	});
+}
+
+template <class T>
+template <class F>
+void BasicHeightmap<T>::stencil3x3(F op, BorderPolicy border) const
+{
+	stencilNxN(1, op, border);
+}
+
+template <class T>
+template <class F>
+void BasicHeightmap<T>::stencilNxN(unsigned radius, F op, BorderPolicy border) const
+{
+	stencilRows(radius, [&](unsigned x, unsigned y, unsigned count, const StencilWindow& window)
+	{
+		for (unsigned i = 0; i < count; ++i)
+		{
+			op(x + i, y, window.offset((int)i));
+		}
+	}, border);
+}
+
+template <class T>
+template <class F>
+void BasicHeightmap<T>::stencilRows(unsigned radius, F op, BorderPolicy border) const
+{
+	if (width_x == 0 || width_y == 0)
+	{
+		return;
 	}
+
+	// Each thread widens a tile and its border into its own buffer, so the stencil only reads floats
+	// and never has to check the edges of the heightmap
+	unsigned tiles_x = (width_x + heightmap_tile_size - 1) / heightmap_tile_size;
+	unsigned tiles_y = (width_y + heightmap_tile_size - 1) / heightmap_tile_size;
+	unsigned stride = heightmap_tile_size + radius * 2;
+	std::vector<std::vector<float>> tiles(getThreadCount());
+	parallelFor(tiles_x * tiles_y, [&](unsigned index, unsigned thread)
+	{
+		TraceSpan span("Stencil tile");
+		unsigned start_x = (index % tiles_x) * heightmap_tile_size;
+		unsigned start_y = (index / tiles_x) * heightmap_tile_size;
+		unsigned size_x = std::min(heightmap_tile_size, width_x - start_x);
+		unsigned size_y = std::min(heightmap_tile_size, width_y - start_y);
+
+		std::vector<float>& tile = tiles[thread];
+		tile.resize((size_t)stride * stride);
+		for (unsigned ty = 0; ty < size_y + radius * 2; ++ty)
+		{
+			unsigned y = borderIndex((int)(start_y + ty) - (int)radius, width_y, border);
+			const T* row = data + (size_t)y * width_x;
+			float* tile_row = tile.data() + (size_t)ty * stride;
+			for (unsigned tx = 0; tx < size_x + radius * 2; ++tx)
+			{
+				tile_row[tx] = HeightStorage<T>::load(row[borderIndex((int)(start_x + tx) - (int)radius, width_x, border)]);
+			}
+		}
+
+		// Run the stencil on each row of the tile
+		for (unsigned y = 0; y < size_y; ++y)
+		{
+			const float* centre = tile.data() + (size_t)(y + radius) * stride + radius;
+			op(start_x, start_y + y, size_x, StencilWindow(centre, stride));
+		}
+	});
+}
+
+template <class T>
+template <class F>
+void BasicHeightmap<T>::filter(unsigned radius, F op, BorderPolicy border)
+{
+	checkWritable();
+
+	// Write the results to a new buffer so that the stencil always reads the original heights
+	std::unique_ptr<T[]> result(new T[(size_t)width_x * width_y]);
+	stencilNxN(radius, [&](unsigned x, unsigned y, const StencilWindow& window)
+	{
+		result[(size_t)y * width_x + x] = HeightStorage<T>::store(op(window));
+	}, border);
+
+	storage = std::move(result);
+	data = storage.get();
+}
+
+///
+/// Heightmap arithmatic
+///
+
+template <class T>
+template <class U>
+void BasicHeightmap<T>::set(const BasicHeightmap<U>& in)
+{
+	// Copy height data from the other map
+	combine(in, [](float, float b) { return b; });
+}
+
+template <class T>
+template <class U>
+void BasicHeightmap<T>::add(const BasicHeightmap<U>& in)
+{
+	// Add the height values from the other heightmap
+	combine(in, [](float a, float b) { return a + b; });
+}
+
+template <class T>
+template <class U>
+void BasicHeightmap<T>::remove(const BasicHeightmap<U>& in)
+{
+	// Subtract the height values from the other heightmap
+	combine(in, [](float a, float b) { return a - b; });
+}
+
+template <class T>
+template <class U>
+void BasicHeightmap<T>::multiply(const BasicHeightmap<U>& in)
+{
+	// Multiply the height values of each heightmap
+	combine(in, [](float a, float b) { return a * b; });
 }
\ No newline at end of file
@@ -0,0 +1,531 @@
+#include "hydrology.h"
+#include "parallel.h"
+
+#include <queue>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+// The width and height of the tiles used for flow accumulation
+constexpr unsigned hydrology_tile_size = 256;
+
+// The offset to each neighbour, numbered anticlockwise from +x
+static const int neighbour_x[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int neighbour_y[8] = { 0, -1, -1, -1, 0, 1, 1, 1 };
+static const float quarter_pi = 0.785398163f;
+static const float sqrt_2 = 1.41421356f;
+
+/*
+ * Fill the depressions in a grid of heights using priority-flood
+ *
+ * epsilon:	Set to true to raise each filled cell slightly above the cell it was reached from, so that every cell
+ *			has a neighbour lower than it on the way to the edge of the grid
+ */
+static void priorityFlood(std::vector<float>& heights, unsigned width_x, unsigned width_y, bool epsilon)
+{
+	typedef std::pair<float, size_t> Cell;
+	std::priority_queue<Cell, std::vector<Cell>, std::greater<Cell>> open;
+	std::queue<size_t> pit;
+	std::vector<uint8_t> closed(heights.size(), 0);
+
+	// Water can always drain from the edges
+	for (unsigned y = 0; y < width_y; ++y)
+	{
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			if (x == 0 || y == 0 || x == width_x - 1 || y == width_y - 1)
+			{
+				size_t i = (size_t)y * width_x + x;
+				closed[i] = 1;
+				open.push(Cell(heights[i], i));
+			}
+		}
+	}
+
+	while (!open.empty() || !pit.empty())
+	{
+		// Cells in the pit queue are never lower than the lowest open cell, so they are visited first
+		size_t i;
+		if (!pit.empty())
+		{
+			i = pit.front();
+			pit.pop();
+		}
+		else
+		{
+			i = open.top().second;
+			open.pop();
+		}
+
+		unsigned x = (unsigned)(i % width_x);
+		unsigned y = (unsigned)(i / width_x);
+		float spill = epsilon ? std::nextafter(heights[i], std::numeric_limits<float>::infinity()) : heights[i];
+		for (unsigned k = 0; k < 8; ++k)
+		{
+			int nx = (int)x + neighbour_x[k];
+			int ny = (int)y + neighbour_y[k];
+			if (nx < 0 || ny < 0 || nx >= (int)width_x || ny >= (int)width_y)
+			{
+				continue;
+			}
+
+			size_t n = (size_t)ny * width_x + nx;
+			if (closed[n])
+			{
+				continue;
+			}
+			closed[n] = 1;
+
+			// Cells that can't drain anywhere lower are filled up to the spill height
+			if (heights[n] <= spill)
+			{
+				heights[n] = spill;
+				pit.push(n);
+			}
+			else
+			{
+				open.push(Cell(heights[n], n));
+			}
+		}
+	}
+}
+
+template <class T>
+void MapHydrology::fillDepressions(BasicHeightmap<T>& map)
+{
+	if (map.isReadOnly())
+	{
+		throw std::logic_error("Unable to modify a read-only heightmap");
+	}
+
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	std::vector<float> heights((size_t)width_x * width_y);
+	for (size_t i = 0; i < heights.size(); ++i)
+	{
+		heights[i] = HeightStorage<T>::load(map.getData()[i]);
+	}
+
+	priorityFlood(heights, width_x, width_y, false);
+
+	for (size_t i = 0; i < heights.size(); ++i)
+	{
+		map.getData()[i] = HeightStorage<T>::store(heights[i]);
+	}
+}
+
+// Find the D8 flow direction of a cell that isn't on the edge of the grid
+static void flowD8(const float* centre, unsigned width_x, FlowDirections& directions, size_t i)
+{
+	float steepest = 0.0f;
+	uint8_t best = FlowDirections::no_flow;
+	for (unsigned k = 0; k < 8; ++k)
+	{
+		float drop = centre[0] - centre[neighbour_y[k] * (int)width_x + neighbour_x[k]];
+		float slope = k % 2 == 0 ? drop : drop / sqrt_2;
+		if (slope > steepest)
+		{
+			steepest = slope;
+			best = (uint8_t)k;
+		}
+	}
+
+	directions.first[i] = best;
+	directions.proportion[i] = 1.0f;
+	directions.angle[i] = best == FlowDirections::no_flow ? -1.0f : best * quarter_pi;
+}
+
+// Find the D-infinity flow direction of a cell that isn't on the edge of the grid
+static void flowDInfinity(const float* centre, unsigned width_x, FlowDirections& directions, size_t i)
+{
+	// Check each triangular facet between two neighbours for the steepest downhill slope
+	float steepest = 0.0f;
+	float best_angle = -1.0f;
+	for (unsigned k = 0; k < 8; ++k)
+	{
+		// Each facet has one neighbour in a cardinal direction and one on a diagonal
+		unsigned cardinal = k % 2 == 0 ? k : (k + 1) % 8;
+		unsigned diagonal = k % 2 == 0 ? k + 1 : k;
+		float e0 = centre[0];
+		float e1 = centre[neighbour_y[cardinal] * (int)width_x + neighbour_x[cardinal]];
+		float e2 = centre[neighbour_y[diagonal] * (int)width_x + neighbour_x[diagonal]];
+
+		// Find the direction of steepest descent across the plane through the three cells, limited to the facet
+		float s1 = e0 - e1;
+		float s2 = e1 - e2;
+		float r = std::atan2(s2, s1);
+		float slope = std::sqrt(s1 * s1 + s2 * s2);
+		if (r < 0.0f)
+		{
+			r = 0.0f;
+			slope = s1;
+		}
+		else if (r > quarter_pi)
+		{
+			r = quarter_pi;
+			slope = (e0 - e2) / sqrt_2;
+		}
+
+		if (slope > steepest)
+		{
+			steepest = slope;
+			best_angle = k % 2 == 0 ? k * quarter_pi + r : (k + 1) * quarter_pi - r;
+		}
+	}
+
+	if (best_angle < 0.0f)
+	{
+		directions.first[i] = FlowDirections::no_flow;
+		directions.angle[i] = -1.0f;
+		return;
+	}
+
+	// Split the flow between the neighbours either side of the angle
+	float facet = best_angle / quarter_pi;
+	unsigned k = std::min((unsigned)facet, 7u);
+	float fraction = facet - k;
+	directions.first[i] = (uint8_t)k;
+	directions.proportion[i] = 1.0f - fraction;
+	directions.second[i] = fraction > 0.0f ? (uint8_t)((k + 1) % 8) : FlowDirections::no_flow;
+	directions.angle[i] = best_angle;
+}
+
+template <class T>
+void MapHydrology::flowDirections(const BasicHeightmap<T>& map, FlowDirections& directions, FlowMethod method)
+{
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	size_t size = (size_t)width_x * width_y;
+
+	// Fill depressions with a slope towards their outlets, so that every cell drains somewhere
+	std::vector<float> heights(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		heights[i] = HeightStorage<T>::load(map.getData()[i]);
+	}
+	priorityFlood(heights, width_x, width_y, true);
+
+	directions.width_x = width_x;
+	directions.width_y = width_y;
+	directions.first.assign(size, FlowDirections::no_flow);
+	directions.second.assign(size, FlowDirections::no_flow);
+	directions.proportion.assign(size, 1.0f);
+	directions.angle.assign(size, -1.0f);
+
+	// Water drains out of the edges, so only interior cells have a direction
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		if (y == 0 || y == width_y - 1)
+		{
+			return;
+		}
+		for (unsigned x = 1; x + 1 < width_x; ++x)
+		{
+			size_t i = (size_t)y * width_x + x;
+			if (method == FlowMethod::DInfinity)
+			{
+				flowDInfinity(heights.data() + i, width_x, directions, i);
+			}
+			else
+			{
+				flowD8(heights.data() + i, width_x, directions, i);
+			}
+		}
+	});
+}
+
+// Get the index of the neighbour of a cell that water flows to, or -1 if there isn't one
+static inline int64_t getReceiver(const FlowDirections& directions, size_t i, uint8_t neighbour)
+{
+	if (neighbour == FlowDirections::no_flow)
+	{
+		return -1;
+	}
+	return (int64_t)i + neighbour_y[neighbour] * (int64_t)directions.width_x + neighbour_x[neighbour];
+}
+
+void MapHydrology::flowAccumulation(const FlowDirections& directions, Heightmap& accumulation)
+{
+	unsigned width_x = directions.width_x;
+	unsigned width_y = directions.width_y;
+	size_t size = (size_t)width_x * width_y;
+	accumulation.resize(width_x, width_y);
+	accumulation.set(1.0f);
+	float* total = accumulation.getData();
+
+	unsigned tiles_x = (width_x + hydrology_tile_size - 1) / hydrology_tile_size;
+	unsigned tiles_y = (width_y + hydrology_tile_size - 1) / hydrology_tile_size;
+	auto getTile = [&](size_t i)
+	{
+		return (unsigned)((i / width_x) / hydrology_tile_size * tiles_x + (i % width_x) / hydrology_tile_size);
+	};
+
+	// Calls op(receiver, fraction) for each neighbour a cell drains to
+	auto forReceivers = [&](size_t i, auto op)
+	{
+		int64_t first = getReceiver(directions, i, directions.first[i]);
+		if (first >= 0)
+		{
+			op((size_t)first, directions.proportion[i]);
+			int64_t second = getReceiver(directions, i, directions.second[i]);
+			if (second >= 0)
+			{
+				op((size_t)second, 1.0f - directions.proportion[i]);
+			}
+		}
+	};
+
+	// Calls op(i) for each cell of a tile
+	auto forTileCells = [&](unsigned tile, auto op)
+	{
+		unsigned start_x = (tile % tiles_x) * hydrology_tile_size;
+		unsigned start_y = (tile / tiles_x) * hydrology_tile_size;
+		unsigned end_x = std::min(width_x, start_x + hydrology_tile_size);
+		unsigned end_y = std::min(width_y, start_y + hydrology_tile_size);
+		for (unsigned y = start_y; y < end_y; ++y)
+		{
+			for (unsigned x = start_x; x < end_x; ++x)
+			{
+				op((size_t)y * width_x + x);
+			}
+		}
+	};
+
+	// Accumulate the flow within each tile, visiting cells after all of the cells in the tile that drain into them
+	struct TileBuffers
+	{
+		std::vector<uint8_t> donors;
+		std::vector<uint32_t> queue;
+		std::vector<size_t> stack;
+	};
+	unsigned tile_count = tiles_x * tiles_y;
+	std::vector<TileBuffers> buffers(getThreadCount());
+	parallelFor(tile_count, [&](unsigned tile, unsigned thread)
+	{
+		unsigned start_x = (tile % tiles_x) * hydrology_tile_size;
+		unsigned start_y = (tile / tiles_x) * hydrology_tile_size;
+		unsigned size_x = std::min(hydrology_tile_size, width_x - start_x);
+		unsigned size_y = std::min(hydrology_tile_size, width_y - start_y);
+		auto getLocal = [&](size_t i)
+		{
+			return (uint32_t)(((i / width_x) - start_y) * size_x + (i % width_x) - start_x);
+		};
+		auto getGlobal = [&](uint32_t local)
+		{
+			return (size_t)(start_y + local / size_x) * width_x + start_x + local % size_x;
+		};
+
+		TileBuffers& buffer = buffers[thread];
+		buffer.donors.assign((size_t)size_x * size_y, 0);
+		buffer.queue.clear();
+		for (uint32_t local = 0; local < size_x * size_y; ++local)
+		{
+			forReceivers(getGlobal(local), [&](size_t receiver, float fraction)
+			{
+				if (getTile(receiver) == tile)
+				{
+					buffer.donors[getLocal(receiver)]++;
+				}
+			});
+		}
+		for (uint32_t local = 0; local < size_x * size_y; ++local)
+		{
+			if (buffer.donors[local] == 0)
+			{
+				buffer.queue.push_back(local);
+			}
+		}
+
+		for (size_t next = 0; next < buffer.queue.size(); ++next)
+		{
+			size_t i = getGlobal(buffer.queue[next]);
+			forReceivers(i, [&](size_t receiver, float fraction)
+			{
+				if (getTile(receiver) == tile)
+				{
+					total[receiver] += total[i] * fraction;
+					uint32_t local = getLocal(receiver);
+					if (--buffer.donors[local] == 0)
+					{
+						buffer.queue.push_back(local);
+					}
+				}
+			});
+		}
+	});
+
+	/*
+	 * Flow between tiles is passed on in rounds. In each round, every tile that was sent flow by another tile visits the
+	 * cells it affects on its own thread, and whatever crosses into another tile is sent on to it for the next round.
+	 * Each cell is only ever written by the thread visiting its tile, and transfers are delivered in tile order, so the
+	 * result doesn't depend on the number of threads. Tiles can drain into each other, so a tile may run in several rounds.
+	 */
+	struct Transfer
+	{
+		size_t receiver;
+		float flow;
+	};
+	std::vector<std::vector<Transfer>> inbox(tile_count);
+	std::vector<std::vector<Transfer>> outbox(tile_count);
+	auto runRounds = [&](auto visit)
+	{
+		std::vector<unsigned> active;
+		while (true)
+		{
+			// Deliver the transfers in order of the tile they were sent from
+			for (unsigned tile = 0; tile < tile_count; ++tile)
+			{
+				for (const Transfer& transfer : outbox[tile])
+				{
+					inbox[getTile(transfer.receiver)].push_back(transfer);
+				}
+				outbox[tile].clear();
+			}
+
+			active.clear();
+			for (unsigned tile = 0; tile < tile_count; ++tile)
+			{
+				if (!inbox[tile].empty())
+				{
+					active.push_back(tile);
+				}
+			}
+			if (active.empty())
+			{
+				return;
+			}
+
+			parallelFor((unsigned)active.size(), [&](unsigned index, unsigned thread)
+			{
+				unsigned tile = active[index];
+				visit(tile, buffers[thread].stack);
+				inbox[tile].clear();
+			});
+		}
+	};
+
+	// Find every cell downstream of flow between tiles, and count the donors of each of them that are also downstream
+	// Flow that stays within a tile was already counted, so only those donors can add to a cell
+	std::vector<uint8_t> donors(size, 0);
+	std::vector<uint8_t> downstream(size, 0);
+	auto markDownstream = [&](unsigned tile, std::vector<size_t>& stack)
+	{
+		while (!stack.empty())
+		{
+			size_t i = stack.back();
+			stack.pop_back();
+			forReceivers(i, [&](size_t receiver, float fraction)
+			{
+				if (getTile(receiver) != tile)
+				{
+					outbox[tile].push_back({ receiver, 0.0f });
+					return;
+				}
+				donors[receiver]++;
+				if (!downstream[receiver])
+				{
+					downstream[receiver] = 1;
+					stack.push_back(receiver);
+				}
+			});
+		}
+	};
+
+	// Start from the cells that drain into another tile
+	parallelFor(tile_count, [&](unsigned tile, unsigned thread)
+	{
+		std::vector<size_t>& stack = buffers[thread].stack;
+		forTileCells(tile, [&](size_t i)
+		{
+			forReceivers(i, [&](size_t receiver, float fraction)
+			{
+				if (!downstream[i] && getTile(receiver) != tile)
+				{
+					downstream[i] = 1;
+					stack.push_back(i);
+				}
+			});
+		});
+		markDownstream(tile, stack);
+	});
+	runRounds([&](unsigned tile, std::vector<size_t>& stack)
+	{
+		for (const Transfer& transfer : inbox[tile])
+		{
+			donors[transfer.receiver]++;
+			if (!downstream[transfer.receiver])
+			{
+				downstream[transfer.receiver] = 1;
+				stack.push_back(transfer.receiver);
+			}
+		}
+		markDownstream(tile, stack);
+	});
+
+	// Add the flow entering from other tiles to the downstream cells in topological order
+	std::vector<float> extra(size, 0.0f);
+	auto passOn = [&](unsigned tile, std::vector<size_t>& stack)
+	{
+		while (!stack.empty())
+		{
+			size_t i = stack.back();
+			stack.pop_back();
+			forReceivers(i, [&](size_t receiver, float fraction)
+			{
+				if (getTile(receiver) != tile)
+				{
+					outbox[tile].push_back({ receiver, (total[i] + extra[i]) * fraction });
+					return;
+				}
+				extra[receiver] += extra[i] * fraction;
+				if (--donors[receiver] == 0)
+				{
+					stack.push_back(receiver);
+				}
+			});
+		}
+	};
+
+	// Start from the downstream cells that no other downstream cell drains into
+	parallelFor(tile_count, [&](unsigned tile, unsigned thread)
+	{
+		std::vector<size_t>& stack = buffers[thread].stack;
+		forTileCells(tile, [&](size_t i)
+		{
+			if (downstream[i] && donors[i] == 0)
+			{
+				stack.push_back(i);
+			}
+		});
+		passOn(tile, stack);
+	});
+	runRounds([&](unsigned tile, std::vector<size_t>& stack)
+	{
+		for (const Transfer& transfer : inbox[tile])
+		{
+			extra[transfer.receiver] += transfer.flow;
+			if (--donors[transfer.receiver] == 0)
+			{
+				stack.push_back(transfer.receiver);
+			}
+		}
+		passOn(tile, stack);
+	});
+
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		size_t row = (size_t)y * width_x;
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			total[row + x] += extra[row + x];
+		}
+	});
+}
+
+// Instantiate the hydrology functions for each heightmap storage type
+template void MapHydrology::fillDepressions(BasicHeightmap<float>&);
+template void MapHydrology::fillDepressions(BasicHeightmap<fixed16>&);
+template void MapHydrology::fillDepressions(BasicHeightmap<half>&);
+template void MapHydrology::flowDirections(const BasicHeightmap<float>&, FlowDirections&, FlowMethod);
+template void MapHydrology::flowDirections(const BasicHeightmap<fixed16>&, FlowDirections&, FlowMethod);
+template void MapHydrology::flowDirections(const BasicHeightmap<half>&, FlowDirections&, FlowMethod);
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "heightmap.h"
+
+#include <vector>
+#include <cstdint>
+
+// The method used to decide where water flows from each cell
+enum class FlowMethod
+{
+	D8,			// All water flows to the neighbour down the steepest slope
+	DInfinity	// Water flows down the steepest slope between two neighbours and is split between them (Tarboton, 1997)
+};
+
+/*
+ * The direction water flows from each cell of a heightmap
+ *
+ * Neighbours are numbered 0 to 7 anticlockwise from +x, with -y as the direction at 90 degrees.
+ * Cells that water drains out of, such as those on the edges of the heightmap, have no_flow as their first neighbour.
+ *
+ * first, second:	The neighbours that water flows to - second is no_flow if all water flows to the first neighbour
+ * proportion:		The fraction of the water that flows to the first neighbour
+ * angle:			The direction of flow in radians anticlockwise from +x, or -1 for cells with no flow
+ */
+struct FlowDirections
+{
+	static constexpr uint8_t no_flow = 255;
+
+	unsigned width_x = 0;
+	unsigned width_y = 0;
+	std::vector<uint8_t> first;
+	std::vector<uint8_t> second;
+	std::vector<float> proportion;
+	std::vector<float> angle;
+};
+
+namespace MapHydrology
+{
+	/*
+	 * Raise every cell that water can't drain out of to the height of the lowest point water could spill over
+	 *
+	 * Uses the priority-flood algorithm (Barnes et al., 2014): cells are visited from the edges of the heightmap
+	 * inwards, lowest first, and the cells of flat and filled areas are visited with a plain queue instead of
+	 * the priority queue, so most maps are filled in close to linear time.
+	 * (THROWS logic_error if the heightmap is read-only)
+	 */
+	template <class T>
+	void fillDepressions(BasicHeightmap<T>& map);
+
+	/*
+	 * Find the direction water flows from each cell
+	 *
+	 * Depressions are filled first on a copy of the heights, and flat areas are given a tiny slope towards their outlet,
+	 * so that water can flow from every cell to the edge of the heightmap
+	 */
+	template <class T>
+	void flowDirections(const BasicHeightmap<T>& map, FlowDirections& directions, FlowMethod method = FlowMethod::D8);
+
+	/*
+	 * Find the number of cells that drain through each cell, including the cell itself, across multiple threads
+	 *
+	 * Each tile of the heightmap is accumulated in its own topological order on a separate thread. The flow between tiles
+	 * is then passed on to the cells downstream of it in rounds, where each tile that receives flow runs on its own thread
+	 */
+	void flowAccumulation(const FlowDirections& directions, Heightmap& accumulation);
+}
\ No newline at end of file
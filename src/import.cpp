@@ -0,0 +1,289 @@
+#include "import.h"
+#include "mappedfile.h"
+
+#include <stdexcept>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <cctype>
+#include <png.h>
+
+///
+/// Utility functions
+///
+
+// Get the dimensions of a raw heightmap from the number of values in the file
+static void getRawDimensions(const std::string& filename, size_t count, unsigned& width, unsigned& height)
+{
+	if (width == 0 || height == 0)
+	{
+		// Assume the heightmap is square
+		width = (unsigned)std::sqrt((double)count);
+		height = width;
+	}
+
+	if ((size_t)width * height != count || count == 0)
+	{
+		throw std::runtime_error("The size of " + filename + " does not match the heightmap dimensions");
+	}
+}
+
+// Reverse the byte order of a value
+template <class T>
+static T swapBytes(T value)
+{
+	unsigned char bytes[sizeof(T)];
+	memcpy(bytes, &value, sizeof(T));
+	for (unsigned i = 0; i < sizeof(T) / 2; ++i)
+	{
+		unsigned char temp = bytes[i];
+		bytes[i] = bytes[sizeof(T) - 1 - i];
+		bytes[sizeof(T) - 1 - i] = temp;
+	}
+	memcpy(&value, bytes, sizeof(T));
+	return value;
+}
+
+///
+/// Image formats
+///
+
+template <class T>
+void MapImport::loadPNG(const std::string& filename, BasicHeightmap<T>& map)
+{
+	// Open the file
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Unable to open file " + filename);
+	}
+
+	// Check the png signature
+	png_byte signature[8];
+	if (fread(signature, 1, 8, file) != 8 || png_sig_cmp(signature, 0, 8))
+	{
+		fclose(file);
+		throw std::runtime_error(filename + " is not a png file");
+	}
+
+	// Create read and info structures
+	png_struct* png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	if (!png_ptr)
+	{
+		fclose(file);
+		throw std::runtime_error("Unable to initialize png reader");
+	}
+
+	png_info* info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr)
+	{
+		fclose(file);
+		png_destroy_read_struct(&png_ptr, nullptr, nullptr);
+		throw std::runtime_error("Unable to initialize png data");
+	}
+
+	// The buffer holding the current row of pixels
+	std::vector<png_byte> row;
+
+	// Setup jumpbuf for png errors
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		fclose(file);
+		png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+		throw std::runtime_error("Unable to read png file " + filename);
+	}
+
+	png_init_io(png_ptr, file);
+	png_set_sig_bytes(png_ptr, 8);
+	png_read_info(png_ptr, info_ptr);
+
+	png_uint_32 width = png_get_image_width(png_ptr, info_ptr);
+	png_uint_32 height = png_get_image_height(png_ptr, info_ptr);
+	int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+	int color_type = png_get_color_type(png_ptr, info_ptr);
+
+	// Only greyscale images can be read one row at a time without conversion
+	if ((color_type != PNG_COLOR_TYPE_GRAY && color_type != PNG_COLOR_TYPE_GRAY_ALPHA) || png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE)
+	{
+		fclose(file);
+		png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+		throw std::runtime_error(filename + " is not a non-interlaced greyscale png");
+	}
+
+	// Convert the pixels to 8 or 16 bit grey values
+	if (bit_depth < 8)
+	{
+		png_set_expand_gray_1_2_4_to_8(png_ptr);
+		bit_depth = 8;
+	}
+	if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+	{
+		png_set_strip_alpha(png_ptr);
+	}
+	png_read_update_info(png_ptr, info_ptr);
+
+	// Read the pixel data one row at a time
+	map.resize(width, height);
+	row.resize(png_get_rowbytes(png_ptr, info_ptr));
+	for (png_uint_32 y = 0; y < height; ++y)
+	{
+		png_read_row(png_ptr, row.data(), nullptr);
+
+		if (bit_depth == 16)
+		{
+			// Pixels are stored as big-endian 16 bit integers
+			for (png_uint_32 x = 0; x < width; ++x)
+			{
+				unsigned value = (row[x * 2] << 8) | row[x * 2 + 1];
+				map.setHeight(x, y, value * (2.0f / 65535.0f) - 1.0f);
+			}
+		}
+		else
+		{
+			for (png_uint_32 x = 0; x < width; ++x)
+			{
+				map.setHeight(x, y, row[x] * (2.0f / 255.0f) - 1.0f);
+			}
+		}
+	}
+
+	png_read_end(png_ptr, nullptr);
+	png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+	fclose(file);
+}
+
+template <class T>
+void MapImport::loadPFM(const std::string& filename, BasicHeightmap<T>& map)
+{
+	MappedFile file(filename);
+	const unsigned char* data = file.getData();
+	size_t size = file.getSize();
+
+	// Read the header fields - the format identifier, the dimensions and the scale
+	std::string fields[4];
+	size_t pos = 0;
+	for (unsigned field = 0; field < 4; ++field)
+	{
+		while (pos < size && isspace(data[pos]))
+		{
+			++pos;
+		}
+		while (pos < size && !isspace(data[pos]))
+		{
+			fields[field].push_back((char)data[pos++]);
+		}
+	}
+
+	// A single whitespace character separates the header from the pixel data
+	++pos;
+
+	if (fields[0] != "Pf")
+	{
+		throw std::runtime_error(filename + " is not a greyscale pfm file");
+	}
+
+	unsigned width, height;
+	float scale;
+	try
+	{
+		width = (unsigned)std::stoul(fields[1]);
+		height = (unsigned)std::stoul(fields[2]);
+		scale = std::stof(fields[3]);
+	}
+	catch (std::exception&)
+	{
+		throw std::runtime_error("Unable to read the header of " + filename);
+	}
+
+	if (width == 0 || height == 0 || pos > size || size - pos < (size_t)width * height * sizeof(float))
+	{
+		throw std::runtime_error("The size of " + filename + " does not match the heightmap dimensions");
+	}
+
+	// A negative scale indicates little-endian data
+#ifndef BIGENDIAN
+	bool swap = scale > 0.0f;
+#else
+	bool swap = scale < 0.0f;
+#endif
+
+	// Rows are stored from bottom to top
+	map.resize(width, height);
+	const unsigned char* pixels = data + pos;
+	for (unsigned y = 0; y < height; ++y)
+	{
+		const unsigned char* row = pixels + (size_t)(height - 1 - y) * width * sizeof(float);
+		for (unsigned x = 0; x < width; ++x)
+		{
+			float value;
+			memcpy(&value, row + x * sizeof(float), sizeof(float));
+			map.setHeight(x, y, swap ? swapBytes(value) : value);
+		}
+	}
+}
+
+///
+/// Raw formats
+///
+
+void MapImport::mapRaw16(const std::string& filename, Heightmap16& map, unsigned width, unsigned height)
+{
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(filename);
+	getRawDimensions(filename, file->getSize() / sizeof(uint16_t), width, height);
+	if (file->getSize() % sizeof(uint16_t) != 0)
+	{
+		throw std::runtime_error("The size of " + filename + " does not match the heightmap dimensions");
+	}
+
+#ifndef BIGENDIAN
+	// The file matches the layout of a 16 bit fixed point heightmap, so it can be used without copying
+	map.view((const fixed16*)file->getData(), width, height, file);
+#else
+	// Swap the byte order of each value
+	map.resize(width, height);
+	const uint16_t* values = (const uint16_t*)file->getData();
+	for (unsigned y = 0; y < height; ++y)
+	{
+		for (unsigned x = 0; x < width; ++x)
+		{
+			fixed16 value = { swapBytes(values[(size_t)y * width + x]) };
+			map.setHeight(x, y, HeightStorage<fixed16>::load(value));
+		}
+	}
+#endif
+}
+
+void MapImport::mapRaw32(const std::string& filename, Heightmap& map, unsigned width, unsigned height)
+{
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(filename);
+	getRawDimensions(filename, file->getSize() / sizeof(float), width, height);
+	if (file->getSize() % sizeof(float) != 0)
+	{
+		throw std::runtime_error("The size of " + filename + " does not match the heightmap dimensions");
+	}
+
+#ifndef BIGENDIAN
+	// The file matches the layout of a float heightmap, so it can be used without copying
+	map.view((const float*)file->getData(), width, height, file);
+#else
+	// Swap the byte order of each value
+	map.resize(width, height);
+	const float* values = (const float*)file->getData();
+	for (unsigned y = 0; y < height; ++y)
+	{
+		for (unsigned x = 0; x < width; ++x)
+		{
+			map.setHeight(x, y, swapBytes(values[(size_t)y * width + x]));
+		}
+	}
+#endif
+}
+
+// Instantiate the loaders for each heightmap storage type
+template void MapImport::loadPNG(const std::string&, BasicHeightmap<float>&);
+template void MapImport::loadPFM(const std::string&, BasicHeightmap<float>&);
+template void MapImport::loadPNG(const std::string&, BasicHeightmap<fixed16>&);
+template void MapImport::loadPFM(const std::string&, BasicHeightmap<fixed16>&);
+template void MapImport::loadPNG(const std::string&, BasicHeightmap<half>&);
+template void MapImport::loadPFM(const std::string&, BasicHeightmap<half>&);
\ No newline at end of file
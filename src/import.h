@@ -0,0 +1,36 @@
+#pragma once
+
+#include "heightmap.h"
+
+#include <string>
+
+/*
+ * Loaders for existing heightmaps
+ *
+ * Heights are converted to the [-1, 1] range used by exported pngs, except for float formats which are loaded as-is
+ * (All loaders THROW runtime_error if the file cannot be read or is not in a supported format)
+ */
+namespace MapImport
+{
+	// Load an 8 or 16 bit greyscale png one row at a time
+	template <class T>
+	void loadPNG(const std::string& filename, BasicHeightmap<T>& map);
+
+	// Load a greyscale portable float map (.pfm)
+	template <class T>
+	void loadPFM(const std::string& filename, BasicHeightmap<T>& map);
+
+	/*
+	 * Memory map a raw file of little-endian 16 bit unsigned integers (.r16) as a read-only heightmap
+	 *
+	 * width, height:	The dimensions of the heightmap - if either is 0 the heightmap is assumed to be square
+	 */
+	void mapRaw16(const std::string& filename, Heightmap16& map, unsigned width = 0, unsigned height = 0);
+
+	/*
+	 * Memory map a raw file of little-endian 32 bit floats (.r32) as a read-only heightmap
+	 *
+	 * width, height:	The dimensions of the heightmap - if either is 0 the heightmap is assumed to be square
+	 */
+	void mapRaw32(const std::string& filename, Heightmap& map, unsigned width = 0, unsigned height = 0);
+}
\ No newline at end of file
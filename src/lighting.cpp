@@ -0,0 +1,303 @@
+#include "lighting.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <initializer_list>
+
+// How far past a boundary rays are moved to make sure they are inside the next cell
+static const float ray_nudge = 1e-3f;
+static const float degrees_to_radians = 0.0174532925f;
+static const float two_pi = 6.28318531f;
+static const float radians_to_degrees = 57.2957795f;
+
+template <class T>
+MaxMipmap::MaxMipmap(const BasicHeightmap<T>& map)
+{
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	levels.emplace_back((size_t)width_x * width_y);
+	widths_x.push_back(width_x);
+	widths_y.push_back(width_y);
+	parallelFor(width_y, [&](unsigned y, unsigned thread)
+	{
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			levels[0][(size_t)y * width_x + x] = map.getHeight(x, y);
+		}
+	});
+
+	// Halve the size of each level until a single cell covers the whole heightmap
+	while (width_x > 1 || width_y > 1)
+	{
+		unsigned next_x = (width_x + 1) / 2;
+		unsigned next_y = (width_y + 1) / 2;
+		std::vector<float> next((size_t)next_x * next_y);
+		const std::vector<float>& previous = levels.back();
+		parallelFor(next_y, [&](unsigned y, unsigned thread)
+		{
+			unsigned y0 = y * 2;
+			unsigned y1 = std::min(y0 + 1, width_y - 1);
+			for (unsigned x = 0; x < next_x; ++x)
+			{
+				unsigned x0 = x * 2;
+				unsigned x1 = std::min(x0 + 1, width_x - 1);
+				next[(size_t)y * next_x + x] = std::max(
+					std::max(previous[(size_t)y0 * width_x + x0], previous[(size_t)y0 * width_x + x1]),
+					std::max(previous[(size_t)y1 * width_x + x0], previous[(size_t)y1 * width_x + x1]));
+			}
+		});
+
+		levels.push_back(std::move(next));
+		widths_x.push_back(next_x);
+		widths_y.push_back(next_y);
+		width_x = next_x;
+		width_y = next_y;
+	}
+}
+
+unsigned MaxMipmap::getLevelCount() const
+{
+	return (unsigned)levels.size();
+}
+
+unsigned MaxMipmap::getWidthX(unsigned level) const
+{
+	return widths_x[level];
+}
+
+unsigned MaxMipmap::getWidthY(unsigned level) const
+{
+	return widths_y[level];
+}
+
+float MaxMipmap::getMax(unsigned level, unsigned x, unsigned y) const
+{
+	return levels[level][(size_t)y * widths_x[level] + x];
+}
+
+// Get the distance along a ray to the far edge of a block of cells in one dimension
+static inline float getExitDistance(float start, float direction, unsigned block, unsigned size)
+{
+	if (direction > 0.0f)
+	{
+		return ((block + 1) * size - start) / direction;
+	}
+	else if (direction < 0.0f)
+	{
+		return (block * size - start) / direction;
+	}
+	return std::numeric_limits<float>::infinity();
+}
+
+bool MaxMipmap::trace(float x, float y, float dx, float dy, float height, float slope, float max_distance, float& distance, float& hit_height) const
+{
+	unsigned top = (unsigned)levels.size() - 1;
+	unsigned level = 0;
+	float t = distance;
+	while (t < max_distance)
+	{
+		float px = x + dx * (t + ray_nudge);
+		float py = y + dy * (t + ray_nudge);
+		if (px < 0.0f || py < 0.0f || px >= widths_x[0] || py >= widths_y[0])
+		{
+			return false;
+		}
+
+		// The ray is lowest where it enters a block, so the whole block is below the ray if its highest cell is
+		unsigned block_x = (unsigned)px >> level;
+		unsigned block_y = (unsigned)py >> level;
+		float block_max = levels[level][(size_t)block_y * widths_x[level] + block_x];
+		if (block_max <= height + slope * t)
+		{
+			// Skip the block and try a larger block next
+			unsigned size = 1u << level;
+			t = std::min(getExitDistance(x, dx, block_x, size), getExitDistance(y, dy, block_y, size));
+			if (level < top)
+			{
+				++level;
+			}
+		}
+		else if (level == 0)
+		{
+			distance = t;
+			hit_height = block_max;
+			return true;
+		}
+		else
+		{
+			--level;
+		}
+	}
+	return false;
+}
+
+// Make sure a mask can hold one byte for each cell of a heightmap
+static void checkMask(const PixelBuffer& mask, unsigned width_x, unsigned width_y)
+{
+	if (mask.getWidth() != width_x || mask.getHeight() != width_y || mask.getSize() != sizeof(uint8_t))
+	{
+		throw std::logic_error("Lighting masks must be 8 bits per pixel and the same size as the heightmap");
+	}
+}
+
+// Get the number of cells a height of 1 is equal to
+static float getVerticalScale(unsigned width_x, unsigned width_y, float scale)
+{
+	if (scale > 0.0f)
+	{
+		return scale;
+	}
+	return (float)std::min(width_x, width_y);
+}
+
+void MapLighting::bakeShadows(const MaxMipmap& mipmap, PixelBuffer& mask, const ShadowSettings& settings)
+{
+	checkMask(mask, mipmap.getWidthX(), mipmap.getWidthY());
+
+	float azimuth = settings.azimuth * degrees_to_radians;
+	float dx = std::sin(azimuth);
+	float dy = -std::cos(azimuth);
+	float slope = std::tan(settings.elevation * degrees_to_radians) / getVerticalScale(mipmap.getWidthX(), mipmap.getWidthY(), settings.scale);
+	float infinity = std::numeric_limits<float>::infinity();
+
+	parallelFor(mipmap.getWidthY(), [&](unsigned y, unsigned thread)
+	{
+		for (unsigned x = 0; x < mipmap.getWidthX(); ++x)
+		{
+			// March a ray from the centre of the cell towards the sun
+			float distance = 0.0f;
+			float hit_height;
+			bool shadowed = mipmap.trace(x + 0.5f, y + 0.5f, dx, dy, mipmap.getMax(0, x, y), slope, infinity, distance, hit_height);
+			mask.fillPixel(x, y, (uint8_t)(shadowed ? 0 : 255));
+		}
+	});
+}
+
+void MapLighting::bakeAmbientOcclusion(const MaxMipmap& mipmap, PixelBuffer& mask, const AmbientSettings& settings)
+{
+	checkMask(mask, mipmap.getWidthX(), mipmap.getWidthY());
+	if (settings.directions == 0)
+	{
+		return;
+	}
+
+	float scale = getVerticalScale(mipmap.getWidthX(), mipmap.getWidthY(), settings.scale);
+	float max_distance = settings.radius > 0.0f ? settings.radius : std::numeric_limits<float>::infinity();
+	std::vector<float> directions_x(settings.directions);
+	std::vector<float> directions_y(settings.directions);
+	for (unsigned i = 0; i < settings.directions; ++i)
+	{
+		float angle = two_pi * (i + 0.5f) / settings.directions;
+		directions_x[i] = std::cos(angle);
+		directions_y[i] = std::sin(angle);
+	}
+
+	parallelFor(mipmap.getWidthY(), [&](unsigned y, unsigned thread)
+	{
+		for (unsigned x = 0; x < mipmap.getWidthX(); ++x)
+		{
+			float height = mipmap.getMax(0, x, y);
+			float occlusion = 0.0f;
+			for (unsigned i = 0; i < settings.directions; ++i)
+			{
+				// Raise the horizon each time a cell above it is found, then keep marching from that cell
+				float slope = 0.0f;
+				float distance = 0.0f;
+				float hit_height;
+				while (mipmap.trace(x + 0.5f, y + 0.5f, directions_x[i], directions_y[i], height, slope, max_distance, distance, hit_height))
+				{
+					slope = (hit_height - height) / std::max(distance, ray_nudge);
+
+					// Make sure rounding doesn't leave the horizon below the cell, which would be hit again
+					while (height + slope * distance < hit_height)
+					{
+						slope = std::nextafter(slope, std::numeric_limits<float>::infinity());
+					}
+				}
+
+				// Add the sine of the horizon angle
+				float rise = slope * scale;
+				occlusion += rise / std::sqrt(1.0f + rise * rise);
+			}
+
+			float visible = 1.0f - occlusion / settings.directions;
+			mask.fillPixel(x, y, (uint8_t)(visible * 255.0f + 0.5f));
+		}
+	});
+}
+
+template <class T>
+void MapLighting::renderTerrain(const BasicHeightmap<T>& map, const ShadeSettings& settings, PixelBuffer* hillshade, PixelBuffer* slope, PixelBuffer* aspect)
+{
+	for (PixelBuffer* image : { hillshade, slope, aspect })
+	{
+		if (image != nullptr)
+		{
+			checkMask(*image, map.getWidthX(), map.getWidthY());
+		}
+	}
+
+	// The light direction, with x towards +x and y towards the top of the heightmap
+	float azimuth = settings.azimuth * degrees_to_radians;
+	float elevation = settings.elevation * degrees_to_radians;
+	float light_x = std::sin(azimuth) * std::cos(elevation);
+	float light_y = std::cos(azimuth) * std::cos(elevation);
+	float light_z = std::sin(elevation);
+	float scale = getVerticalScale(map.getWidthX(), map.getWidthY(), settings.scale);
+
+	map.stencilRows(1, [&](unsigned x, unsigned y, unsigned count, const StencilWindow& window)
+	{
+		float gradient_x[heightmap_tile_size];
+		float gradient_y[heightmap_tile_size];
+		float values[heightmap_tile_size];
+		calculateGradients(window, count, scale, gradient_x, gradient_y);
+
+		if (hillshade != nullptr)
+		{
+			// The surface normal is (-gradient_x, gradient_y, 1) with y towards the top of the heightmap
+			for (unsigned i = 0; i < count; ++i)
+			{
+				float lit = (light_z - gradient_x[i] * light_x + gradient_y[i] * light_y) / std::sqrt(1.0f + gradient_x[i] * gradient_x[i] + gradient_y[i] * gradient_y[i]);
+				values[i] = std::max(lit, 0.0f) * 255.0f + 0.5f;
+			}
+			for (unsigned i = 0; i < count; ++i)
+			{
+				hillshade->fillPixel(x + i, y, (uint8_t)values[i]);
+			}
+		}
+		if (slope != nullptr)
+		{
+			for (unsigned i = 0; i < count; ++i)
+			{
+				values[i] = std::atan(std::sqrt(gradient_x[i] * gradient_x[i] + gradient_y[i] * gradient_y[i])) * radians_to_degrees;
+			}
+			for (unsigned i = 0; i < count; ++i)
+			{
+				slope->fillPixel(x + i, y, (uint8_t)(values[i] / 90.0f * 255.0f + 0.5f));
+			}
+		}
+		if (aspect != nullptr)
+		{
+			for (unsigned i = 0; i < count; ++i)
+			{
+				// Downhill is (-gradient_x, gradient_y) with y towards the top of the heightmap
+				float angle = std::atan2(-gradient_x[i], gradient_y[i]) * radians_to_degrees;
+				values[i] = angle < 0.0f ? angle + 360.0f : angle;
+			}
+			for (unsigned i = 0; i < count; ++i)
+			{
+				aspect->fillPixel(x + i, y, (uint8_t)((unsigned)(values[i] / 360.0f * 256.0f) & 255));
+			}
+		}
+	});
+}
+
+// Instantiate the mipmap constructor and terrain renderer for each heightmap storage type
+template MaxMipmap::MaxMipmap(const BasicHeightmap<float>&);
+template MaxMipmap::MaxMipmap(const BasicHeightmap<fixed16>&);
+template MaxMipmap::MaxMipmap(const BasicHeightmap<half>&);
+template void MapLighting::renderTerrain(const BasicHeightmap<float>&, const ShadeSettings&, PixelBuffer*, PixelBuffer*, PixelBuffer*);
+template void MapLighting::renderTerrain(const BasicHeightmap<fixed16>&, const ShadeSettings&, PixelBuffer*, PixelBuffer*, PixelBuffer*);
+template void MapLighting::renderTerrain(const BasicHeightmap<half>&, const ShadeSettings&, PixelBuffer*, PixelBuffer*, PixelBuffer*);
\ No newline at end of file
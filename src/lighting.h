@@ -0,0 +1,116 @@
+#pragma once
+
+#include "heightmap.h"
+#include "export.h"
+
+#include <vector>
+
+/*
+ * A maximum mipmap of a heightmap, where each level holds the highest height in each 2x2 block of the level below
+ *
+ * Rays are marched through the mipmap from the top level down, so that large areas the ray passes over are
+ * skipped in a single step instead of being checked one cell at a time.
+ */
+class MaxMipmap
+{
+public:
+	// Build the mipmap levels across multiple threads
+	template <class T>
+	MaxMipmap(const BasicHeightmap<T>& map);
+
+	unsigned getLevelCount() const;
+	unsigned getWidthX(unsigned level = 0) const;
+	unsigned getWidthY(unsigned level = 0) const;
+	// Get the highest height in a block of 2^level by 2^level cells
+	float getMax(unsigned level, unsigned x, unsigned y) const;
+
+	/*
+	 * Find the first cell that rises above a ray
+	 *
+	 * x, y:			The start of the ray in cells, where cell (0, 0) covers [0, 1) in both directions
+	 * dx, dy:			The horizontal direction of the ray, which must have a length of 1
+	 * height, slope:	The height of the ray is height + slope * distance, where slope must not be negative
+	 * distance:		The distance along the ray to start searching from, set to where the ray enters the cell it hits
+	 * hit_height:		Set to the height of the cell the ray hits
+	 *
+	 * Returns true if a cell is hit before max_distance or the edge of the heightmap
+	 */
+	bool trace(float x, float y, float dx, float dy, float height, float slope, float max_distance, float& distance, float& hit_height) const;
+
+private:
+	std::vector<std::vector<float>> levels;
+	std::vector<unsigned> widths_x;
+	std::vector<unsigned> widths_y;
+};
+
+/*
+ * Settings for baking shadows cast by the sun
+ *
+ * azimuth:		The direction of the sun in degrees clockwise from the top of the heightmap
+ * elevation:	The angle of the sun above the horizon in degrees
+ * scale:		The number of cells a height of 1 is equal to, or 0 to use the smaller dimension of the heightmap
+ */
+struct ShadowSettings
+{
+	float azimuth = 315.0f;
+	float elevation = 30.0f;
+	float scale = 0.0f;
+};
+
+/*
+ * Settings for baking horizon-based ambient occlusion
+ *
+ * directions:	The number of directions the horizon is searched in around each cell
+ * radius:		The furthest distance in cells the horizon is searched to, or 0 to search to the edge of the heightmap
+ * scale:		The number of cells a height of 1 is equal to, or 0 to use the smaller dimension of the heightmap
+ */
+struct AmbientSettings
+{
+	unsigned directions = 16;
+	float radius = 64.0f;
+	float scale = 0.0f;
+};
+
+/*
+ * Settings for rendering hillshade, slope and aspect maps
+ *
+ * azimuth:		The direction of the light used for hillshading in degrees clockwise from the top of the heightmap
+ * elevation:	The angle of the light above the horizon in degrees
+ * scale:		The number of cells a height of 1 is equal to, or 0 to use the smaller dimension of the heightmap
+ */
+struct ShadeSettings
+{
+	float azimuth = 315.0f;
+	float elevation = 45.0f;
+	float scale = 0.0f;
+};
+
+namespace MapLighting
+{
+	// Write 255 to each cell of an 8 bit mask that the sun can reach, or 0 if the cell is in shadow, across multiple threads
+	// (THROWS logic_error if the mask isn't 8 bits per pixel and the same size as the heightmap)
+	void bakeShadows(const MaxMipmap& mipmap, PixelBuffer& mask, const ShadowSettings& settings);
+
+	/*
+	 * Write the fraction of the sky visible from each cell to an 8 bit mask across multiple threads
+	 *
+	 * The highest horizon in each direction is found by marching rays that only stop at cells above the highest
+	 * horizon found so far, and the occlusion in each direction is the sine of the angle of the horizon
+	 * (THROWS logic_error if the mask isn't 8 bits per pixel and the same size as the heightmap)
+	 */
+	void bakeAmbientOcclusion(const MaxMipmap& mipmap, PixelBuffer& mask, const AmbientSettings& settings);
+
+	/*
+	 * Render any combination of hillshade, slope and aspect maps as 8 bit images in a single stencil pass
+	 *
+	 * Each run of cells finds its gradients with calculateGradients, the same as calculateNormals, then fills each
+	 * requested image from them in turn. Outputs that aren't needed can be nullptr.
+	 * hillshade:	The brightness of the surface lit from the light direction, from 0 (facing away) to 255
+	 * slope:		The angle of the surface from 0 (flat) to 255 (vertical)
+	 * aspect:		The compass direction downhill, clockwise from the top of the heightmap, from 0 to 255 for a full
+	 *				circle (flat cells are 0)
+	 * (THROWS logic_error if an image isn't 8 bits per pixel and the same size as the heightmap)
+	 */
+	template <class T>
+	void renderTerrain(const BasicHeightmap<T>& map, const ShadeSettings& settings, PixelBuffer* hillshade, PixelBuffer* slope, PixelBuffer* aspect);
+}
\ No newline at end of file
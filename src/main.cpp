@@ -1,33 +1,884 @@
 #include "generate.h"
 #include "export.h"
+#include "import.h"
+#include "graph.h"
+#include "cache.h"
+#include "stats.h"
+#include "parallel.h"
+#include "erosion.h"
+#include "filter.h"
+#include "hydrology.h"
+#include "lighting.h"
+#include "mesh.h"
+#include "contour.h"
+#include "trace.h"
+#include "perfcounters.h"
+#include "allocstats.h"
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
 #include <string>
 #include <random>
 #include <chrono>
+#include <algorithm>
+#include <cctype>
 
 #include <png.h>
 
 using namespace std;
 typedef std::chrono::steady_clock Timer;
 
-int main(int argc, char** argv)
+// The number of histogram bins used for histogram equalisation
+constexpr unsigned remap_bins = 4096;
+
+// Settings read from the command line
+struct Settings
 {
 	string fname = "heightmap.png";	// The filename the png will be saved to
 	unsigned width = 1024;			// Heightmap width
 	unsigned height = 1024;			// Heightmap height
 	float min_height = 0.0f;		// Minimum map height
 	float max_height = 1.0f;		// Maximum map height
+	unsigned seed = 0;				// The rng seed
 
 	string generator_name;			// The name of the generator being used
 	vector<float> generator_data;	// Data for the heightmap generator
 
 	bool gen_normals = false;		// Set to true to generate normals for the heightmap
-	
+	string precision = "float";		// The storage type used for height data
+	string remap = "none";			// How heights are remapped when the heightmap is exported
+
+	string import_name;				// The file to load a base heightmap from
+	string graph_name;				// The generator graph file to use instead of a generator
+	bool custom_size = false;		// Set to true if the heightmap dimensions were specified
+	bool use_region = false;		// Set to true to generate only a window of the heightmap
+	MapRegion region;				// The window of the heightmap to generate, with the size of the whole heightmap
+	unsigned region_width = 0;		// The size of the window
+	unsigned region_height = 0;
+	bool progressive = false;		// Set to true to save lower resolution previews while the heightmap is generated
+	bool wrap = false;				// Set to true to generate a heightmap that tiles seamlessly
+
+	unsigned erosion_droplets = 0;	// The number of droplets used for hydraulic erosion, or 0 to skip erosion
+	unsigned thermal_iterations = 0;	// The number of thermal erosion iterations, or 0 to skip thermal erosion
+	unsigned median_radius = 0;		// The radius of the median filter, or 0 to skip it
+	unsigned blur_radius = 0;		// The radius of the box blur, or 0 to skip it
+	float blur_sigma = 0.0f;		// The standard deviation of the Gaussian blur, or 0 to skip it
+	string flow_method;				// The flow direction method (d8 or dinf) used for hydrology outputs, or empty to skip them
+	float sun_azimuth = 315.0f;		// The direction of the sun in degrees clockwise from the top of the heightmap
+	float sun_elevation = 0.0f;		// The angle of the sun above the horizon in degrees, or 0 to skip baking shadows
+	float ao_radius = 0.0f;			// The distance in cells ambient occlusion is baked to, or 0 to skip it
+	bool gen_hillshade = false;		// Set to true to render a hillshade image of the heightmap
+	bool gen_slope = false;			// Set to true to render a slope image of the heightmap
+	bool gen_aspect = false;		// Set to true to render an aspect image of the heightmap
+	string mesh_format;				// The format (obj or glb) of the mesh exported with the heightmap, or empty to skip it
+	float mesh_error = 1.0f;		// The largest error of the vertices left out of the mesh, in cells
+	vector<float> contour_levels;	// The heights contour lines are traced at, or empty to skip them
+
+	string cache_dir;				// The directory generated stages are cached in, or empty to disable the cache
+	unsigned cache_size = 4096;		// The maximum size of the cache in megabytes
+
+	bool trace = false;				// Set to true to record a trace of the work done
+	string trace_name;				// The file the trace is saved to, or empty to save it next to the heightmap
+	bool perf_counters = false;		// Set to true to count hardware events for each stage
+	bool alloc_stats = false;		// Set to true to count heap allocations for each stage
+};
+
+// Traces a pipeline stage, and counts its hardware events and allocations when those are enabled
+struct StageScope
+{
+	TraceSpan span;
+	PerfStage counters;
+	AllocStage allocations;
+
+	StageScope(const char* name, double pixels) : span(name), counters(name, pixels), allocations(name)
+	{
+	}
+};
+
+// Get the cache key for the heightmap produced by the current settings
+CacheKey getHeightmapKey(const Settings& settings)
+{
+	CacheKey key;
+	key.add(string("heightmap")).add(settings.precision).add((uint64_t)settings.seed);
+	key.add((uint64_t)settings.width).add((uint64_t)settings.height).add(settings.min_height).add(settings.max_height);
+	if (settings.use_region)
+	{
+		key.add(string("region")).add((uint64_t)settings.region.x).add((uint64_t)settings.region.y);
+		key.add((uint64_t)settings.region_width).add((uint64_t)settings.region_height);
+	}
+	if (settings.wrap)
+	{
+		key.add(string("wrap"));
+	}
+	key.add(settings.generator_name).add((uint64_t)settings.generator_data.size());
+	for (float value : settings.generator_data)
+	{
+		key.add(value);
+	}
+	key.add((uint64_t)settings.erosion_droplets).add((uint64_t)settings.thermal_iterations);
+	key.add((uint64_t)settings.median_radius).add((uint64_t)settings.blur_radius).add(settings.blur_sigma);
+
+	// Graphs are keyed by the contents of the graph file rather than its name
+	if (!settings.graph_name.empty())
+	{
+		ifstream file(settings.graph_name, ios::binary);
+		stringstream contents;
+		contents << file.rdbuf();
+		key.add(string("graph")).add(contents.str());
+	}
+	return key;
+}
+
+// Run the selected generator on a heightmap, passing it a preview callback if one is given
+template <class T>
+void generateHeightmap(BasicHeightmap<T>& map, const Settings& settings, const PreviewCallback& preview = nullptr)
+{
+	// Only the main heightmap is generated as a window, other layers match the size of what they are added to
+	MapRegion region = settings.use_region ? settings.region : MapRegion();
+	region.wrap = settings.wrap;
+	StageScope stage("Generate heightmap", (double)map.getWidthX() * map.getWidthY());
+	bool done = false;
+	if (!settings.generator_name.empty())
+	{
+		// Use the specified generator
+		if (settings.generator_name == "random" || settings.generator_name == "Random")
+		{
+			if (settings.generator_data.size() > 2)
+			{
+				MapGenerator::layeredWhiteNoise(map, settings.seed, settings.min_height, settings.max_height, (unsigned)settings.generator_data[0], (unsigned)settings.generator_data[1], settings.generator_data[2], region, preview);
+				done = true;
+			}
+		}
+		else if (settings.generator_name == "plasma" || settings.generator_name == "Plasma")
+		{
+			if (settings.generator_data.size() > 0)
+			{
+				MapGenerator::plasma(map, settings.seed, settings.min_height, settings.max_height, (unsigned)settings.generator_data[0], region, preview);
+				done = true;
+			}
+		}
+		else if (settings.generator_name == "perlin" || settings.generator_name == "Perlin")
+		{
+			if (settings.generator_data.size() > 2)
+			{
+				MapGenerator::layeredPerlin(map, settings.seed, settings.min_height, settings.max_height, (unsigned)settings.generator_data[0], (unsigned)settings.generator_data[1], settings.generator_data[2], region, preview);
+				done = true;
+			}
+		}
+		else if (settings.generator_name == "simplex" || settings.generator_name == "Simplex")
+		{
+			if (settings.generator_data.size() > 2)
+			{
+				MapGenerator::layeredSimplex(map, settings.seed, settings.min_height, settings.max_height, (unsigned)settings.generator_data[0], (unsigned)settings.generator_data[1], settings.generator_data[2], region, preview);
+				done = true;
+			}
+		}
+	}
+
+	if (!done)
+	{
+		MapGenerator::defaultGenerator(map, settings.seed, settings.min_height, settings.max_height, region, preview);
+	}
+}
+
+// Run the erosion stages selected on the command line
+template <class T>
+void erodeHeightmap(BasicHeightmap<T>& map, const Settings& settings)
+{
+	if (settings.erosion_droplets > 0)
+	{
+		cout << "\nEroding heightmap... ";
+		StageScope stage("Hydraulic erosion", (double)map.getWidthX() * map.getWidthY());
+		auto t_start = Timer::now();
+		HydraulicSettings hydraulic;
+		hydraulic.droplets = settings.erosion_droplets;
+		double rate = MapErosion::hydraulic(map, settings.seed, hydraulic);
+
+		// Measure the time taken to erode the heightmap
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s (" << (uint64_t)rate << " droplets/s)";
+	}
+
+	// Thermal erosion runs last to settle the slopes left by the droplets
+	if (settings.thermal_iterations > 0)
+	{
+		cout << "\nThermal erosion... ";
+		StageScope stage("Thermal erosion", (double)map.getWidthX() * map.getWidthY());
+		auto t_start = Timer::now();
+		ThermalSettings thermal;
+		thermal.iterations = settings.thermal_iterations;
+		MapErosion::thermal(map, thermal);
+
+		// Measure the time taken to erode the heightmap
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+	}
+}
+
+// Run the smoothing filters selected on the command line
+template <class T>
+void filterHeightmap(BasicHeightmap<T>& map, const Settings& settings)
+{
+	if (settings.median_radius == 0 && settings.blur_radius == 0 && settings.blur_sigma <= 0.0f)
+	{
+		return;
+	}
+
+	cout << "\nFiltering heightmap... ";
+	StageScope stage("Filter heightmap", (double)map.getWidthX() * map.getWidthY());
+	auto t_start = Timer::now();
+
+	// The median filter runs first so that blurring doesn't spread out spikes before they are removed
+	// Filters read across the edges of a wrapping heightmap, so that it still tiles
+	BorderPolicy border = settings.wrap ? BorderPolicy::Wrap : BorderPolicy::Clamp;
+	MapFilter::medianFilter(map, settings.median_radius, border);
+	MapFilter::boxBlur(map, settings.blur_radius, border);
+	MapFilter::gaussianBlur(map, settings.blur_sigma, border);
+
+	// Measure the time taken to filter the heightmap
+	auto t_now = Timer::now();
+	chrono::duration<double> delta = t_now - t_start;
+	cout << delta.count() << "s";
+}
+
+// Get the heightmap filename without its extension, used to name the extra outputs saved next to the heightmap
+string getOutputBase(const Settings& settings)
+{
+	string base = settings.fname;
+	size_t extension = base.find_last_of('.');
+	if (extension != string::npos && base.find_first_of("/\\", extension) == string::npos)
+	{
+		base.erase(extension);
+	}
+	return base;
+}
+
+// Save a preview of a heightmap that is being generated as a 16 bit png next to the heightmap
+void savePreview(const Heightmap& preview, unsigned stride, const Settings& settings, Timer::time_point t_start)
+{
+	// Previews are remapped using their own heights, as the full heightmap hasn't been measured yet
+	HeightRemap remap;
+	if (settings.remap != "none")
+	{
+		bool equalise = settings.remap == "equalise";
+		HeightStats stats = measureHeights(preview, equalise ? remap_bins : 0);
+		remap = equalise ? HeightRemap::equalise(stats, settings.min_height, settings.max_height) : HeightRemap::linear(stats, settings.min_height, settings.max_height);
+	}
+
+	PixelBuffer image(preview.getWidthX(), preview.getWidthY(), sizeof(uint16_t));
+	for (unsigned y = 0; y < preview.getWidthY(); ++y)
+	{
+		for (unsigned x = 0; x < preview.getWidthX(); ++x)
+		{
+			float height = clamp(remap.apply(preview.getHeight(x, y)), -1.0f, 1.0f);
+			image.fillPixel(x, y, (uint16_t)((height * 0.5f + 0.5f) * std::numeric_limits<uint16_t>::max()));
+		}
+	}
+
+	string filename = getOutputBase(settings) + "_preview" + to_string(stride) + ".png";
+	try
+	{
+		image.save(filename);
+
+		// Measure the time taken to reach this preview, flushing so that it is seen straight away
+		chrono::duration<double> delta = Timer::now() - t_start;
+		cout << "\nPreview saved to " << filename << " after " << delta.count() << "s" << endl;
+	}
+	catch (exception& e)
+	{
+		cout << "\nPreview failed: " << e.what() << endl;
+	}
+}
+
+// Fill depressions and calculate flow directions and accumulation, saving each as a 32 bit raster next to the heightmap
+template <class T>
+void exportHydrology(const BasicHeightmap<T>& map, const Settings& settings)
+{
+	cout << "\nCalculating flow... ";
+	auto t_start = Timer::now();
+	string base = getOutputBase(settings);
+
+	try
+	{
+		Heightmap filled(map.getWidthX(), map.getWidthY());
+		filled.set(map);
+		MapHydrology::fillDepressions(filled);
+		saveRaw32(base + "_filled.r32", filled.getData(), filled.getWidthX(), filled.getWidthY());
+
+		FlowDirections directions;
+		MapHydrology::flowDirections(map, directions, settings.flow_method == "dinf" ? FlowMethod::DInfinity : FlowMethod::D8);
+		saveRaw32(base + "_flow.r32", directions.angle.data(), directions.width_x, directions.width_y);
+
+		Heightmap accumulation;
+		MapHydrology::flowAccumulation(directions, accumulation);
+		saveRaw32(base + "_accumulation.r32", accumulation.getData(), accumulation.getWidthX(), accumulation.getWidthY());
+
+		// Measure the time taken to calculate flow
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+
+		cout << "\nFlow saved to " << base << "_filled.r32, " << base << "_flow.r32 and " << base << "_accumulation.r32" << endl;
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nFlow export failed:\n" << e.what() << endl;
+	}
+}
+
+// Bake shadow and ambient occlusion masks for a heightmap, saving each as an 8 bit png next to the heightmap
+template <class T>
+void exportLighting(const BasicHeightmap<T>& map, const Settings& settings)
+{
+	cout << "\nBaking lighting... ";
+	auto t_start = Timer::now();
+	string base = getOutputBase(settings);
+
+	try
+	{
+		MaxMipmap mipmap(map);
+		if (settings.sun_elevation > 0.0f)
+		{
+			ShadowSettings shadow;
+			shadow.azimuth = settings.sun_azimuth;
+			shadow.elevation = settings.sun_elevation;
+			PixelBuffer mask(map.getWidthX(), map.getWidthY(), sizeof(uint8_t));
+			MapLighting::bakeShadows(mipmap, mask, shadow);
+			mask.save(base + "_shadow.png");
+		}
+		if (settings.ao_radius > 0.0f)
+		{
+			AmbientSettings ambient;
+			ambient.radius = settings.ao_radius;
+			PixelBuffer mask(map.getWidthX(), map.getWidthY(), sizeof(uint8_t));
+			MapLighting::bakeAmbientOcclusion(mipmap, mask, ambient);
+			mask.save(base + "_ao.png");
+		}
+
+		// Measure the time taken to bake lighting
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+
+		if (settings.sun_elevation > 0.0f)
+		{
+			cout << "\nShadows saved to " << base << "_shadow.png";
+		}
+		if (settings.ao_radius > 0.0f)
+		{
+			cout << "\nAmbient occlusion saved to " << base << "_ao.png";
+		}
+		cout << endl;
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nLighting export failed:\n" << e.what() << endl;
+	}
+}
+
+// Render hillshade, slope and aspect images of a heightmap in one pass, saving each as an 8 bit png next to the heightmap
+template <class T>
+void exportShading(const BasicHeightmap<T>& map, const Settings& settings)
+{
+	cout << "\nRendering terrain... ";
+	auto t_start = Timer::now();
+	string base = getOutputBase(settings);
+
+	try
+	{
+		unique_ptr<PixelBuffer> hillshade, slope, aspect;
+		if (settings.gen_hillshade)
+		{
+			hillshade = make_unique<PixelBuffer>(map.getWidthX(), map.getWidthY(), sizeof(uint8_t));
+		}
+		if (settings.gen_slope)
+		{
+			slope = make_unique<PixelBuffer>(map.getWidthX(), map.getWidthY(), sizeof(uint8_t));
+		}
+		if (settings.gen_aspect)
+		{
+			aspect = make_unique<PixelBuffer>(map.getWidthX(), map.getWidthY(), sizeof(uint8_t));
+		}
+		MapLighting::renderTerrain(map, ShadeSettings(), hillshade.get(), slope.get(), aspect.get());
+
+		string saved;
+		if (hillshade)
+		{
+			hillshade->save(base + "_hillshade.png");
+			saved += " " + base + "_hillshade.png";
+		}
+		if (slope)
+		{
+			slope->save(base + "_slope.png");
+			saved += " " + base + "_slope.png";
+		}
+		if (aspect)
+		{
+			aspect->save(base + "_aspect.png");
+			saved += " " + base + "_aspect.png";
+		}
+
+		// Measure the time taken to render and save the images
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+
+		cout << "\nTerrain images saved to" << saved << endl;
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nTerrain render failed:\n" << e.what() << endl;
+	}
+}
+
+// Build an adaptive triangle mesh of a heightmap and save it next to the heightmap, with normals if they were calculated
+template <class T>
+void exportMesh(const BasicHeightmap<T>& map, const Settings& settings, const Vectormap* normals)
+{
+	cout << "\nBuilding mesh... ";
+	auto t_start = Timer::now();
+	string filename = getOutputBase(settings) + "." + settings.mesh_format;
+
+	try
+	{
+		MeshErrors errors(map);
+		TerrainMesh mesh;
+		errors.extract(map, mesh, settings.mesh_error, normals);
+		if (settings.mesh_format == "obj")
+		{
+			MapMesh::saveOBJ(mesh, filename);
+		}
+		else
+		{
+			MapMesh::saveGLB(mesh, filename);
+		}
+
+		// Measure the time taken to build the mesh
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+
+		cout << "\nMesh saved to " << filename << " (" << mesh.indices.size() / 3 << " triangles)" << endl;
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nMesh export failed:\n" << e.what() << endl;
+	}
+}
+
+// Trace contour lines on a heightmap and save them as GeoJSON next to the heightmap
+template <class T>
+void exportContours(const BasicHeightmap<T>& map, const Settings& settings)
+{
+	cout << "\nTracing contours... ";
+	auto t_start = Timer::now();
+	string filename = getOutputBase(settings) + "_contours.geojson";
+
+	try
+	{
+		vector<Contour> contours;
+		MapContour::extract(map, settings.contour_levels, contours);
+		MapContour::saveGeoJSON(contours, filename);
+
+		// Measure the time taken to trace the contours
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+
+		cout << "\nContours saved to " << filename << " (" << contours.size() << " lines)" << endl;
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nContour export failed:\n" << e.what() << endl;
+	}
+}
+
+// Calculate normals for a heightmap if requested and export it as a png
+// If a cache and the key of the heightmap are given, the normals are loaded from or added to the cache
+template <class T>
+void exportHeightmap(BasicHeightmap<T>& map, const Settings& settings, StageCache* cache = nullptr, const CacheKey* key = nullptr)
+{
+	// Generate normals and tangents, reading across the edges of a wrapping heightmap
+	Vectormap normals, tangents;
+	BorderPolicy border = settings.wrap ? BorderPolicy::Wrap : BorderPolicy::Clamp;
+	if (settings.gen_normals)
+	{
+		cout << "\nCalculating normals... ";
+		StageScope stage("Calculate normals", (double)map.getWidthX() * map.getWidthY());
+		auto t_start = Timer::now();
+		if (cache != nullptr && key != nullptr)
+		{
+			CacheKey normals_key = *key;
+			normals_key.add(string("normals"));
+			if (cache->load(normals_key, normals, tangents))
+			{
+				cout << "(cached) ";
+			}
+			else
+			{
+				map.calculateNormals(normals, tangents, 0.0f, border);
+				try
+				{
+					cache->store(normals_key, normals, tangents);
+				}
+				catch (exception& e)
+				{
+					cout << "\nCache failed: " << e.what() << " ";
+				}
+			}
+		}
+		else
+		{
+			map.calculateNormals(normals, tangents, 0.0f, border);
+		}
+
+		// Measure the time taken to generate normals
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+	}
+
+	// Measure the heightmap to find the remapping applied while it is exported
+	HeightRemap remap;
+	if (settings.remap != "none")
+	{
+		cout << "\nMeasuring heightmap... ";
+		auto t_start = Timer::now();
+		bool equalise = settings.remap == "equalise";
+		HeightStats stats = measureHeights(map, equalise ? remap_bins : 0);
+		if (equalise)
+		{
+			remap = HeightRemap::equalise(stats, settings.min_height, settings.max_height);
+		}
+		else
+		{
+			remap = HeightRemap::linear(stats, settings.min_height, settings.max_height);
+		}
+
+		// Measure the time taken to measure the heightmap
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+		cout << "\nHeight range: " << stats.min << " to " << stats.max << ", mean " << stats.mean;
+	}
+
+	// Load height data into a byte buffer
+	cout << "\nExporting heightmap... ";
+	auto t_start = Timer::now();
+	PixelBuffer image(map.getWidthX(), map.getWidthY(), sizeof(uint16_t));
+	{
+		StageScope stage("Quantise heights", (double)map.getWidthX() * map.getWidthY());
+		unsigned blocks = (map.getWidthY() + heightmap_tile_size - 1) / heightmap_tile_size;
+		parallelFor(blocks, [&](unsigned block, unsigned thread)
+		{
+			TraceSpan block_span("Quantise block");
+			unsigned end = min(map.getWidthY(), (block + 1) * heightmap_tile_size);
+			for (unsigned y = block * heightmap_tile_size; y < end; ++y)
+			{
+				for (unsigned x = 0; x < map.getWidthX(); ++x)
+				{
+					// Remap the height and clamp it to the range of the image, so that heights outside [-1, 1] can't wrap around
+					float height = clamp(remap.apply(map.getHeight(x, y)), -1.0f, 1.0f);
+
+					// Convert noise to a 16 bit integer and write it to the image
+					image.fillPixel(x, y, (uint16_t)((height * 0.5f + 0.5f) * std::numeric_limits<uint16_t>::max()));
+				}
+			}
+		});
+	}
+
+	// Save the heightmap as a png
+	try
+	{
+		{
+			StageScope stage("Save heightmap", (double)map.getWidthX() * map.getWidthY());
+			image.save(settings.fname);
+		}
+
+		// Measure the time taken to package the heightmap
+		auto t_now = Timer::now();
+		chrono::duration<double> delta = t_now - t_start;
+		cout << delta.count() << "s";
+
+		cout << "\n\nHeightmap saved to " << settings.fname << endl;
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nExport failed:\n" << e.what() << endl;
+	}
+
+	if (!settings.flow_method.empty())
+	{
+		exportHydrology(map, settings);
+	}
+	if (settings.sun_elevation > 0.0f || settings.ao_radius > 0.0f)
+	{
+		exportLighting(map, settings);
+	}
+	if (settings.gen_hillshade || settings.gen_slope || settings.gen_aspect)
+	{
+		exportShading(map, settings);
+	}
+	if (!settings.mesh_format.empty())
+	{
+		exportMesh(map, settings, settings.gen_normals ? &normals : nullptr);
+	}
+	if (!settings.contour_levels.empty())
+	{
+		exportContours(map, settings);
+	}
+}
+
+// Load a base heightmap, then add a generated layer to it if a generator was selected
+template <class T, class U, class F>
+void importHeightmap(const Settings& settings, F load)
+{
+	cout << "\nImporting heightmap... ";
+	auto t_start = Timer::now();
+	BasicHeightmap<U> base;
+	try
+	{
+		load(base);
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nImport failed:\n" << e.what() << endl;
+		return;
+	}
+
+	// Measure the time taken to load the heightmap
+	auto t_now = Timer::now();
+	chrono::duration<double> delta = t_now - t_start;
+	cout << delta.count() << "s";
+
+	// Imported heightmaps are only copied if they need to be modified
+	bool modified = settings.erosion_droplets > 0 || settings.thermal_iterations > 0 || settings.median_radius > 0 || settings.blur_radius > 0 || settings.blur_sigma > 0.0f;
+	if (settings.generator_name.empty() && !modified)
+	{
+		exportHeightmap(base, settings);
+		return;
+	}
+
+	BasicHeightmap<T> map(base.getWidthX(), base.getWidthY());
+	if (!settings.generator_name.empty())
+	{
+		// Generate a layer with the same dimensions as the base heightmap
+		cout << "\nGenerating heightmap... ";
+		t_start = Timer::now();
+		generateHeightmap(map, settings);
+		map.add(base);
+
+		// Measure the time taken to create the heightmap
+		t_now = Timer::now();
+		delta = t_now - t_start;
+		cout << delta.count() << "s";
+	}
+	else
+	{
+		// Copy the base heightmap, which may be read-only, so that it can be modified
+		map.set(base);
+	}
+
+	erodeHeightmap(map, settings);
+	filterHeightmap(map, settings);
+	exportHeightmap(map, settings);
+}
+
+// Generate and export every output of a generator graph
+template <class T>
+void buildGraph(const Settings& settings, StageCache* cache)
+{
+	cout << "\nGenerating heightmap... ";
+	auto t_start = Timer::now();
+	GraphResult<T> result;
+	unsigned main_output = 0;
+	vector<string> files;
+	vector<CacheKey> keys;
+	try
+	{
+		GeneratorGraph graph(settings.graph_name);
+		main_output = graph.getMainOutput();
+		CacheKey graph_key = getHeightmapKey(settings);
+		for (unsigned i = 0; i < graph.getOutputCount(); ++i)
+		{
+			files.push_back(graph.getOutputFile(i));
+			keys.push_back(CacheKey(graph_key).add((uint64_t)i));
+		}
+
+		// The graph only needs to run if any of its outputs are missing from the cache
+		bool cached = cache != nullptr;
+		result.heightmaps.resize(files.size());
+		for (unsigned i = 0; i < files.size() && cached; ++i)
+		{
+			cached = cache->load(keys[i], result.heightmaps[i]);
+		}
+
+		if (cached)
+		{
+			cout << "(cached) ";
+		}
+		else
+		{
+			result.heightmaps.clear();
+			graph.generate(result, settings.width, settings.height, settings.seed);
+			if (cache != nullptr)
+			{
+				for (unsigned i = 0; i < files.size(); ++i)
+				{
+					cache->store(keys[i], result.heightmaps[i]);
+				}
+			}
+		}
+	}
+	catch (exception& e)
+	{
+		cout << "\n\nGraph failed:\n" << e.what() << endl;
+		return;
+	}
+
+	// Measure the time taken to create the heightmaps
+	auto t_now = Timer::now();
+	chrono::duration<double> delta = t_now - t_start;
+	cout << delta.count() << "s";
+
+	// Export the main output with the command line settings, and other outputs to the files named in the graph
+	for (unsigned i = 0; i < files.size(); ++i)
+	{
+		if (i == main_output)
+		{
+			exportHeightmap(result.heightmaps[i], settings, cache, &keys[i]);
+		}
+		else
+		{
+			Settings output_settings = settings;
+			output_settings.fname = files[i];
+			output_settings.gen_normals = false;
+			output_settings.flow_method.clear();
+			output_settings.sun_elevation = 0.0f;
+			output_settings.ao_radius = 0.0f;
+			output_settings.gen_hillshade = false;
+			output_settings.gen_slope = false;
+			output_settings.gen_aspect = false;
+			output_settings.mesh_format.clear();
+			output_settings.contour_levels.clear();
+			exportHeightmap(result.heightmaps[i], output_settings);
+		}
+	}
+}
+
+// Generate and export a heightmap using the specified height storage type
+template <class T>
+void buildHeightmap(const Settings& settings)
+{
+	// Generated heightmaps and normals are reused from previous runs with the same settings
+	unique_ptr<StageCache> cache;
+	if (!settings.cache_dir.empty())
+	{
+		cache = make_unique<StageCache>(settings.cache_dir, (uint64_t)settings.cache_size << 20);
+	}
+
+	if (!settings.graph_name.empty())
+	{
+		buildGraph<T>(settings, cache.get());
+		return;
+	}
+
+	if (!settings.import_name.empty())
+	{
+		// Raw files are mapped into memory, so their dimensions are only used if they were set on the command line
+		unsigned raw_width = settings.custom_size ? settings.width : 0;
+		unsigned raw_height = settings.custom_size ? settings.height : 0;
+
+		// Pick a loader based on the file extension
+		string extension = settings.import_name.substr(min(settings.import_name.rfind('.'), settings.import_name.size()));
+		transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		if (extension == ".r16" || extension == ".raw")
+		{
+			importHeightmap<T, fixed16>(settings, [&](Heightmap16& base) { MapImport::mapRaw16(settings.import_name, base, raw_width, raw_height); });
+		}
+		else if (extension == ".r32")
+		{
+			importHeightmap<T, float>(settings, [&](Heightmap& base) { MapImport::mapRaw32(settings.import_name, base, raw_width, raw_height); });
+		}
+		else if (extension == ".pfm")
+		{
+			importHeightmap<T, T>(settings, [&](BasicHeightmap<T>& base) { MapImport::loadPFM(settings.import_name, base); });
+		}
+		else
+		{
+			importHeightmap<T, T>(settings, [&](BasicHeightmap<T>& base) { MapImport::loadPNG(settings.import_name, base); });
+		}
+		return;
+	}
+
+	// Create the heightmap
+	cout << "\nGenerating heightmap... ";
+	auto t_start = Timer::now();
+	CacheKey key = getHeightmapKey(settings);
+	BasicHeightmap<T> map;
+	bool cached = cache != nullptr && cache->load(key, map);
+	if (cached)
+	{
+		cout << "(cached) ";
+	}
+	else
+	{
+		if (settings.use_region)
+		{
+			map.resize(settings.region_width, settings.region_height);
+		}
+		else
+		{
+			map.resize(settings.width, settings.height);
+		}
+		if (settings.progressive)
+		{
+			generateHeightmap(map, settings, [&](const Heightmap& preview, unsigned stride) { savePreview(preview, stride, settings, t_start); });
+		}
+		else
+		{
+			generateHeightmap(map, settings);
+		}
+	}
+
+	// Measure the time taken to create the heightmap
+	auto t_now = Timer::now();
+	chrono::duration<double> delta = t_now - t_start;
+	cout << delta.count() << "s";
+
+	// The cached heightmap has already been eroded
+	if (!cached)
+	{
+		erodeHeightmap(map, settings);
+		filterHeightmap(map, settings);
+		if (cache != nullptr)
+		{
+			try
+			{
+				cache->store(key, map);
+			}
+			catch (exception& e)
+			{
+				cout << "\nCache failed: " << e.what() << " ";
+			}
+		}
+	}
+
+	exportHeightmap(map, settings, cache.get(), &key);
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+
 	// Get the start time
 	auto t_start = Timer::now();
 	// Generate the default rng seed
-	unsigned seed = (unsigned)t_start.time_since_epoch().count();
+	settings.seed = (unsigned)t_start.time_since_epoch().count();
 
 	// Get the command line arguments
 	if (argc > 1)
@@ -37,14 +888,300 @@ int main(int argc, char** argv)
 		// Get the file name from the first parameter if it is not a flag
 		if (argv[1][0] != '-' && argv[1][0] != '/')
 		{
-			fname = argv[1];
+			settings.fname = argv[1];
 			i++;
 		}
 
 		// Read other command line parameters
 		for (i; i < argc; ++i)
 		{
-			if (argv[i][0] == '-' || argv[i][0] == '/')
+			if (argv[i][0] == '-' && argv[i][1] == '-')
+			{
+				// Long options
+				string option = argv[i] + 2;
+				if (option == "cache")
+				{
+					// Get the directory used to cache generated stages
+					if (argc > i + 1)
+					{
+						settings.cache_dir = argv[++i];
+					}
+				}
+				else if (option == "remap")
+				{
+					// Get how heights are remapped when they are exported
+					if (argc > i + 1)
+					{
+						settings.remap = argv[++i];
+						if (settings.remap == "equalize")
+						{
+							settings.remap = "equalise";
+						}
+					}
+				}
+				else if (option == "erode")
+				{
+					// Get the number of droplets used for hydraulic erosion
+					if (argc > i + 1)
+					{
+						try
+						{
+							int droplets = stoi(argv[++i]);
+							if (droplets < 0)
+							{
+								cout << "Invalid droplet count - must be 0 or more";
+								return 0;
+							}
+							settings.erosion_droplets = droplets;
+						}
+						catch (logic_error e)
+						{
+							cout << "Invalid droplet count";
+							return 0;
+						}
+					}
+				}
+				else if (option == "thermal")
+				{
+					// Get the number of thermal erosion iterations
+					if (argc > i + 1)
+					{
+						try
+						{
+							int iterations = stoi(argv[++i]);
+							if (iterations < 0)
+							{
+								cout << "Invalid iteration count - must be 0 or more";
+								return 0;
+							}
+							settings.thermal_iterations = iterations;
+						}
+						catch (logic_error e)
+						{
+							cout << "Invalid iteration count";
+							return 0;
+						}
+					}
+				}
+				else if (option == "median")
+				{
+					// Get the radius of the median filter
+					if (argc > i + 1)
+					{
+						try
+						{
+							int radius = stoi(argv[++i]);
+							if (radius < 0 || radius > (int)MapFilter::max_median_radius)
+							{
+								cout << "Invalid filter radius - must be between 0 and " << MapFilter::max_median_radius;
+								return 0;
+							}
+							settings.median_radius = radius;
+						}
+						catch (logic_error e)
+						{
+							cout << "Invalid filter radius";
+							return 0;
+						}
+					}
+				}
+				else if (option == "blur")
+				{
+					// Get the radius of the box blur
+					if (argc > i + 1)
+					{
+						try
+						{
+							int radius = stoi(argv[++i]);
+							if (radius < 0 || radius > (int)MapFilter::max_blur_radius)
+							{
+								cout << "Invalid filter radius - must be between 0 and " << MapFilter::max_blur_radius;
+								return 0;
+							}
+							settings.blur_radius = radius;
+						}
+						catch (logic_error e)
+						{
+							cout << "Invalid filter radius";
+							return 0;
+						}
+					}
+				}
+				else if (option == "gaussian")
+				{
+					// Get the standard deviation of the Gaussian blur
+					if (argc > i + 1)
+					{
+						try
+						{
+							settings.blur_sigma = stof(argv[++i]);
+							if (!(settings.blur_sigma >= 0.0f && settings.blur_sigma <= MapFilter::max_blur_sigma))
+							{
+								cout << "Invalid blur size - must be between 0 and " << MapFilter::max_blur_sigma;
+								return 0;
+							}
+						}
+						catch (logic_error e)
+						{
+							cout << "Invalid blur size";
+							return 0;
+						}
+					}
+				}
+				else if (option == "flow")
+				{
+					// Get the method used to find flow directions
+					if (argc > i + 1)
+					{
+						settings.flow_method = argv[++i];
+					}
+				}
+				else if (option == "shadow")
+				{
+					// Get the direction and angle of the sun used to bake shadows
+					if (argc > i + 2)
+					{
+						try
+						{
+							settings.sun_azimuth = stof(argv[++i]);
+							settings.sun_elevation = stof(argv[++i]);
+						}
+						catch (invalid_argument e)
+						{
+							cout << "Invalid sun direction";
+							return 0;
+						}
+					}
+				}
+				else if (option == "ao")
+				{
+					// Get the distance ambient occlusion is baked to
+					if (argc > i + 1)
+					{
+						try
+						{
+							settings.ao_radius = stof(argv[++i]);
+						}
+						catch (invalid_argument e)
+						{
+							cout << "Invalid ambient occlusion radius";
+							return 0;
+						}
+					}
+				}
+				else if (option == "hillshade")
+				{
+					settings.gen_hillshade = true;
+				}
+				else if (option == "slope")
+				{
+					settings.gen_slope = true;
+				}
+				else if (option == "aspect")
+				{
+					settings.gen_aspect = true;
+				}
+				else if (option == "mesh")
+				{
+					// Get the mesh format and the largest error allowed in the mesh
+					if (argc > i + 2)
+					{
+						settings.mesh_format = argv[++i];
+						try
+						{
+							settings.mesh_error = stof(argv[++i]);
+						}
+						catch (invalid_argument e)
+						{
+							cout << "Invalid mesh error";
+							return 0;
+						}
+					}
+				}
+				else if (option == "contours")
+				{
+					// Get the comma separated list of heights to trace contours at
+					if (argc > i + 1)
+					{
+						stringstream list(argv[++i]);
+						string level;
+						try
+						{
+							while (getline(list, level, ','))
+							{
+								settings.contour_levels.push_back(stof(level));
+							}
+						}
+						catch (invalid_argument e)
+						{
+							cout << "Invalid contour level";
+							return 0;
+						}
+					}
+				}
+				else if (option == "trace")
+				{
+					// Get the file the trace is saved to, if one is given
+					settings.trace = true;
+					if (argc > i + 1 && argv[i + 1][0] != '-' && argv[i + 1][0] != '/')
+					{
+						settings.trace_name = argv[++i];
+					}
+				}
+				else if (option == "perf-counters")
+				{
+					settings.perf_counters = true;
+				}
+				else if (option == "alloc-stats")
+				{
+					settings.alloc_stats = true;
+				}
+				else if (option == "region")
+				{
+					// Get the position and size of the window to generate
+					if (argc > i + 4)
+					{
+						try
+						{
+							settings.region.x = stoi(argv[++i]);
+							settings.region.y = stoi(argv[++i]);
+							settings.region_width = stoi(argv[++i]);
+							settings.region_height = stoi(argv[++i]);
+							settings.use_region = true;
+						}
+						catch (invalid_argument e)
+						{
+							cout << "Invalid region";
+							return 0;
+						}
+					}
+				}
+				else if (option == "progressive")
+				{
+					settings.progressive = true;
+				}
+				else if (option == "wrap")
+				{
+					settings.wrap = true;
+				}
+				else if (option == "cache-size")
+				{
+					// Get the maximum size of the cache in megabytes
+					if (argc > i + 1)
+					{
+						try
+						{
+							settings.cache_size = stoi(argv[++i]);
+						}
+						catch (invalid_argument e)
+						{
+							cout << "Invalid cache size";
+							return 0;
+						}
+					}
+				}
+			}
+			else if (argv[i][0] == '-' || argv[i][0] == '/')
 			{
 				switch (argv[i][1])
 				{
@@ -55,7 +1192,8 @@ int main(int argc, char** argv)
 					{
 						try
 						{
-							width = stoi(argv[++i]);
+							settings.width = stoi(argv[++i]);
+							settings.custom_size = true;
 						}
 						catch (invalid_argument e)
 						{
@@ -72,7 +1210,8 @@ int main(int argc, char** argv)
 					{
 						try
 						{
-							height = stoi(argv[++i]);
+							settings.height = stoi(argv[++i]);
+							settings.custom_size = true;
 						}
 						catch (invalid_argument e)
 						{
@@ -89,7 +1228,7 @@ int main(int argc, char** argv)
 					{
 						try
 						{
-							seed = stoi(argv[++i]);
+							settings.seed = stoi(argv[++i]);
 						}
 						catch (invalid_argument e)
 						{
@@ -106,7 +1245,7 @@ int main(int argc, char** argv)
 					{
 						try
 						{
-							max_height = stof(argv[++i]);
+							settings.max_height = stof(argv[++i]);
 						}
 						catch (invalid_argument e)
 						{
@@ -123,7 +1262,7 @@ int main(int argc, char** argv)
 					{
 						try
 						{
-							min_height = stof(argv[++i]);
+							settings.min_height = stof(argv[++i]);
 						}
 						catch (invalid_argument e)
 						{
@@ -139,7 +1278,7 @@ int main(int argc, char** argv)
 					if (argc > i + 1)
 					{
 						++i;
-						generator_name = argv[i];
+						settings.generator_name = argv[i];
 
 						// Get data input for the generator
 						if (argc > i + 1)
@@ -150,7 +1289,7 @@ int main(int argc, char** argv)
 								while (true)
 								{
 									// Add the data
-									generator_data.push_back(stof(argv[i]));
+									settings.generator_data.push_back(stof(argv[i]));
 
 									// Move to the next string
 									if (argc > i + 1)
@@ -183,7 +1322,34 @@ int main(int argc, char** argv)
 
 				case 'N':
 				case 'n':
-					gen_normals = true;
+					settings.gen_normals = true;
+					break;
+
+				case 'C':
+				case 'c':
+					// Get the generator graph file
+					if (argc > i + 1)
+					{
+						settings.graph_name = argv[++i];
+					}
+					break;
+
+				case 'I':
+				case 'i':
+					// Get the heightmap to import
+					if (argc > i + 1)
+					{
+						settings.import_name = argv[++i];
+					}
+					break;
+
+				case 'P':
+				case 'p':
+					// Get the storage type used for height data
+					if (argc > i + 1)
+					{
+						settings.precision = argv[++i];
+					}
 					break;
 				}
 			}
@@ -191,16 +1357,16 @@ int main(int argc, char** argv)
 	}
 
 	// Display selected parameters
-	cout << "Seed value: " << seed << endl;
-	cout << "Width: " << width << ", Height: " << height << endl;
-	cout << "Upper bound: " << max_height << ", Lower bound: " << min_height << endl;
+	cout << "Seed value: " << settings.seed << endl;
+	cout << "Width: " << settings.width << ", Height: " << settings.height << endl;
+	cout << "Upper bound: " << settings.max_height << ", Lower bound: " << settings.min_height << endl;
 	cout << "Generator: ";
-	if (!generator_name.empty())
+	if (!settings.generator_name.empty())
 	{
-		cout << generator_name;
-		for (unsigned i = 0; i < generator_data.size(); ++i)
+		cout << settings.generator_name;
+		for (unsigned i = 0; i < settings.generator_data.size(); ++i)
 		{
-			cout << " " << generator_data[i];
+			cout << " " << settings.generator_data[i];
 		}
 	}
 	else
@@ -208,101 +1374,215 @@ int main(int argc, char** argv)
 		cout << "default";
 	}
 	cout << endl;
-
-	// Check parameters
-	if (width == 0 || height == 0 || max_height > 1.0f || min_height < -1.0f || min_height >= max_height)
+	cout << "Precision: " << settings.precision << endl;
+	cout << "Remap: " << settings.remap << endl;
+	if (settings.erosion_droplets > 0)
 	{
-		cout << "Heightmap dimensions are invalid";
-		return 0;
+		cout << "Erosion: " << settings.erosion_droplets << " droplets" << endl;
 	}
+	if (settings.thermal_iterations > 0)
+	{
+		cout << "Thermal erosion: " << settings.thermal_iterations << " iterations" << endl;
+	}
+	if (settings.median_radius > 0 || settings.blur_radius > 0 || settings.blur_sigma > 0.0f)
+	{
+		cout << "Filters: median " << settings.median_radius << ", box " << settings.blur_radius << ", gaussian " << settings.blur_sigma << endl;
+	}
+	if (!settings.flow_method.empty())
+	{
+		cout << "Flow: " << settings.flow_method << endl;
+	}
+	if (settings.sun_elevation > 0.0f)
+	{
+		cout << "Shadows: azimuth " << settings.sun_azimuth << ", elevation " << settings.sun_elevation << endl;
+	}
+	if (settings.ao_radius > 0.0f)
+	{
+		cout << "Ambient occlusion: radius " << settings.ao_radius << endl;
+	}
+	if (settings.gen_hillshade || settings.gen_slope || settings.gen_aspect)
+	{
+		cout << "Terrain images:" << (settings.gen_hillshade ? " hillshade" : "") << (settings.gen_slope ? " slope" : "") << (settings.gen_aspect ? " aspect" : "") << endl;
+	}
+	if (!settings.mesh_format.empty())
+	{
+		cout << "Mesh: " << settings.mesh_format << ", error " << settings.mesh_error << endl;
+	}
+	if (!settings.contour_levels.empty())
+	{
+		cout << "Contours:";
+		for (float level : settings.contour_levels)
+		{
+			cout << " " << level;
+		}
+		cout << endl;
+	}
+	if (!settings.import_name.empty())
+	{
+		cout << "Import: " << settings.import_name << endl;
+	}
+	if (!settings.graph_name.empty())
+	{
+		cout << "Graph: " << settings.graph_name << endl;
+	}
+	if (settings.use_region)
+	{
+		settings.region.width_x = settings.width;
+		settings.region.width_y = settings.height;
+		cout << "Region: " << settings.region_width << "x" << settings.region_height << " at " << settings.region.x << ", " << settings.region.y << endl;
+	}
+	if (settings.progressive)
+	{
+		cout << "Progressive: previews at 1/4 and 1/2 resolution" << endl;
 
-	// Create the heightmap
-	cout << "\nGenerating heightmap... ";
-	t_start = Timer::now();
-	Heightmap map(width, height);
-
-	bool done = false;
-	if (!generator_name.empty())
+		// Previews are only saved while the heightmap is generated, which a cached heightmap would skip
+		if (!settings.cache_dir.empty())
+		{
+			cout << "Cache: disabled, as progressive runs always generate the heightmap" << endl;
+			settings.cache_dir.clear();
+		}
+	}
+	if (settings.wrap)
 	{
-		// Use the specified generator
-		if (generator_name == "random" || generator_name == "Random")
+		cout << "Wrap: enabled" << endl;
+	}
+	if (!settings.cache_dir.empty())
+	{
+		cout << "Cache: " << settings.cache_dir << " (" << settings.cache_size << "MB)" << endl;
+	}
+	if (settings.trace)
+	{
+		if (settings.trace_name.empty())
 		{
-			if (generator_data.size() > 2)
-			{
-				MapGenerator::layeredWhiteNoise(map, seed, min_height, max_height, (unsigned)generator_data[0], (unsigned)generator_data[1], generator_data[2]);
-				done = true;
-			}
+			settings.trace_name = getOutputBase(settings) + "_trace.json";
 		}
-		else if (generator_name == "plasma" || generator_name == "Plasma")
+		cout << "Trace: " << settings.trace_name << endl;
+	}
+	if (settings.perf_counters)
+	{
+		// Carry on without counters if they can't be opened
+		string error;
+		if (PerfCounters::enable(error))
 		{
-			if (generator_data.size() > 0)
-			{
-				MapGenerator::plasma(map, seed, min_height, max_height, (unsigned)generator_data[0]);
-				done = true;
-			}
+			cout << "Performance counters: enabled" << endl;
 		}
-		else if (generator_name == "perlin" || generator_name == "Perlin")
+		else
 		{
-			if (generator_data.size() > 2)
-			{
-				MapGenerator::layeredPerlin(map, seed, min_height, max_height, (unsigned)generator_data[0], (unsigned)generator_data[1], generator_data[2]);
-				done = true;
-			}
+			cout << "Performance counters: unavailable - " << error << endl;
 		}
 	}
-
-	if (!done)
+	if (settings.alloc_stats)
 	{
-		MapGenerator::defaultGenerator(map, seed, min_height, max_height);
+		cout << "Allocation stats: enabled" << endl;
 	}
 
-	// Measure the time taken to create the heightmap
-	auto t_now = Timer::now();
-	chrono::duration<double> delta = t_now - t_start;
-	cout << delta.count() << "s";
-
-	// Generate normals and tangents
-	if (gen_normals)
+	// Check parameters
+	if (settings.width == 0 || settings.height == 0 || settings.max_height > 1.0f || settings.min_height < -1.0f || settings.min_height >= settings.max_height)
 	{
-		cout << "\nCalculating normals... ";
-		t_start = Timer::now();
-		Vectormap normals, tangents;
-		map.calculateNormals(normals, tangents);
-
-		// Measure the time taken to generate normals
-		t_now = Timer::now();
-		delta = t_now - t_start;
-		cout << delta.count() << "s";
+		cout << "Heightmap dimensions are invalid";
+		return 0;
 	}
-
-	// Load height data into a byte buffer
-	cout << "\nExporting heightmap... ";
-	t_start = Timer::now();
-	PixelBuffer image(map.getWidthX(), map.getWidthY(), sizeof(uint16_t));
-	for (unsigned y = 0; y < map.getWidthY(); ++y)
+	if (settings.use_region)
 	{
-		for (unsigned x = 0; x < map.getWidthX(); ++x)
+		if (settings.region_width == 0 || settings.region_height == 0 || (uint64_t)settings.region.x + settings.region_width > settings.width || (uint64_t)settings.region.y + settings.region_height > settings.height)
 		{
-			// Convert noise to a 16 bit integer and write it to the image
-			image.fillPixel(x, y, (uint16_t)((map.getHeight(x, y) * 0.5f + 0.5f) * std::numeric_limits<uint16_t>::max()));
+			cout << "Invalid region - must be within the heightmap dimensions";
+			return 0;
+		}
+
+		// Erosion and filters depend on cells outside the window, so they can't give the same heights as the whole heightmap
+		if (!settings.import_name.empty() || !settings.graph_name.empty() || settings.erosion_droplets > 0 || settings.thermal_iterations > 0
+			|| settings.median_radius > 0 || settings.blur_radius > 0 || settings.blur_sigma > 0.0f)
+		{
+			cout << "Invalid region - can't be used with imports, graphs, erosion or filters";
+			return 0;
+		}
+
+		// Remapping measures the heights of the window rather than the whole heightmap, which would change every height
+		if (settings.remap != "none")
+		{
+			cout << "Invalid region - can't be used with remapping";
+			return 0;
 		}
 	}
+	if (settings.wrap)
+	{
+		// Simplex noise is built on a skewed lattice that doesn't repeat across a rectangle
+		if (settings.generator_name == "simplex" || settings.generator_name == "Simplex")
+		{
+			cout << "Invalid wrap - simplex noise can't wrap";
+			return 0;
+		}
 
-	// Save the heightmap as a png
-	try
+		// Imported heightmaps, graphs and erosion don't repeat across the edges of the heightmap
+		if (!settings.import_name.empty() || !settings.graph_name.empty() || settings.erosion_droplets > 0 || settings.thermal_iterations > 0)
+		{
+			cout << "Invalid wrap - can't be used with imports, graphs or erosion";
+			return 0;
+		}
+	}
+	if (settings.remap != "none" && settings.remap != "linear" && settings.remap != "equalise")
+	{
+		cout << "Invalid remap - must be none, linear or equalise";
+		return 0;
+	}
+	if (!settings.flow_method.empty() && settings.flow_method != "d8" && settings.flow_method != "dinf")
+	{
+		cout << "Invalid flow method - must be d8 or dinf";
+		return 0;
+	}
+	if (!settings.mesh_format.empty() && settings.mesh_format != "obj" && settings.mesh_format != "glb")
 	{
-		image.save(fname);
+		cout << "Invalid mesh format - must be obj or glb";
+		return 0;
+	}
 
-		// Measure the time taken to package the heightmap
-		t_now = Timer::now();
-		delta = t_now - t_start;
-		cout << delta.count() << "s";
+	// Build the heightmap using the selected storage type
+	if (settings.trace)
+	{
+		Trace::enable();
+	}
+	if (settings.alloc_stats)
+	{
+		AllocStats::enable();
+	}
+	if (settings.precision == "float")
+	{
+		buildHeightmap<float>(settings);
+	}
+	else if (settings.precision == "half")
+	{
+		buildHeightmap<half>(settings);
+	}
+	else if (settings.precision == "fixed" || settings.precision == "16")
+	{
+		buildHeightmap<fixed16>(settings);
+	}
+	else
+	{
+		cout << "Invalid precision - must be float, half or fixed";
+	}
 
-		cout << "\n\nHeightmap saved to " << fname << endl;
+	if (PerfCounters::enabled)
+	{
+		PerfCounters::printSummary(cout);
 	}
-	catch (exception& e)
+	if (AllocStats::enabled)
 	{
-		cout << "\n\nExport failed:\n" << e.what() << endl;
+		AllocStats::printSummary(cout);
+	}
+	if (settings.trace)
+	{
+		try
+		{
+			Trace::save(settings.trace_name);
+			Trace::printSummary(cout);
+			cout << "\nTrace saved to " << settings.trace_name << endl;
+		}
+		catch (exception& e)
+		{
+			cout << "\n\nTrace failed:\n" << e.what() << endl;
+		}
 	}
 
 	return 0;
@@ -0,0 +1,121 @@
+#include "mappedfile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename)
+{
+#ifdef _WIN32
+	// Open the file and get its size
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		file = nullptr;
+		throw std::runtime_error("Unable to open file " + filename);
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+	{
+		CloseHandle(file);
+		throw std::runtime_error("Unable to read the size of " + filename);
+	}
+	size = (size_t)file_size.QuadPart;
+
+	// Empty files can't be mapped
+	if (size == 0)
+	{
+		return;
+	}
+
+	// Map the file
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		throw std::runtime_error("Unable to map file " + filename);
+	}
+
+	data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("Unable to map file " + filename);
+	}
+#else
+	// Open the file and get its size
+	int file = open(filename.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		throw std::runtime_error("Unable to open file " + filename);
+	}
+
+	struct stat info;
+	if (fstat(file, &info) != 0)
+	{
+		close(file);
+		throw std::runtime_error("Unable to read the size of " + filename);
+	}
+	size = (size_t)info.st_size;
+
+	// Empty files can't be mapped
+	if (size == 0)
+	{
+		close(file);
+		return;
+	}
+
+	// Map the file - the mapping remains valid after the file is closed
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (mapping == MAP_FAILED)
+	{
+		throw std::runtime_error("Unable to map file " + filename);
+	}
+	data = (const unsigned char*)mapping;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mapping != nullptr)
+	{
+		CloseHandle(mapping);
+	}
+	if (file != nullptr)
+	{
+		CloseHandle(file);
+	}
+#else
+	if (data != nullptr)
+	{
+		munmap((void*)data, size);
+	}
+#endif
+}
+
+const unsigned char* MappedFile::getData() const
+{
+	return data;
+}
+
+size_t MappedFile::getSize() const
+{
+	return size;
+}
\ No newline at end of file
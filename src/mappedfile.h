@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// A read-only memory mapping of an entire file
+class MappedFile
+{
+public:
+	// Map a file into memory
+	// (THROWS runtime_error if the file cannot be opened or mapped)
+	MappedFile(const std::string& filename);
+	MappedFile(const MappedFile& copy) = delete;
+	~MappedFile();
+
+	MappedFile& operator=(const MappedFile& copy) = delete;
+
+	// Get a pointer to the start of the file's contents
+	const unsigned char* getData() const;
+	// Get the size of the file in bytes
+	size_t getSize() const;
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,380 @@
+#include "mesh.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+// Where a triangle is relative to the area covered by a heightmap
+enum class Overlap
+{
+	Inside,
+	Outside,
+	Crossing
+};
+
+/*
+ * Find where a triangle of the mesh grid is relative to the heightmap, which covers [0, width_x - 1] by [0, width_y - 1]
+ *
+ * The edges of the triangles are all horizontal, vertical or diagonal, so they are separated from the heightmap
+ * if they are separated along one of those four axes. Triangles that only touch the edge are outside.
+ */
+static Overlap getOverlap(unsigned width_x, unsigned width_y, int ax, int ay, int bx, int by, int cx, int cy)
+{
+	int max_x = (int)width_x - 1;
+	int max_y = (int)width_y - 1;
+	if (ax <= max_x && ay <= max_y && bx <= max_x && by <= max_y && cx <= max_x && cy <= max_y)
+	{
+		return Overlap::Inside;
+	}
+
+	// Triangles never extend below 0, so only the far side of each axis needs to be checked
+	if (std::min({ ax, bx, cx }) >= max_x || std::min({ ay, by, cy }) >= max_y ||
+		std::min({ ax + ay, bx + by, cx + cy }) >= max_x + max_y ||
+		std::min({ ax - ay, bx - by, cx - cy }) >= max_x || std::max({ ax - ay, bx - by, cx - cy }) <= -max_y)
+	{
+		return Overlap::Outside;
+	}
+	return Overlap::Crossing;
+}
+
+template <class T>
+MeshErrors::MeshErrors(const BasicHeightmap<T>& map, float _scale)
+{
+	width_x = map.getWidthX();
+	width_y = map.getWidthY();
+	if (width_x < 2 || width_y < 2)
+	{
+		throw std::logic_error("Meshes can only be built from heightmaps of at least 2x2 cells");
+	}
+	scale = _scale > 0.0f ? _scale : (float)std::min(width_x, width_y);
+
+	// Find the smallest grid of 2^n + 1 vertices that covers the heightmap
+	unsigned tile_size = 1;
+	while (tile_size < width_x - 1 || tile_size < width_y - 1)
+	{
+		tile_size *= 2;
+	}
+	grid_size = tile_size + 1;
+	errors.assign((size_t)grid_size * grid_size, 0.0f);
+
+	// Vertices outside the heightmap repeat the nearest edge, but are only used by triangles that are always split
+	auto getHeight = [&](int x, int y)
+	{
+		return map.getHeight(std::min((unsigned)x, width_x - 1), std::min((unsigned)y, width_y - 1)) * scale;
+	};
+
+	// Set the error of the midpoint of the hypotenuse from m - h to m + h, shared by the triangles on either side of it
+	auto setError = [&](int mx, int my, int hx, int hy)
+	{
+		int ax = mx - hx;
+		int ay = my - hy;
+		int bx = mx + hx;
+		int by = my + hy;
+		float error = std::fabs((getHeight(ax, ay) + getHeight(bx, by)) * 0.5f - getHeight(mx, my));
+
+		for (int side = -1; side <= 1; side += 2)
+		{
+			int cx = mx - side * hy;
+			int cy = my + side * hx;
+			if (cx < 0 || cy < 0 || cx >= (int)grid_size || cy >= (int)grid_size)
+			{
+				continue;
+			}
+
+			if (getOverlap(width_x, width_y, ax, ay, bx, by, cx, cy) == Overlap::Crossing)
+			{
+				error = std::numeric_limits<float>::infinity();
+			}
+
+			// Include the errors of the midpoints of both legs, unless the triangle is one of the smallest
+			if (std::abs(hx) + std::abs(hy) > 1)
+			{
+				error = std::max(error, errors[(size_t)((ay + cy) / 2) * grid_size + (ax + cx) / 2]);
+				error = std::max(error, errors[(size_t)((by + cy) / 2) * grid_size + (bx + cx) / 2]);
+			}
+		}
+		errors[(size_t)my * grid_size + mx] = error;
+	};
+
+	// Work from the smallest triangles up, so that the errors of the midpoints below each level are known
+	// Each level only reads the level below it, so the rows of each level can be processed by different threads
+	for (unsigned step = 1; step < tile_size; step *= 2)
+	{
+		// Triangles with a horizontal or vertical hypotenuse of length 2 * step
+		parallelFor(tile_size / step + 1, [&](unsigned row, unsigned thread)
+		{
+			int y = row * step;
+			if (row % 2 == 1)
+			{
+				for (int x = 0; x < (int)grid_size; x += 2 * step)
+				{
+					setError(x, y, 0, step);
+				}
+			}
+			else
+			{
+				for (int x = step; x < (int)grid_size; x += 2 * step)
+				{
+					setError(x, y, step, 0);
+				}
+			}
+		});
+
+		// Triangles with a diagonal hypotenuse across a square of 2 * step cells
+		parallelFor(tile_size / (2 * step), [&](unsigned row, unsigned thread)
+		{
+			int y = (2 * row + 1) * step;
+			for (int x = step; x < (int)grid_size; x += 2 * step)
+			{
+				// Each square is split along the diagonal between its corners with matching parity at this level
+				bool parity_x = ((x + step) / (2 * step)) % 2 == 1;
+				bool parity_y = ((y + step) / (2 * step)) % 2 == 1;
+				setError(x, y, step, parity_x == parity_y ? step : -(int)step);
+			}
+		});
+	}
+}
+
+float MeshErrors::getScale() const
+{
+	return scale;
+}
+
+float MeshErrors::getMaxError() const
+{
+	// Midpoints forced to split by the edge of the heightmap have an infinite error, so they are skipped
+	float error = 0.0f;
+	for (unsigned y = 0; y < width_y; ++y)
+	{
+		for (unsigned x = 0; x < width_x; ++x)
+		{
+			float e = errors[(size_t)y * grid_size + x];
+			if (e != std::numeric_limits<float>::infinity())
+			{
+				error = std::max(error, e);
+			}
+		}
+	}
+	return error;
+}
+
+template <class T>
+void MeshErrors::extract(const BasicHeightmap<T>& map, TerrainMesh& mesh, float max_error, const Vectormap* normals) const
+{
+	if (map.getWidthX() != width_x || map.getWidthY() != width_y)
+	{
+		throw std::logic_error("The heightmap doesn't match the size of the mesh errors");
+	}
+	if (normals != nullptr && (normals->getWidthX() != width_x || normals->getWidthY() != width_y))
+	{
+		throw std::logic_error("The normals don't match the size of the mesh errors");
+	}
+
+	mesh.positions.clear();
+	mesh.normals.clear();
+	mesh.indices.clear();
+	std::unordered_map<uint32_t, uint32_t> vertices;
+
+	// Get the index of the vertex at a grid location, adding it to the mesh the first time it is used
+	auto addVertex = [&](int x, int y)
+	{
+		auto found = vertices.emplace((uint32_t)(y * grid_size + x), (uint32_t)vertices.size());
+		if (found.second)
+		{
+			mesh.positions.push_back((float)x);
+			mesh.positions.push_back(map.getHeight(x, y) * scale);
+			mesh.positions.push_back((float)y);
+			if (normals != nullptr)
+			{
+				// Normals point along +z with +y towards the top of the heightmap, while the mesh z increases down the
+				// heightmap, so the normal's y is flipped
+				Vector3 normal = normals->getVector(x, y);
+				mesh.normals.push_back(normal.x);
+				mesh.normals.push_back(normal.z);
+				mesh.normals.push_back(-normal.y);
+			}
+		}
+		return found.first->second;
+	};
+
+	// Split triangles until their midpoint error is small enough, where a to b is the hypotenuse
+	auto process = [&](int ax, int ay, int bx, int by, int cx, int cy, auto& process) -> void
+	{
+		if (getOverlap(width_x, width_y, ax, ay, bx, by, cx, cy) == Overlap::Outside)
+		{
+			return;
+		}
+
+		int mx = (ax + bx) / 2;
+		int my = (ay + by) / 2;
+		if (std::abs(ax - cx) + std::abs(ay - cy) > 1 && errors[(size_t)my * grid_size + mx] > max_error)
+		{
+			process(cx, cy, ax, ay, mx, my, process);
+			process(bx, by, cx, cy, mx, my, process);
+			return;
+		}
+
+		// Wind the triangle anticlockwise when seen from above, where +y in the grid is towards the viewer
+		if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) > 0)
+		{
+			std::swap(bx, cx);
+			std::swap(by, cy);
+		}
+		mesh.indices.push_back(addVertex(ax, ay));
+		mesh.indices.push_back(addVertex(bx, by));
+		mesh.indices.push_back(addVertex(cx, cy));
+	};
+
+	int tile_size = grid_size - 1;
+	process(0, 0, tile_size, tile_size, tile_size, 0, process);
+	process(tile_size, tile_size, 0, 0, 0, tile_size, process);
+}
+
+///
+/// Mesh files
+///
+
+void MapMesh::saveOBJ(const TerrainMesh& mesh, const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Unable to create file " + filename);
+	}
+
+	for (size_t i = 0; i + 2 < mesh.positions.size(); i += 3)
+	{
+		fprintf(file, "v %g %g %g\n", mesh.positions[i], mesh.positions[i + 1], mesh.positions[i + 2]);
+	}
+	for (size_t i = 0; i + 2 < mesh.normals.size(); i += 3)
+	{
+		fprintf(file, "vn %g %g %g\n", mesh.normals[i], mesh.normals[i + 1], mesh.normals[i + 2]);
+	}
+
+	// OBJ indices start from 1
+	bool has_normals = !mesh.normals.empty();
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		uint32_t a = mesh.indices[i] + 1;
+		uint32_t b = mesh.indices[i + 1] + 1;
+		uint32_t c = mesh.indices[i + 2] + 1;
+		if (has_normals)
+		{
+			fprintf(file, "f %u//%u %u//%u %u//%u\n", a, a, b, b, c, c);
+		}
+		else
+		{
+			fprintf(file, "f %u %u %u\n", a, b, c);
+		}
+	}
+
+	bool written = !ferror(file);
+	if (fclose(file) != 0 || !written)
+	{
+		throw std::runtime_error("Unable to write file " + filename);
+	}
+}
+
+// Write 32 bit values to a file in little-endian order
+static bool writeLittleEndian(FILE* file, const void* data, size_t count)
+{
+#ifndef BIGENDIAN
+	return fwrite(data, 4, count, file) == count;
+#else
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < count; ++i)
+	{
+		unsigned char value[4] = { bytes[i * 4 + 3], bytes[i * 4 + 2], bytes[i * 4 + 1], bytes[i * 4] };
+		if (fwrite(value, 1, 4, file) != 4)
+		{
+			return false;
+		}
+	}
+	return true;
+#endif
+}
+
+void MapMesh::saveGLB(const TerrainMesh& mesh, const std::string& filename)
+{
+	// The binary chunk holds the positions, then the indices, then the normals
+	uint32_t vertex_count = (uint32_t)(mesh.positions.size() / 3);
+	uint32_t positions_size = (uint32_t)(mesh.positions.size() * sizeof(float));
+	uint32_t indices_size = (uint32_t)(mesh.indices.size() * sizeof(uint32_t));
+	uint32_t normals_size = (uint32_t)(mesh.normals.size() * sizeof(float));
+	uint32_t binary_size = positions_size + indices_size + normals_size;
+
+	// The position accessor needs the bounds of the mesh
+	float min[3] = { 0.0f, 0.0f, 0.0f };
+	float max[3] = { 0.0f, 0.0f, 0.0f };
+	for (uint32_t i = 0; i < vertex_count; ++i)
+	{
+		for (unsigned axis = 0; axis < 3; ++axis)
+		{
+			float value = mesh.positions[i * 3 + axis];
+			min[axis] = i == 0 ? value : std::min(min[axis], value);
+			max[axis] = i == 0 ? value : std::max(max[axis], value);
+		}
+	}
+
+	std::ostringstream json;
+	json.precision(9);
+	json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"heightmap\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],";
+	json << "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0";
+	if (normals_size > 0)
+	{
+		json << ",\"NORMAL\":2";
+	}
+	json << "},\"indices\":1}]}],";
+	json << "\"buffers\":[{\"byteLength\":" << binary_size << "}],";
+	json << "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << positions_size << ",\"target\":34962},";
+	json << "{\"buffer\":0,\"byteOffset\":" << positions_size << ",\"byteLength\":" << indices_size << ",\"target\":34963}";
+	if (normals_size > 0)
+	{
+		json << ",{\"buffer\":0,\"byteOffset\":" << positions_size + indices_size << ",\"byteLength\":" << normals_size << ",\"target\":34962}";
+	}
+	json << "],\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":" << vertex_count << ",\"type\":\"VEC3\",";
+	json << "\"min\":[" << min[0] << "," << min[1] << "," << min[2] << "],\"max\":[" << max[0] << "," << max[1] << "," << max[2] << "]},";
+	json << "{\"bufferView\":1,\"componentType\":5125,\"count\":" << mesh.indices.size() << ",\"type\":\"SCALAR\"}";
+	if (normals_size > 0)
+	{
+		json << ",{\"bufferView\":2,\"componentType\":5126,\"count\":" << vertex_count << ",\"type\":\"VEC3\"}";
+	}
+	json << "]}";
+
+	// Chunks must be padded to a multiple of 4 bytes, with spaces for the JSON chunk
+	std::string json_chunk = json.str();
+	json_chunk.append((4 - json_chunk.size() % 4) % 4, ' ');
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Unable to create file " + filename);
+	}
+
+	uint32_t header[5] = { 0x46546C67, 2, (uint32_t)(12 + 8 + json_chunk.size() + 8 + binary_size), (uint32_t)json_chunk.size(), 0x4E4F534A };
+	uint32_t binary_header[2] = { binary_size, 0x004E4942 };
+	bool written = writeLittleEndian(file, header, 5) &&
+		fwrite(json_chunk.data(), 1, json_chunk.size(), file) == json_chunk.size() &&
+		writeLittleEndian(file, binary_header, 2) &&
+		writeLittleEndian(file, mesh.positions.data(), mesh.positions.size()) &&
+		writeLittleEndian(file, mesh.indices.data(), mesh.indices.size()) &&
+		writeLittleEndian(file, mesh.normals.data(), mesh.normals.size());
+
+	if (fclose(file) != 0 || !written)
+	{
+		throw std::runtime_error("Unable to write file " + filename);
+	}
+}
+
+// Instantiate the mesh functions for each heightmap storage type
+template MeshErrors::MeshErrors(const BasicHeightmap<float>&, float);
+template MeshErrors::MeshErrors(const BasicHeightmap<fixed16>&, float);
+template MeshErrors::MeshErrors(const BasicHeightmap<half>&, float);
+template void MeshErrors::extract(const BasicHeightmap<float>&, TerrainMesh&, float, const Vectormap*) const;
+template void MeshErrors::extract(const BasicHeightmap<fixed16>&, TerrainMesh&, float, const Vectormap*) const;
+template void MeshErrors::extract(const BasicHeightmap<half>&, TerrainMesh&, float, const Vectormap*) const;
\ No newline at end of file
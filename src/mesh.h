@@ -0,0 +1,82 @@
+#pragma once
+
+#include "heightmap.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * A triangle mesh of a heightmap, with the y axis pointing up and one unit for each cell
+ *
+ * positions:	Three floats for each vertex - the x position, the scaled height and the y position
+ * normals:		Three floats for each vertex in the same space as the positions, or empty if the mesh has no normals
+ * indices:		Three vertex indices for each triangle, wound anticlockwise when seen from above
+ */
+struct TerrainMesh
+{
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<uint32_t> indices;
+};
+
+/*
+ * The error of each vertex of a right-triangulated irregular network (RTIN) covering a heightmap
+ *
+ * The heightmap is covered by a square grid of 2^n + 1 vertices, which is split into right triangles by repeatedly
+ * splitting the hypotenuse of each triangle at its midpoint. The error stored at a midpoint is the largest height
+ * difference between the heightmap and the triangles that skip it or any of the midpoints below it, so a mesh is
+ * extracted by only splitting triangles whose midpoint error is above the allowed error.
+ * Triangles crossing the edge of a heightmap that isn't 2^n + 1 cells wide are always split, and triangles outside it
+ * are dropped, so the mesh follows the edge of the heightmap exactly.
+ *
+ * Errors are measured in the same units as the mesh positions, so a renderer can choose the allowed error from the
+ * largest screen-space error it accepts and the distance the mesh is viewed from.
+ */
+class MeshErrors
+{
+public:
+	/*
+	 * Calculate the error of each vertex one level of the triangle hierarchy at a time, across multiple threads
+	 *
+	 * scale:	The mesh height of a height of 1, or 0 to use the smaller dimension of the heightmap, which matches
+	 *			the default scale of calculateNormals
+	 * (THROWS logic_error if the heightmap is smaller than 2x2)
+	 */
+	template <class T>
+	MeshErrors(const BasicHeightmap<T>& map, float scale = 0.0f);
+
+	// Get the mesh height of a height of 1
+	float getScale() const;
+	// Get the largest error of any vertex inside the heightmap
+	float getMaxError() const;
+
+	/*
+	 * Build the mesh where every vertex that is left out has an error of at most max_error
+	 * (the error is measured at vertices against the edges that skip them, so the surface between vertices can differ
+	 * from the heightmap by somewhat more)
+	 *
+	 * map:		The heightmap the errors were calculated from
+	 * normals:	The normals from calculateNormals to add to the vertices, or nullptr to leave them out
+	 * (THROWS logic_error if the heightmap or normals aren't the size the errors were calculated for)
+	 */
+	template <class T>
+	void extract(const BasicHeightmap<T>& map, TerrainMesh& mesh, float max_error, const Vectormap* normals = nullptr) const;
+
+private:
+	std::vector<float> errors;
+	unsigned grid_size = 0;
+	unsigned width_x = 0;
+	unsigned width_y = 0;
+	float scale = 0.0f;
+};
+
+namespace MapMesh
+{
+	// Save a mesh as a Wavefront OBJ file
+	// (THROWS runtime_error if the file can't be written)
+	void saveOBJ(const TerrainMesh& mesh, const std::string& filename);
+	// Save a mesh as a binary glTF 2.0 file (.glb)
+	// (THROWS runtime_error if the file can't be written)
+	void saveGLB(const TerrainMesh& mesh, const std::string& filename);
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "parallel.h"
+#include "trace.h"
+
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// The number of threads requested, or 0 to match the hardware
+static unsigned thread_count = 0;
+
+unsigned getThreadCount()
+{
+	if (thread_count == 0)
+	{
+		unsigned hardware = std::thread::hardware_concurrency();
+		return hardware > 0 ? hardware : 1;
+	}
+	return thread_count;
+}
+
+void setThreadCount(unsigned count)
+{
+	thread_count = count;
+}
+
+void parallelFor(unsigned count, const std::function<void(unsigned index, unsigned thread)>& task)
+{
+	unsigned threads = getThreadCount();
+	if (threads > count)
+	{
+		threads = count;
+	}
+
+	// Run small jobs on the calling thread
+	if (threads <= 1)
+	{
+		for (unsigned i = 0; i < count; ++i)
+		{
+			task(i, 0);
+		}
+		return;
+	}
+
+	// Each thread takes the next unclaimed work item until none are left
+	std::atomic<unsigned> next(0);
+	auto worker = [&](unsigned thread)
+	{
+		// Spans from new threads are shown under their index, while the calling thread keeps its own
+		if (thread != 0)
+		{
+			Trace::setThread(thread);
+		}
+		for (unsigned i = next++; i < count; i = next++)
+		{
+			task(i, thread);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned t = 1; t < threads; ++t)
+	{
+		workers.emplace_back(worker, t);
+	}
+	worker(0);
+
+	for (std::thread& thread : workers)
+	{
+		thread.join();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <functional>
+
+// Get the number of threads used for parallel work
+unsigned getThreadCount();
+// Set the number of threads used for parallel work - 0 uses one thread per hardware thread
+void setThreadCount(unsigned count);
+
+/*
+ * Run a task for each index in [0, count) across multiple threads
+ *
+ * task:	Called with the index of the work item and the index of the thread running it (less than getThreadCount())
+ *			Work items are handed out in order as threads become free
+ */
+void parallelFor(unsigned count, const std::function<void(unsigned index, unsigned thread)>& task);
\ No newline at end of file
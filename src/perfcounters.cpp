@@ -0,0 +1,180 @@
+#include "perfcounters.h"
+
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool PerfCounters::enabled = false;
+
+namespace
+{
+	constexpr size_t event_count = (size_t)PerfEvent::Count;
+
+	const char* event_names[event_count] = { "cycles", "instructions", "L1 misses", "LLC misses", "branch misses" };
+
+	// The counts of a finished stage
+	struct StageCount
+	{
+		const char* name;
+		double pixels;
+		PerfSample counts;
+	};
+
+	int counters[event_count] = { -1, -1, -1, -1, -1 };
+	int open_error = 0;		// The error from the first counter that failed to open
+	std::vector<StageCount> stages;
+
+#ifdef __linux__
+	// Open a counter for the calling process and every thread it starts afterwards, returning -1 if it can't be counted
+	int openCounter(uint32_t type, uint64_t config)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		int counter = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (counter < 0 && open_error == 0)
+		{
+			open_error = errno;
+		}
+		return counter;
+	}
+
+	uint64_t getCacheMiss(uint64_t cache)
+	{
+		return cache | ((uint64_t)PERF_COUNT_HW_CACHE_OP_READ << 8) | ((uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	}
+#endif
+
+	// Get a count per output pixel for the summary, or n/a if it wasn't counted
+	std::string perPixel(int64_t count, double pixels)
+	{
+		if (count < 0)
+		{
+			return "n/a";
+		}
+		std::ostringstream text;
+		text << std::fixed << std::setprecision(3) << count / std::max(pixels, 1.0);
+		return text.str();
+	}
+}
+
+bool PerfCounters::enable(std::string& error)
+{
+#ifdef __linux__
+	counters[(size_t)PerfEvent::Cycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	counters[(size_t)PerfEvent::Instructions] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	counters[(size_t)PerfEvent::L1Misses] = openCounter(PERF_TYPE_HW_CACHE, getCacheMiss(PERF_COUNT_HW_CACHE_L1D));
+	counters[(size_t)PerfEvent::LLCMisses] = openCounter(PERF_TYPE_HW_CACHE, getCacheMiss(PERF_COUNT_HW_CACHE_LL));
+	counters[(size_t)PerfEvent::BranchMisses] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+	bool any = false;
+	for (size_t i = 0; i < event_count; ++i)
+	{
+		any = any || counters[i] >= 0;
+	}
+	if (!any)
+	{
+		error = std::string("perf_event_open failed: ") + strerror(open_error);
+		if (open_error == EACCES || open_error == EPERM)
+		{
+			error += " (check /proc/sys/kernel/perf_event_paranoid)";
+		}
+		return false;
+	}
+
+	enabled = true;
+	return true;
+#else
+	error = "Hardware performance counters are only supported on Linux";
+	return false;
+#endif
+}
+
+PerfSample PerfCounters::read()
+{
+	PerfSample sample;
+	for (size_t i = 0; i < event_count; ++i)
+	{
+		sample.values[i] = -1;
+#ifdef __linux__
+		// value, time enabled, time running
+		uint64_t data[3];
+		if (counters[i] >= 0 && ::read(counters[i], data, sizeof(data)) == sizeof(data))
+		{
+			// Scale up counts from events that had to share a hardware counter with others
+			double scale = data[2] > 0 ? (double)data[1] / data[2] : 0.0;
+			sample.values[i] = data[2] > 0 ? (int64_t)(data[0] * scale) : -1;
+		}
+#endif
+	}
+	return sample;
+}
+
+void PerfCounters::record(const char* stage, const PerfSample& start, const PerfSample& end, double pixels)
+{
+	StageCount count = { stage, pixels, {} };
+	for (size_t i = 0; i < event_count; ++i)
+	{
+		count.counts.values[i] = start.values[i] >= 0 && end.values[i] >= 0 ? end.values[i] - start.values[i] : -1;
+	}
+	stages.push_back(count);
+}
+
+void PerfCounters::printSummary(std::ostream& out)
+{
+	out << "\n" << std::left << std::setw(24) << "Stage" << std::right << std::setw(8) << "IPC";
+	for (size_t i = 0; i < event_count; ++i)
+	{
+		out << std::setw(18) << std::string(event_names[i]) + "/px";
+	}
+	out << "\n";
+
+	for (const StageCount& stage : stages)
+	{
+		int64_t cycles = stage.counts.get(PerfEvent::Cycles);
+		int64_t instructions = stage.counts.get(PerfEvent::Instructions);
+		std::string ipc = "n/a";
+		if (cycles > 0 && instructions >= 0)
+		{
+			std::ostringstream text;
+			text << std::fixed << std::setprecision(2) << (double)instructions / cycles;
+			ipc = text.str();
+		}
+
+		out << std::left << std::setw(24) << stage.name << std::right << std::setw(8) << ipc;
+		for (size_t i = 0; i < event_count; ++i)
+		{
+			out << std::setw(18) << perPixel(stage.counts.values[i], stage.pixels);
+		}
+		out << "\n";
+	}
+
+	// Say which events couldn't be counted so the n/a columns aren't mistaken for zero
+	std::string missing;
+	for (size_t i = 0; i < event_count; ++i)
+	{
+		if (counters[i] < 0)
+		{
+			missing += missing.empty() ? event_names[i] : std::string(", ") + event_names[i];
+		}
+	}
+	if (!missing.empty())
+	{
+		out << "Unavailable: " << missing << "\n";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+// The hardware events counted for each pipeline stage
+enum class PerfEvent
+{
+	Cycles,
+	Instructions,
+	L1Misses,		// Level 1 data cache read misses
+	LLCMisses,		// Last level cache read misses
+	BranchMisses,
+	Count
+};
+
+// Running totals of each hardware event, with -1 for events that can't be counted
+struct PerfSample
+{
+	int64_t values[(size_t)PerfEvent::Count];
+
+	int64_t get(PerfEvent event) const
+	{
+		return values[(size_t)event];
+	}
+};
+
+/*
+ * Hardware performance counters for the whole process, read with perf_event_open on Linux
+ *
+ * Counters are inherited by threads created after they are opened, so work done by parallelFor is counted too. Events
+ * that can't be counted, because of the platform, a virtual machine or perf_event_paranoid, are reported as unavailable
+ * rather than failing.
+ */
+namespace PerfCounters
+{
+	// Set to true while stages are being counted
+	extern bool enabled;
+
+	// Open a counter for each event
+	// Returns false with the reason in error if none of the events can be counted
+	bool enable(std::string& error);
+	// Get the current totals of each event
+	PerfSample read();
+	// Record the events counted over a stage, which produced the given number of output pixels
+	void record(const char* stage, const PerfSample& start, const PerfSample& end, double pixels);
+
+	// Print the IPC and the events per output pixel of each recorded stage
+	void printSummary(std::ostream& out);
+}
+
+// Counts hardware events between its construction and destruction as a stage if counters are enabled
+// The name must outlive the counters, so it should be a string literal
+class PerfStage
+{
+public:
+	PerfStage(const char* _name, double _pixels) : name(_name), pixels(_pixels)
+	{
+		if (PerfCounters::enabled)
+		{
+			start = PerfCounters::read();
+		}
+	}
+	~PerfStage()
+	{
+		if (PerfCounters::enabled)
+		{
+			PerfCounters::record(name, start, PerfCounters::read(), pixels);
+		}
+	}
+
+	PerfStage(const PerfStage&) = delete;
+	PerfStage& operator=(const PerfStage&) = delete;
+
+private:
+	const char* name;
+	double pixels;
+	PerfSample start;
+};
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include "query.h"
+#include "simd.h"
+
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+// The number of points each task samples
+constexpr unsigned query_batch_size = 256;
+// The number of samples interpolated at once, which bounds the cells gathered on the stack
+constexpr unsigned query_group_size = 64;
+
+namespace
+{
+	// Get the order to sample points in, grouped by the tile they are in if sort is set
+	std::vector<unsigned> getQueryOrder(const std::vector<Vector2>& points, unsigned width_x, unsigned width_y, bool sort)
+	{
+		std::vector<unsigned> order(points.size());
+		if (!sort)
+		{
+			std::iota(order.begin(), order.end(), 0u);
+			return order;
+		}
+
+		// Find the tile of each point, grouping points outside the heightmap with the nearest tile on its edge
+		unsigned tiles_x = (width_x + heightmap_tile_size - 1) / heightmap_tile_size;
+		unsigned tiles_y = (width_y + heightmap_tile_size - 1) / heightmap_tile_size;
+		float max_x = (float)(std::max(width_x, 1u) - 1);
+		float max_y = (float)(std::max(width_y, 1u) - 1);
+		std::vector<unsigned> tiles(points.size());
+		std::vector<unsigned> tile_start((size_t)tiles_x * tiles_y + 1, 0);
+		for (size_t i = 0; i < points.size(); ++i)
+		{
+			unsigned x = (unsigned)std::min(std::max(points[i].x, 0.0f), max_x) / heightmap_tile_size;
+			unsigned y = (unsigned)std::min(std::max(points[i].y, 0.0f), max_y) / heightmap_tile_size;
+			tiles[i] = y * tiles_x + x;
+			tile_start[tiles[i] + 1]++;
+		}
+
+		// Counting sort, which keeps the points in each tile in the order they were given
+		std::partial_sum(tile_start.begin(), tile_start.end(), tile_start.begin());
+		for (size_t i = 0; i < points.size(); ++i)
+		{
+			order[tile_start[tiles[i]]++] = (unsigned)i;
+		}
+		return order;
+	}
+
+	/*
+	 * Run a query in batches across multiple threads
+	 *
+	 * sample(x, y, count, heights) writes the heights at count positions, where count is at most 5 * query_batch_size
+	 * When normals are needed each batch also samples the points one cell either side of each point in x and y
+	 */
+	template <class F>
+	void runQuery(const std::vector<Vector2>& points, std::vector<float>& heights, std::vector<Vector3>* normals, unsigned width_x, unsigned width_y,
+		const QuerySettings& settings, F sample)
+	{
+		unsigned count = (unsigned)points.size();
+		heights.resize(count);
+		if (normals != nullptr)
+		{
+			normals->resize(count);
+		}
+
+		// Use the same height scale as calculateNormals
+		float scale = settings.scale;
+		if (scale <= 0.0f)
+		{
+			scale = (float)std::min(width_x, width_y);
+		}
+		float half_scale = scale * 0.5f;
+
+		std::vector<unsigned> order = getQueryOrder(points, width_x, width_y, settings.sort);
+		unsigned batches = (count + query_batch_size - 1) / query_batch_size;
+		parallelFor(batches, [&](unsigned batch, unsigned thread)
+		{
+			TraceSpan span("Query batch");
+			unsigned start = batch * query_batch_size;
+			unsigned size = std::min(count - start, query_batch_size);
+
+			// Gather the positions of the batch, followed by the positions either side of them for normals
+			float x[query_batch_size * 5];
+			float y[query_batch_size * 5];
+			float result[query_batch_size * 5];
+			unsigned samples = normals != nullptr ? size * 5 : size;
+			for (unsigned i = 0; i < size; ++i)
+			{
+				Vector2 point = points[order[start + i]];
+				x[i] = point.x;
+				y[i] = point.y;
+				if (normals != nullptr)
+				{
+					x[size + i] = point.x - 1.0f;
+					y[size + i] = point.y;
+					x[size * 2 + i] = point.x + 1.0f;
+					y[size * 2 + i] = point.y;
+					x[size * 3 + i] = point.x;
+					y[size * 3 + i] = point.y - 1.0f;
+					x[size * 4 + i] = point.x;
+					y[size * 4 + i] = point.y + 1.0f;
+				}
+			}
+			sample(x, y, samples, result);
+
+			// Write the results back in the order the points were given
+			for (unsigned i = 0; i < size; ++i)
+			{
+				unsigned index = order[start + i];
+				heights[index] = result[i];
+				if (normals != nullptr)
+				{
+					float gradient_x = (result[size * 2 + i] - result[size + i]) * half_scale;
+					float gradient_y = (result[size * 4 + i] - result[size * 3 + i]) * half_scale;
+
+					// Get tangents in the x and y directions, where y points down the heightmap
+					Vector3 vx = normalize(Vector3(1.0f, 0, gradient_x));
+					Vector3 vy = normalize(Vector3(0, 1.0f, -gradient_y));
+					(*normals)[index] = cross(vx, vy);
+				}
+			}
+		});
+	}
+
+	// Read the size by size block of cells around each position, starting first cells before the cell containing it,
+	// where cells[j * size + i][k] is cell (i, j) of the block for position k and tx, ty are the positions within the cell
+	template <class T>
+	void gatherCells(const BasicHeightmap<T>& map, BorderPolicy border, const float* x, const float* y, unsigned count, int first, unsigned size,
+		float* tx, float* ty, float (*cells)[query_group_size])
+	{
+		const T* data = map.getData();
+		unsigned width_x = map.getWidthX();
+		unsigned width_y = map.getWidthY();
+		for (unsigned k = 0; k < count; ++k)
+		{
+			float fx = std::floor(x[k]);
+			float fy = std::floor(y[k]);
+			tx[k] = x[k] - fx;
+			ty[k] = y[k] - fy;
+
+			unsigned columns[4];
+			for (unsigned i = 0; i < size; ++i)
+			{
+				columns[i] = borderIndex((int)fx - first + (int)i, width_x, border);
+			}
+			for (unsigned j = 0; j < size; ++j)
+			{
+				const T* row = data + (size_t)borderIndex((int)fy - first + (int)j, width_y, border) * width_x;
+				for (unsigned i = 0; i < size; ++i)
+				{
+					cells[j * size + i][k] = HeightStorage<T>::load(row[columns[i]]);
+				}
+			}
+		}
+	}
+
+	// Blend the four cells around each position
+	void blendBilinear(const float* tx, const float* ty, float (*cells)[query_group_size], unsigned count, float* heights)
+	{
+		unsigned k = 0;
+
+#ifdef USE_SSE2
+		// Blend four positions at a time
+		for (; k + 4 <= count; k += 4)
+		{
+			__m128 vx = _mm_loadu_ps(tx + k);
+			__m128 vy = _mm_loadu_ps(ty + k);
+			__m128 h00 = _mm_loadu_ps(cells[0] + k);
+			__m128 h10 = _mm_loadu_ps(cells[1] + k);
+			__m128 h01 = _mm_loadu_ps(cells[2] + k);
+			__m128 h11 = _mm_loadu_ps(cells[3] + k);
+			__m128 top = _mm_add_ps(h00, _mm_mul_ps(vx, _mm_sub_ps(h10, h00)));
+			__m128 bottom = _mm_add_ps(h01, _mm_mul_ps(vx, _mm_sub_ps(h11, h01)));
+			_mm_storeu_ps(heights + k, _mm_add_ps(top, _mm_mul_ps(vy, _mm_sub_ps(bottom, top))));
+		}
+#endif
+
+		// Blend any remaining positions one at a time
+		for (; k < count; ++k)
+		{
+			float top = cells[0][k] + tx[k] * (cells[1][k] - cells[0][k]);
+			float bottom = cells[2][k] + tx[k] * (cells[3][k] - cells[2][k]);
+			heights[k] = top + ty[k] * (bottom - top);
+		}
+	}
+
+	// Get the weights of the four Catmull-Rom control points around a position t within the middle span
+	inline void getCubicWeights(float t, float w[4])
+	{
+		float t2 = t * t;
+		float t3 = t2 * t;
+		w[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+		w[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+		w[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+		w[3] = 0.5f * (t3 - t2);
+	}
+
+#ifdef USE_SSE2
+	inline void getCubicWeights4(__m128 t, __m128 w[4])
+	{
+		const __m128 half = _mm_set1_ps(0.5f);
+		__m128 t2 = _mm_mul_ps(t, t);
+		__m128 t3 = _mm_mul_ps(t2, t);
+		w[0] = _mm_mul_ps(half, _mm_sub_ps(_mm_sub_ps(_mm_add_ps(t2, t2), t3), t));
+		w[1] = _mm_mul_ps(half, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), t3), _mm_mul_ps(_mm_set1_ps(5.0f), t2)), _mm_set1_ps(2.0f)));
+		w[2] = _mm_mul_ps(half, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(4.0f), t2), _mm_mul_ps(_mm_set1_ps(3.0f), t3)), t));
+		w[3] = _mm_mul_ps(half, _mm_sub_ps(t3, t2));
+	}
+#endif
+
+	// Blend the sixteen cells around each position with a Catmull-Rom spline through each row, then through the rows
+	void blendBicubic(const float* tx, const float* ty, float (*cells)[query_group_size], unsigned count, float* heights)
+	{
+		unsigned k = 0;
+
+#ifdef USE_SSE2
+		// Blend four positions at a time
+		for (; k + 4 <= count; k += 4)
+		{
+			__m128 wx[4], wy[4];
+			getCubicWeights4(_mm_loadu_ps(tx + k), wx);
+			getCubicWeights4(_mm_loadu_ps(ty + k), wy);
+
+			__m128 height = _mm_setzero_ps();
+			for (unsigned j = 0; j < 4; ++j)
+			{
+				__m128 row = _mm_setzero_ps();
+				for (unsigned i = 0; i < 4; ++i)
+				{
+					row = _mm_add_ps(row, _mm_mul_ps(wx[i], _mm_loadu_ps(cells[j * 4 + i] + k)));
+				}
+				height = _mm_add_ps(height, _mm_mul_ps(wy[j], row));
+			}
+			_mm_storeu_ps(heights + k, height);
+		}
+#endif
+
+		// Blend any remaining positions one at a time
+		for (; k < count; ++k)
+		{
+			float wx[4], wy[4];
+			getCubicWeights(tx[k], wx);
+			getCubicWeights(ty[k], wy);
+
+			float height = 0.0f;
+			for (unsigned j = 0; j < 4; ++j)
+			{
+				float row = 0.0f;
+				for (unsigned i = 0; i < 4; ++i)
+				{
+					row += wx[i] * cells[j * 4 + i][k];
+				}
+				height += wy[j] * row;
+			}
+			heights[k] = height;
+		}
+	}
+}
+
+template <class T>
+void MapQuery::query(const BasicHeightmap<T>& map, const std::vector<Vector2>& points, std::vector<float>& heights, std::vector<Vector3>* normals, const QuerySettings& settings)
+{
+	bool bicubic = settings.filter == QueryFilter::Bicubic;
+	runQuery(points, heights, normals, map.getWidthX(), map.getWidthY(), settings, [&](const float* x, const float* y, unsigned count, float* out)
+	{
+		// Gather and blend the cells in groups, so that the gathered cells stay small enough for the stack
+		float tx[query_group_size];
+		float ty[query_group_size];
+		float cells[16][query_group_size];
+		for (unsigned start = 0; start < count; start += query_group_size)
+		{
+			unsigned size = std::min(count - start, query_group_size);
+			if (bicubic)
+			{
+				gatherCells(map, settings.border, x + start, y + start, size, 1, 4, tx, ty, cells);
+				blendBicubic(tx, ty, cells, size, out + start);
+			}
+			else
+			{
+				gatherCells(map, settings.border, x + start, y + start, size, 0, 2, tx, ty, cells);
+				blendBilinear(tx, ty, cells, size, out + start);
+			}
+		}
+	});
+}
+
+void MapQuery::query(const HeightField& field, const std::vector<Vector2>& points, std::vector<float>& heights, std::vector<Vector3>* normals, const QuerySettings& settings)
+{
+	runQuery(points, heights, normals, field.getWidthX(), field.getWidthY(), settings, [&](const float* x, const float* y, unsigned count, float* out)
+	{
+		field.sample(x, y, count, out);
+	});
+}
+
+// Instantiate the queries for each heightmap storage type
+template void MapQuery::query(const BasicHeightmap<float>&, const std::vector<Vector2>&, std::vector<float>&, std::vector<Vector3>*, const QuerySettings&);
+template void MapQuery::query(const BasicHeightmap<fixed16>&, const std::vector<Vector2>&, std::vector<float>&, std::vector<Vector3>*, const QuerySettings&);
+template void MapQuery::query(const BasicHeightmap<half>&, const std::vector<Vector2>&, std::vector<float>&, std::vector<Vector3>*, const QuerySettings&);
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "heightmap.h"
+#include "generate.h"
+
+#include <vector>
+
+// How heights between the cells of a heightmap are interpolated
+enum class QueryFilter
+{
+	Bilinear,	// Blend the four cells around the position
+	Bicubic		// Fit a Catmull-Rom spline through the sixteen cells around the position, which passes through each cell
+};
+
+/*
+ * Settings for height queries
+ *
+ * filter:	How heights between cells are interpolated (height fields sample the noise itself, so they ignore this)
+ * border:	How cells beyond the edges of a heightmap are read (height fields clamp positions to their edges instead, or repeat
+ *			themselves if they wrap)
+ * scale:	The number of cells a height of 1 is equal to when finding normals, or 0 to use the smaller dimension of the heightmap
+ * sort:	Set to true to sample the points in order of the tile they are in, which keeps the cells and lattice points
+ *			each batch reads close together when the points are scattered
+ */
+struct QuerySettings
+{
+	QueryFilter filter = QueryFilter::Bilinear;
+	BorderPolicy border = BorderPolicy::Clamp;
+	float scale = 0.0f;
+	bool sort = true;
+};
+
+/*
+ * Batched height queries at arbitrary positions, for finding heights without baking a whole heightmap
+ *
+ * Positions are in cells, where cell (x, y) of a heightmap is at (x, y). Points are split into batches that run across
+ * multiple threads, and the results are always written in the order the points were given, however they were sorted.
+ * Normals are found from the heights one cell either side of each point, the same way as calculateNormals.
+ */
+namespace MapQuery
+{
+	// Get the interpolated height of a heightmap at each point, and the normal there if normals isn't nullptr
+	template <class T>
+	void query(const BasicHeightmap<T>& map, const std::vector<Vector2>& points, std::vector<float>& heights, std::vector<Vector3>* normals = nullptr, const QuerySettings& settings = QuerySettings());
+
+	// Get the height a generator produces at each point, and the normal there if normals isn't nullptr, without generating a heightmap
+	void query(const HeightField& field, const std::vector<Vector2>& points, std::vector<float>& heights, std::vector<Vector3>* normals = nullptr, const QuerySettings& settings = QuerySettings());
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+// Enable the SSE2 code paths when the target supports them
+// (SSE2 is always available on x64, and is enabled by -msse2 or /arch:SSE2 on x86)
+#if !defined(NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef USE_SSE2
+// Round each element of a vector towards negative infinity
+inline __m128 floor4(__m128 v)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+}
+#endif
+
+// Enable hardware half precision conversions
+// (F16C is implied by AVX2 on MSVC, which does not define __F16C__)
+#if !defined(NO_SIMD) && (defined(__F16C__) || defined(__AVX2__))
+#define USE_F16C
+#include <immintrin.h>
+#endif
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "stats.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+// The number of rows measured by each work item
+constexpr unsigned stats_block_rows = 16;
+
+template <class T>
+HeightStats measureHeights(const BasicHeightmap<T>& map, unsigned bins)
+{
+	HeightStats stats;
+	unsigned width_x = map.getWidthX();
+	unsigned width_y = map.getWidthY();
+	if (width_x == 0 || width_y == 0)
+	{
+		return stats;
+	}
+
+	const T* data = map.getData();
+	unsigned blocks = (width_y + stats_block_rows - 1) / stats_block_rows;
+	unsigned threads = getThreadCount();
+
+	// Each thread keeps its own totals, which are combined once every row has been measured
+	struct Totals
+	{
+		float min = std::numeric_limits<float>::max();
+		float max = std::numeric_limits<float>::lowest();
+		double sum = 0.0;
+	};
+	std::vector<Totals> totals(threads);
+	parallelFor(blocks, [&](unsigned block, unsigned thread)
+	{
+		Totals& total = totals[thread];
+		unsigned end = std::min(width_y, (block + 1) * stats_block_rows);
+		for (unsigned y = block * stats_block_rows; y < end; ++y)
+		{
+			// Sum each row separately to limit rounding error
+			const T* row = data + (size_t)y * width_x;
+			float row_sum = 0.0f;
+			for (unsigned x = 0; x < width_x; ++x)
+			{
+				float height = HeightStorage<T>::load(row[x]);
+				total.min = std::min(total.min, height);
+				total.max = std::max(total.max, height);
+				row_sum += height;
+			}
+			total.sum += row_sum;
+		}
+	});
+
+	stats.min = std::numeric_limits<float>::max();
+	stats.max = std::numeric_limits<float>::lowest();
+	double sum = 0.0;
+	for (const Totals& total : totals)
+	{
+		stats.min = std::min(stats.min, total.min);
+		stats.max = std::max(stats.max, total.max);
+		sum += total.sum;
+	}
+	stats.mean = (float)(sum / ((double)width_x * width_y));
+
+	if (bins == 0)
+	{
+		return stats;
+	}
+
+	// Count the heights in each bin now that the range is known
+	std::vector<std::vector<uint32_t>> histograms(threads, std::vector<uint32_t>(bins, 0));
+	float bin_scale = stats.max > stats.min ? bins / (stats.max - stats.min) : 0.0f;
+	parallelFor(blocks, [&](unsigned block, unsigned thread)
+	{
+		uint32_t* histogram = histograms[thread].data();
+		unsigned end = std::min(width_y, (block + 1) * stats_block_rows);
+		for (unsigned y = block * stats_block_rows; y < end; ++y)
+		{
+			const T* row = data + (size_t)y * width_x;
+			for (unsigned x = 0; x < width_x; ++x)
+			{
+				unsigned bin = (unsigned)((HeightStorage<T>::load(row[x]) - stats.min) * bin_scale);
+				histogram[std::min(bin, bins - 1)]++;
+			}
+		}
+	});
+
+	stats.histogram.assign(bins, 0);
+	for (const std::vector<uint32_t>& histogram : histograms)
+	{
+		for (unsigned i = 0; i < bins; ++i)
+		{
+			stats.histogram[i] += histogram[i];
+		}
+	}
+	return stats;
+}
+
+HeightRemap::HeightRemap()
+{
+}
+
+HeightRemap HeightRemap::linear(const HeightStats& stats, float min, float max)
+{
+	HeightRemap remap;
+	if (stats.max > stats.min)
+	{
+		remap.scale = (max - min) / (stats.max - stats.min);
+		remap.bias = min - stats.min * remap.scale;
+	}
+	else
+	{
+		// A flat heightmap is moved to the middle of the range
+		remap.scale = 0.0f;
+		remap.bias = (min + max) * 0.5f;
+	}
+	return remap;
+}
+
+HeightRemap HeightRemap::equalise(const HeightStats& stats, float min, float max)
+{
+	if (stats.histogram.empty())
+	{
+		throw std::logic_error("Histogram equalisation requires a histogram");
+	}
+
+	// Convert heights to a position in the table of bin edges
+	unsigned bins = (unsigned)stats.histogram.size();
+	HeightRemap remap = linear(stats, 0.0f, (float)bins);
+
+	// Each bin edge maps to the fraction of heights below it
+	uint64_t total = 0;
+	for (uint32_t count : stats.histogram)
+	{
+		total += count;
+	}
+
+	remap.table.resize(bins + 1);
+	uint64_t below = 0;
+	for (unsigned i = 0; i <= bins; ++i)
+	{
+		remap.table[i] = min + (max - min) * (float)((double)below / total);
+		if (i < bins)
+		{
+			below += stats.histogram[i];
+		}
+	}
+	return remap;
+}
+
+// Instantiate the measurements for each heightmap storage type
+template HeightStats measureHeights(const BasicHeightmap<float>&, unsigned);
+template HeightStats measureHeights(const BasicHeightmap<fixed16>&, unsigned);
+template HeightStats measureHeights(const BasicHeightmap<half>&, unsigned);
\ No newline at end of file
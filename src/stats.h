@@ -0,0 +1,78 @@
+#pragma once
+
+#include "heightmap.h"
+
+#include <vector>
+#include <cstdint>
+
+/*
+ * A summary of the heights in a heightmap
+ *
+ * min, max:	The lowest and highest heights
+ * mean:		The average height
+ * histogram:	The number of heights in each of a set of equal sized bins covering [min, max]
+ */
+struct HeightStats
+{
+	float min = 0.0f;
+	float max = 0.0f;
+	float mean = 0.0f;
+	std::vector<uint32_t> histogram;
+};
+
+/*
+ * Measure the heights of a heightmap across multiple threads
+ *
+ * bins:	The number of histogram bins - if 0 the histogram is skipped, which saves a second pass over the heightmap
+ */
+template <class T>
+HeightStats measureHeights(const BasicHeightmap<T>& map, unsigned bins = 0);
+
+// A mapping from one range of heights to another, applied to single heights so it can be fused into other loops
+class HeightRemap
+{
+public:
+	// Leave heights unchanged
+	HeightRemap();
+
+	// Linearly stretch the measured range of heights to fill [min, max]
+	static HeightRemap linear(const HeightStats& stats, float min, float max);
+	// Spread heights evenly across [min, max] using the histogram, so that each output height is equally common
+	// (THROWS logic_error if the stats do not include a histogram)
+	static HeightRemap equalise(const HeightStats& stats, float min, float max);
+
+	// Remap a single height
+	float apply(float height) const;
+
+private:
+	// Linear mapping: height * scale + bias
+	float scale = 1.0f;
+	float bias = 0.0f;
+
+	// Equalisation: the output height at each histogram bin edge
+	// The input height is converted to a position in the table with the linear mapping
+	std::vector<float> table;
+};
+
+inline float HeightRemap::apply(float height) const
+{
+	float t = height * scale + bias;
+	if (table.empty())
+	{
+		return t;
+	}
+
+	// Interpolate between the bin edges either side of the height
+	unsigned last = (unsigned)table.size() - 1;
+	if (!(t > 0.0f))
+	{
+		return table[0];
+	}
+	if (t >= (float)last)
+	{
+		return table[last];
+	}
+	unsigned i = (unsigned)t;
+	float f = t - i;
+	return table[i] + (table[i + 1] - table[i]) * f;
+}
\ No newline at end of file
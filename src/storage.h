@@ -0,0 +1,152 @@
+#pragma once
+
+#include "simd.h"
+
+#include <cstdint>
+#include <cstring>
+
+// Height data stored as a 16 bit fixed point value, mapping [-1, 1] to [0, 65535]
+struct fixed16
+{
+	uint16_t bits;
+};
+
+// Height data stored as an IEEE 754 half precision float
+struct half
+{
+	uint16_t bits;
+};
+
+/*
+ * Conversions between the storage type of a heightmap and the floats used for calculations
+ *
+ * load:	Widen a stored value to a float
+ * store:	Narrow a float to the storage type
+ */
+template <class T>
+struct HeightStorage;
+
+template <>
+struct HeightStorage<float>
+{
+	static inline float load(float value)
+	{
+		return value;
+	}
+
+	static inline float store(float value)
+	{
+		return value;
+	}
+};
+
+template <>
+struct HeightStorage<fixed16>
+{
+	static inline float load(fixed16 value)
+	{
+		return value.bits * (2.0f / 65535.0f) - 1.0f;
+	}
+
+	static inline fixed16 store(float value)
+	{
+		// Clamp to the representable range and round to the nearest step
+		float scaled = (value + 1.0f) * (65535.0f / 2.0f) + 0.5f;
+		if (!(scaled > 0.0f))
+		{
+			return { 0 };
+		}
+		else if (scaled >= 65535.0f)
+		{
+			return { 65535 };
+		}
+		return { (uint16_t)scaled };
+	}
+};
+
+template <>
+struct HeightStorage<half>
+{
+	static inline float load(half value)
+	{
+#ifdef USE_F16C
+		return _cvtsh_ss(value.bits);
+#else
+		uint32_t sign = (uint32_t)(value.bits & 0x8000) << 16;
+		uint32_t exponent = (value.bits >> 10) & 0x1F;
+		uint32_t mantissa = value.bits & 0x3FF;
+		uint32_t bits;
+
+		if (exponent == 0x1F)
+		{
+			// Infinity or NaN
+			bits = sign | 0x7F800000 | (mantissa << 13);
+		}
+		else if (exponent != 0)
+		{
+			// Normal number
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+		else if (mantissa != 0)
+		{
+			// Subnormal number - normalize the mantissa
+			exponent = 113;
+			while ((mantissa & 0x400) == 0)
+			{
+				mantissa <<= 1;
+				--exponent;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+		else
+		{
+			// Zero
+			bits = sign;
+		}
+
+		float result;
+		memcpy(&result, &bits, sizeof(float));
+		return result;
+#endif
+	}
+
+	static inline half store(float value)
+	{
+#ifdef USE_F16C
+		return { _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT) };
+#else
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(float));
+
+		uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+		int exponent = (int)((bits >> 23) & 0xFF) - 112;
+		uint32_t mantissa = bits & 0x7FFFFF;
+
+		if (exponent >= 0x1F)
+		{
+			// Infinity, NaN or a value too large to represent
+			if (((bits >> 23) & 0xFF) == 0xFF && mantissa != 0)
+			{
+				return { (uint16_t)(sign | 0x7E00) };
+			}
+			return { (uint16_t)(sign | 0x7C00) };
+		}
+		else if (exponent <= 0)
+		{
+			// Subnormal or zero
+			if (exponent < -10)
+			{
+				return { sign };
+			}
+			mantissa |= 0x800000;
+			unsigned shift = 14 - exponent;
+			uint32_t rounded = (mantissa + (1u << (shift - 1)) - 1 + ((mantissa >> shift) & 1)) >> shift;
+			return { (uint16_t)(sign | rounded) };
+		}
+
+		// Normal number - round to nearest even
+		uint32_t rounded = ((uint32_t)exponent << 10 | (mantissa >> 13)) + ((mantissa & 0x1FFF) > 0x1000 || ((mantissa & 0x3FFF) == 0x3000));
+		return { (uint16_t)(sign | rounded) };
+#endif
+	}
+};
\ No newline at end of file
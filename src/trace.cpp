@@ -0,0 +1,176 @@
+#include "trace.h"
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <stdexcept>
+
+bool Trace::enabled = false;
+
+namespace
+{
+	struct Event
+	{
+		const char* name;
+		unsigned thread;
+		Trace::Clock::time_point start;
+		Trace::Clock::time_point end;
+	};
+
+	// The spans recorded by one thread
+	struct ThreadBuffer
+	{
+		std::vector<Event> events;
+	};
+
+	// Buffers are owned here rather than by their thread, as parallelFor threads finish before the trace is saved
+	std::mutex buffers_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	Trace::Clock::time_point trace_start;
+
+	thread_local ThreadBuffer* thread_buffer = nullptr;
+	thread_local unsigned thread_index = 0;
+
+	double toMicroseconds(Trace::Clock::duration duration)
+	{
+		return std::chrono::duration<double, std::micro>(duration).count();
+	}
+
+	// Add up the time covered by a set of spans, counting nested and overlapping spans once
+	Trace::Clock::duration getCoveredTime(std::vector<Event> events)
+	{
+		std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.start < b.start; });
+		Trace::Clock::duration covered(0);
+		Trace::Clock::time_point end = trace_start;
+		for (const Event& event : events)
+		{
+			if (event.end > end)
+			{
+				covered += event.end - std::max(event.start, end);
+				end = event.end;
+			}
+		}
+		return covered;
+	}
+}
+
+void Trace::enable()
+{
+	trace_start = Clock::now();
+	enabled = true;
+}
+
+void Trace::setThread(unsigned thread)
+{
+	thread_index = thread;
+}
+
+void Trace::record(const char* name, Clock::time_point start, Clock::time_point end)
+{
+	if (thread_buffer == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		buffers.push_back(std::make_unique<ThreadBuffer>());
+		thread_buffer = buffers.back().get();
+	}
+	thread_buffer->events.push_back({ name, thread_index, start, end });
+}
+
+void Trace::save(const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Unable to create file " + filename);
+	}
+
+	// Complete events, with times in microseconds from when tracing was enabled
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	unsigned max_thread = 0;
+	bool first = true;
+	for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+	{
+		for (const Event& event : buffer->events)
+		{
+			fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"hmap\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				first ? "" : ",\n", event.name, event.thread, toMicroseconds(event.start - trace_start), toMicroseconds(event.end - event.start));
+			max_thread = std::max(max_thread, event.thread);
+			first = false;
+		}
+	}
+
+	// Name the threads so the main thread is easy to find
+	fprintf(file, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"hmap\"}}", first ? "" : ",\n");
+	for (unsigned thread = 0; thread <= max_thread; ++thread)
+	{
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+			thread, thread == 0 ? "Main thread" : "Worker", thread);
+	}
+	fprintf(file, "\n]}\n");
+
+	bool written = ferror(file) == 0;
+	if (fclose(file) != 0 || !written)
+	{
+		throw std::runtime_error("Unable to write file " + filename);
+	}
+}
+
+void Trace::printSummary(std::ostream& out)
+{
+	struct SpanTotals
+	{
+		unsigned count = 0;
+		Clock::duration total = Clock::duration(0);
+		Clock::duration longest = Clock::duration(0);
+	};
+
+	// Gather the spans by name and by thread
+	std::map<std::string, SpanTotals> spans;
+	std::map<unsigned, std::vector<Event>> threads;
+	Clock::time_point end = trace_start;
+	for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+	{
+		for (const Event& event : buffer->events)
+		{
+			SpanTotals& totals = spans[event.name];
+			totals.count++;
+			totals.total += event.end - event.start;
+			totals.longest = std::max(totals.longest, event.end - event.start);
+			threads[event.thread].push_back(event);
+			end = std::max(end, event.end);
+		}
+	}
+
+	// Show the most expensive spans first
+	std::vector<std::pair<std::string, SpanTotals>> sorted(spans.begin(), spans.end());
+	std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.total > b.second.total; });
+
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+	out << "\n" << std::left << std::setw(28) << "Span" << std::right << std::setw(10) << "Count" << std::setw(14) << "Total (ms)"
+		<< std::setw(14) << "Mean (ms)" << std::setw(14) << "Max (ms)" << "\n";
+	for (const auto& span : sorted)
+	{
+		double total = toMicroseconds(span.second.total) * 1e-3;
+		out << std::left << std::setw(28) << span.first << std::right << std::setw(10) << span.second.count << std::setw(14) << total
+			<< std::setw(14) << total / span.second.count << std::setw(14) << toMicroseconds(span.second.longest) * 1e-3 << "\n";
+	}
+
+	// The share of the traced time each thread spent inside spans shows how well work was balanced
+	double traced = std::max(toMicroseconds(end - trace_start), 1.0);
+	out << "\n" << std::left << std::setw(28) << "Thread" << std::right << std::setw(10) << "Spans" << std::setw(14) << "Busy (ms)" << std::setw(14) << "Busy (%)" << "\n";
+	for (const auto& thread : threads)
+	{
+		double busy = toMicroseconds(getCoveredTime(thread.second));
+		out << std::left << std::setw(28) << thread.first << std::right << std::setw(10) << thread.second.size() << std::setw(14) << busy * 1e-3
+			<< std::setw(14) << busy / traced * 100.0 << "\n";
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+}
\ No newline at end of file
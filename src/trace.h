@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <ostream>
+
+/*
+ * Lightweight tracing of timed spans of work
+ *
+ * Each thread records spans into its own buffer, so recording never waits on a lock, and a span only checks a flag
+ * when tracing is disabled. Spans are shown under the index of the parallelFor thread that ran them.
+ */
+namespace Trace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// Set to true while spans are being recorded
+	extern bool enabled;
+
+	// Start recording spans
+	void enable();
+	// Set the thread index spans recorded by the current thread are shown under
+	void setThread(unsigned thread);
+	// Record a finished span on the current thread
+	void record(const char* name, Clock::time_point start, Clock::time_point end);
+
+	// Save every recorded span as Chrome trace JSON, which can be opened in Perfetto or chrome://tracing
+	// (THROWS runtime_error if the file can't be written)
+	void save(const std::string& filename);
+	// Print the count, total, mean and longest time of each span, and how long each thread was busy
+	void printSummary(std::ostream& out);
+}
+
+// Records the time between its construction and destruction as a span if tracing is enabled
+// The name must outlive the trace, so it should be a string literal
+class TraceSpan
+{
+public:
+	TraceSpan(const char* _name) : name(_name)
+	{
+		if (Trace::enabled)
+		{
+			start = Trace::Clock::now();
+		}
+	}
+	~TraceSpan()
+	{
+		if (Trace::enabled)
+		{
+			Trace::record(name, start, Trace::Clock::now());
+		}
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* name;
+	Trace::Clock::time_point start;
+};
\ No newline at end of file